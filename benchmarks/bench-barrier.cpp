@@ -0,0 +1,83 @@
+#include "bench.h"
+#include "barrier.h"
+#include "cyclicbarrier.h"
+#include "treebarrier.h"
+#include <barrier>
+#include <memory>
+
+// Barrier is one-shot, so every round gets a fresh one.
+struct OneShotBarriers {
+    OneShotBarriers(size_t num_threads, size_t rounds) {
+        for (size_t i = 0; i < rounds; i++) {
+            barriers.emplace_back(new Barrier { num_threads });
+        }
+    }
+    void arrive_and_wait(size_t, size_t round) {
+        barriers[round]->check_in_and_wait();
+    }
+
+    std::vector<std::unique_ptr<Barrier>> barriers;
+};
+
+struct CyclicBarrierAdapter {
+    CyclicBarrierAdapter(size_t num_threads, size_t) : barrier(num_threads) { }
+    void arrive_and_wait(size_t, size_t) {
+        barrier.arrive_and_wait();
+    }
+
+    CyclicBarrier<> barrier;
+};
+
+struct TreeBarrierAdapter {
+    TreeBarrierAdapter(size_t num_threads, size_t) : barrier(num_threads) { }
+    void arrive_and_wait(size_t thread_index, size_t) {
+        barrier.arrive_and_wait(thread_index);
+    }
+
+    TreeBarrier<> barrier;
+};
+
+struct StdBarrier {
+    StdBarrier(size_t num_threads, size_t) : barrier(num_threads) { }
+    void arrive_and_wait(size_t, size_t) {
+        barrier.arrive_and_wait();
+    }
+
+    std::barrier<> barrier;
+};
+
+template<typename B>
+static void run(const BenchOptions &options, const char *impl) {
+    constexpr size_t rounds = 2000;
+    for (size_t cs : options.cs_lengths) {
+        for (size_t num_threads : options.threads) {
+            B barrier { num_threads, rounds };
+            std::vector<std::thread> threads;
+            uint64_t start = now_ns();
+            for (size_t i = 0; i < num_threads; i++) {
+                threads.emplace_back([&barrier, cs, i] {
+                    for (size_t round = 0; round < rounds; round++) {
+                        busy_work(cs);
+                        barrier.arrive_and_wait(i, round);
+                    }
+                });
+            }
+            for (std::thread &thread : threads) {
+                thread.join();
+            }
+            uint64_t elapsed = now_ns() - start;
+            report(
+                "barrier", impl, "round_latency", params(num_threads, cs),
+                (double) elapsed / rounds, "ns/round"
+            );
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options = parse_options(argc, argv);
+    run<OneShotBarriers>(options, "Barrier");
+    run<CyclicBarrierAdapter>(options, "CyclicBarrier");
+    run<TreeBarrierAdapter>(options, "TreeBarrier");
+    run<StdBarrier>(options, "std::barrier");
+}
@@ -0,0 +1,90 @@
+#include "bench.h"
+#include "channel.h"
+#include "semaphore.h"
+#include "mutex.h"
+#include <deque>
+#include <optional>
+
+// What we'd use without a channel: a queue under a mutex, with a semaphore
+// each for the free slots and for the items.
+struct SemaphoreQueue {
+    SemaphoreQueue(size_t capacity) : free_slots(capacity), items(0) { }
+    void send(size_t item) {
+        free_slots.down();
+        mutex.lock();
+        queue.push_back(item);
+        mutex.unlock();
+        items.up();
+    }
+    size_t recv() {
+        items.down();
+        mutex.lock();
+        size_t item = queue.front();
+        queue.pop_front();
+        mutex.unlock();
+        free_slots.up();
+        return item;
+    }
+
+    Semaphore free_slots;
+    Semaphore items;
+    Mutex mutex;
+    std::deque<size_t> queue;
+};
+
+struct ChannelAdapter {
+    ChannelAdapter(size_t capacity) : channel(capacity) { }
+    void send(size_t item) {
+        channel.send(std::move(item));
+    }
+    size_t recv() {
+        return *channel.recv();
+    }
+
+    Channel<size_t> channel;
+};
+
+// Run as many producers as consumers, passing a fixed number of items.
+template<typename Queue>
+static void run(const BenchOptions &options, const char *impl) {
+    constexpr size_t capacity = 1024;
+    constexpr size_t items_per_producer = 200000;
+    std::string extra = ", \"capacity\": " + std::to_string(capacity);
+    for (size_t num_threads : options.threads) {
+        size_t producers = std::max((size_t) 1, num_threads / 2);
+        Queue queue { capacity };
+        PerfCounters counters { options.perf };
+        std::vector<std::thread> threads;
+        counters.start();
+        uint64_t start = now_ns();
+        for (size_t i = 0; i < producers; i++) {
+            threads.emplace_back([&queue] {
+                for (size_t j = 0; j < items_per_producer; j++) {
+                    queue.send(j);
+                }
+            });
+            threads.emplace_back([&queue] {
+                for (size_t j = 0; j < items_per_producer; j++) {
+                    queue.recv();
+                }
+            });
+        }
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+        uint64_t elapsed = now_ns() - start;
+        counters.stop();
+        report(
+            "channel", impl, "transfer_throughput",
+            params(2 * producers, 0) + extra,
+            producers * items_per_producer * 1e9 / elapsed, "items/s",
+            counters.json()
+        );
+    }
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options = parse_options(argc, argv);
+    run<ChannelAdapter>(options, "Channel");
+    run<SemaphoreQueue>(options, "Semaphore+Mutex");
+}
@@ -0,0 +1,80 @@
+#include "bench.h"
+#include "event.h"
+#include "mutex.h"
+#include "condvar.h"
+
+// How long it takes the threads blocked in event.wait()
+// to get going once another thread calls event.notify().
+static void run_event(const BenchOptions &options, size_t num_waiters) {
+    std::vector<uint64_t> samples;
+    Mutex samples_mutex;
+    for (size_t i = 0; i < options.samples / num_waiters; i++) {
+        Event event;
+        std::atomic_uint64_t notified_at { 0 };
+        std::vector<std::thread> threads;
+        for (size_t j = 0; j < num_waiters; j++) {
+            threads.emplace_back([&] {
+                event.wait();
+                uint64_t latency = now_ns() - notified_at.load();
+                samples_mutex.lock();
+                samples.push_back(latency);
+                samples_mutex.unlock();
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+        notified_at.store(now_ns());
+        event.notify();
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+    }
+    report_percentiles(
+        "event", "Event", "wake_latency", params(num_waiters + 1, 0), samples
+    );
+}
+
+static void run_condvar(const BenchOptions &options, size_t num_waiters) {
+    std::vector<uint64_t> samples;
+    Mutex mutex;
+    CondVar condvar { mutex };
+    for (size_t i = 0; i < options.samples / num_waiters; i++) {
+        bool notified = false;
+        uint64_t notified_at = 0;
+        std::vector<std::thread> threads;
+        for (size_t j = 0; j < num_waiters; j++) {
+            threads.emplace_back([&] {
+                mutex.lock();
+                condvar.wait([&notified] { return notified; });
+                samples.push_back(now_ns() - notified_at);
+                mutex.unlock();
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+        mutex.lock();
+        notified = true;
+        notified_at = now_ns();
+        mutex.unlock();
+        condvar.notify_all();
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+    }
+    report_percentiles(
+        "event", "CondVar", "wake_latency", params(num_waiters + 1, 0), samples
+    );
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options = parse_options(argc, argv);
+
+    Event event;
+    event.notify();
+    measure_uncontended("event", "Event", [&event] {
+        event.wait();
+    });
+
+    for (size_t num_threads : options.threads) {
+        run_event(options, num_threads);
+        run_condvar(options, num_threads);
+    }
+}
@@ -0,0 +1,49 @@
+#include "bench.h"
+#include "lockstripe.h"
+#include "mutex.h"
+#include <array>
+
+// The same table of locks, just packed together.
+template<size_t N>
+struct PackedStripe {
+    template<typename Key>
+    void lock(const Key &key) {
+        locks[LockStripe<Mutex, N>::shard_of(key)].lock();
+    }
+    template<typename Key>
+    void unlock(const Key &key) {
+        locks[LockStripe<Mutex, N>::shard_of(key)].unlock();
+    }
+
+    std::array<Mutex, N> locks;
+};
+
+template<typename Stripe>
+static void run(const BenchOptions &options, const char *impl) {
+    Stripe stripe;
+    measure_uncontended("lockstripe", impl, [&stripe] {
+        stripe.lock(35);
+        stripe.unlock(35);
+    });
+
+    // Each thread keeps locking a key of its own, so unless two of the keys
+    // hash onto the same shard, the threads only fight over cache lines.
+    for (size_t cs : options.cs_lengths) {
+        for (size_t num_threads : options.threads) {
+            measure_throughput(
+                options, "lockstripe", impl, num_threads, cs,
+                [&stripe, cs] (size_t thread) {
+                    stripe.lock(thread);
+                    busy_work(cs);
+                    stripe.unlock(thread);
+                }
+            );
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options = parse_options(argc, argv);
+    run<LockStripe<Mutex, 256>>(options, "LockStripe<Mutex>");
+    run<PackedStripe<256>>(options, "Mutex[]");
+}
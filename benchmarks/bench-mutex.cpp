@@ -0,0 +1,102 @@
+#include "bench.h"
+#include "mutex.h"
+#include "spinlock.h"
+#include "mcslock.h"
+#include "cohortlock.h"
+#include "compactmutex.h"
+#include "pimutex.h"
+#include "event.h"
+#include <mutex>
+#include <memory>
+
+template<typename Lock>
+static void run(const BenchOptions &options, const char *impl) {
+    Lock lock;
+    measure_uncontended("mutex", impl, [&lock] {
+        lock.lock();
+        lock.unlock();
+    });
+
+    for (size_t cs : options.cs_lengths) {
+        for (size_t num_threads : options.threads) {
+            measure_throughput(
+                options, "mutex", impl, num_threads, cs,
+                [&lock, cs] (size_t) {
+                    lock.lock();
+                    busy_work(cs);
+                    lock.unlock();
+                    // Give the others a chance to grab it.
+                    busy_work(cs);
+                }
+            );
+        }
+    }
+
+    // How long it takes a waiter to get going once the
+    // thread holding the lock has released it.
+    std::vector<uint64_t> samples;
+    for (size_t i = 0; i < options.samples; i++) {
+        std::atomic_uint64_t unlocked_at { 0 };
+        Event waiting;
+        lock.lock();
+        std::thread waiter { [&] {
+            waiting.notify();
+            lock.lock();
+            uint64_t latency = now_ns() - unlocked_at.load();
+            lock.unlock();
+            samples.push_back(latency);
+        } };
+        waiting.wait();
+        // Make it likely that the waiter actually has to wait.
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+        unlocked_at.store(now_ns());
+        lock.unlock();
+        waiter.join();
+    }
+    report_percentiles("mutex", impl, "handoff_latency", params(2, 0), samples);
+
+    // How long each acquisition takes with all the threads hammering the lock,
+    // including the unlucky ones that keep losing to the threads barging in.
+    size_t num_threads = options.threads.back();
+    for (size_t cs : options.cs_lengths) {
+        std::vector<std::vector<uint64_t>> per_thread(num_threads);
+        std::atomic_bool stop { false };
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < num_threads; t++) {
+            threads.emplace_back([&, t] {
+                while (!stop.load(std::memory_order_relaxed)) {
+                    uint64_t start = now_ns();
+                    lock.lock();
+                    per_thread[t].push_back(now_ns() - start);
+                    busy_work(cs);
+                    lock.unlock();
+                }
+            });
+        }
+        std::this_thread::sleep_for(
+            std::chrono::duration<double>(options.duration)
+        );
+        stop.store(true);
+        samples.clear();
+        for (size_t t = 0; t < num_threads; t++) {
+            threads[t].join();
+            samples.insert(
+                samples.end(), per_thread[t].begin(), per_thread[t].end()
+            );
+        }
+        report_percentiles(
+            "mutex", impl, "acquire_latency", params(num_threads, cs), samples
+        );
+    }
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options = parse_options(argc, argv);
+    run<Mutex>(options, "Mutex");
+    run<Spinlock>(options, "Spinlock");
+    run<MCSLock>(options, "MCSLock");
+    run<CohortLock>(options, "CohortLock");
+    run<CompactMutex>(options, "CompactMutex");
+    run<PIMutex>(options, "PIMutex");
+    run<std::mutex>(options, "std::mutex");
+}
@@ -0,0 +1,95 @@
+#include "bench.h"
+#include "rwlock.h"
+#include "biasedrwlock.h"
+#include "compactrwlock.h"
+#include <pthread.h>
+
+struct PthreadRWLock {
+    PthreadRWLock() { pthread_rwlock_init(&lock, nullptr); }
+    ~PthreadRWLock() { pthread_rwlock_destroy(&lock); }
+    void lock_read() { pthread_rwlock_rdlock(&lock); }
+    void unlock_read() { pthread_rwlock_unlock(&lock); }
+    void lock_write() { pthread_rwlock_wrlock(&lock); }
+    void unlock_write() { pthread_rwlock_unlock(&lock); }
+
+    pthread_rwlock_t lock;
+};
+
+// Keeps the read token on the side, so that
+// the same benchmark code can be used for all locks.
+struct BiasedRWLockAdapter {
+    void lock_read() { token = lock.lock_read(); }
+    void unlock_read() { lock.unlock_read(token); }
+    void lock_write() { lock.lock_write(); }
+    void unlock_write() { lock.unlock_write(); }
+
+    BiasedRWLock lock;
+    static inline thread_local BiasedRWLock::ReadToken token;
+};
+
+// Reads optimistically, falling back to actually locking when a writer holds
+// the lock. The benchmark doesn't read anything, so there's nothing to retry
+// when validation fails, but it still pays for the validation.
+struct OptimisticRWLockAdapter {
+    void lock_read() {
+        stamp = lock.try_optimistic_read();
+        if (!stamp) {
+            lock.lock_read();
+        }
+    }
+    void unlock_read() {
+        if (!stamp) {
+            lock.unlock_read();
+        } else {
+            lock.validate(stamp);
+        }
+    }
+    void lock_write() { lock.lock_write(); }
+    void unlock_write() { lock.unlock_write(); }
+
+    RWLock lock;
+    static inline thread_local uint32_t stamp;
+};
+
+template<typename Lock>
+static void run(const BenchOptions &options, const char *impl) {
+    Lock lock;
+    measure_uncontended("rwlock", impl, [&lock] {
+        lock.lock_read();
+        lock.unlock_read();
+    });
+
+    // Percentage of the operations that are writes.
+    for (size_t write_pct : { 0, 10, 50 }) {
+        std::string extra = ", \"write_pct\": " + std::to_string(write_pct);
+        for (size_t cs : options.cs_lengths) {
+            for (size_t num_threads : options.threads) {
+                measure_throughput(
+                    options, "rwlock", impl, num_threads, cs,
+                    [&lock, cs, write_pct, n = size_t(0)] (size_t) mutable {
+                        if (++n % 100 < write_pct) {
+                            lock.lock_write();
+                            busy_work(cs);
+                            lock.unlock_write();
+                        } else {
+                            lock.lock_read();
+                            busy_work(cs);
+                            lock.unlock_read();
+                        }
+                        busy_work(cs);
+                    },
+                    extra
+                );
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options = parse_options(argc, argv);
+    run<RWLock>(options, "RWLock");
+    run<OptimisticRWLockAdapter>(options, "RWLock (optimistic)");
+    run<BiasedRWLockAdapter>(options, "BiasedRWLock");
+    run<CompactRWLock>(options, "CompactRWLock");
+    run<PthreadRWLock>(options, "pthread_rwlock_t");
+}
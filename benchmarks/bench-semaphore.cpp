@@ -0,0 +1,73 @@
+#include "bench.h"
+#include "semaphore.h"
+#include "percpusemaphore.h"
+#include <semaphore.h>
+
+struct PosixSemaphore {
+    PosixSemaphore(size_t initial_value) { sem_init(&sem, 0, initial_value); }
+    ~PosixSemaphore() { sem_destroy(&sem); }
+    void down() { while (sem_wait(&sem) != 0) { } }
+    void up() { sem_post(&sem); }
+
+    sem_t sem;
+};
+
+template<typename Sem>
+static void run(const BenchOptions &options, const char *impl) {
+    Sem uncontended { 1 };
+    measure_uncontended("semaphore", impl, [&uncontended] {
+        uncontended.down();
+        uncontended.up();
+    });
+
+    // A pool with a few slots, shared by more threads than that, and a pool
+    // with plenty of slots for everyone.
+    for (size_t slots : { 4, 1024 }) {
+        Sem pool { slots };
+        std::string extra = ", \"slots\": " + std::to_string(slots);
+        for (size_t cs : options.cs_lengths) {
+            for (size_t num_threads : options.threads) {
+                measure_throughput(
+                    options, "semaphore", impl, num_threads, cs,
+                    [&pool, cs] (size_t) {
+                        pool.down();
+                        busy_work(cs);
+                        pool.up();
+                        busy_work(cs);
+                    },
+                    extra
+                );
+            }
+        }
+    }
+
+    // How long it takes a thread blocked in down() to
+    // get going once another thread calls up().
+    std::vector<uint64_t> samples;
+    Sem ping { 0 }, pong { 0 };
+    std::atomic_uint64_t up_at { 0 };
+    std::thread waiter { [&] {
+        for (size_t i = 0; i < options.samples; i++) {
+            ping.down();
+            samples.push_back(now_ns() - up_at.load());
+            pong.up();
+        }
+    } };
+    for (size_t i = 0; i < options.samples; i++) {
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+        up_at.store(now_ns());
+        ping.up();
+        pong.down();
+    }
+    waiter.join();
+    report_percentiles(
+        "semaphore", impl, "wake_latency", params(2, 0), samples
+    );
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options = parse_options(argc, argv);
+    run<Semaphore>(options, "Semaphore");
+    run<PerCpuSemaphore>(options, "PerCpuSemaphore");
+    run<PosixSemaphore>(options, "sem_t");
+}
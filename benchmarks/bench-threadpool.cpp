@@ -0,0 +1,62 @@
+#include "bench.h"
+#include "threadpool.h"
+
+static uint64_t fib(ThreadPool &pool, uint64_t n) {
+    if (n < 20) {
+        return n < 2 ? n : fib(pool, n - 1) + fib(pool, n - 2);
+    }
+    uint64_t a, b;
+    TaskGroup group { pool };
+    group.spawn([&pool, &a, n] {
+        a = fib(pool, n - 1);
+    });
+    b = fib(pool, n - 2);
+    group.wait();
+    return a + b;
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options = parse_options(argc, argv);
+    for (size_t num_threads : options.threads) {
+        ThreadPool pool { num_threads };
+
+        // The cost of spawning and running an empty task, with the
+        // spawning done from inside the pool, like it usually is.
+        constexpr size_t num_tasks = 1000000;
+        uint64_t elapsed;
+        {
+            TaskGroup outer { pool };
+            outer.spawn([&pool, &elapsed] {
+                uint64_t start = now_ns();
+                TaskGroup group { pool };
+                for (size_t i = 0; i < num_tasks; i++) {
+                    group.spawn([] { });
+                }
+                group.wait();
+                elapsed = now_ns() - start;
+            });
+        }
+        report(
+            "threadpool", "ThreadPool", "spawn_latency",
+            params(num_threads, 0), (double) elapsed / num_tasks, "ns/task"
+        );
+
+        // Fork-join, with plenty of tasks to steal.
+        uint64_t start = now_ns();
+        uint64_t result;
+        {
+            TaskGroup group { pool };
+            group.spawn([&pool, &result] {
+                result = fib(pool, 32);
+            });
+        }
+        elapsed = now_ns() - start;
+        if (result != 2178309) {
+            abort();
+        }
+        report(
+            "threadpool", "ThreadPool", "fork_join_time",
+            params(num_threads, 0), elapsed / 1e6, "ms"
+        );
+    }
+}
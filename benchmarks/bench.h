@@ -0,0 +1,292 @@
+#pragma once
+
+// A tiny benchmarking harness shared by all the benchmarks.
+//
+// Every measurement is printed to stdout as a single line of JSON, so that the
+// results of different runs can be collected and compared mechanically. Human-
+// readable progress, if any, goes to stderr.
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+struct BenchOptions {
+    std::vector<size_t> threads;
+    // Critical section lengths, in iterations of busy_work().
+    std::vector<size_t> cs_lengths { 0, 50, 500 };
+    double duration = 0.1;
+    size_t samples = 1000;
+    bool perf = false;
+};
+
+inline std::vector<size_t> parse_list(const char *s) {
+    std::vector<size_t> list;
+    while (*s) {
+        char *end;
+        size_t value = strtoul(s, &end, 10);
+        if (end == s) {
+            break;
+        }
+        list.push_back(value);
+        s = *end == ',' ? end + 1 : end;
+    }
+    return list;
+}
+
+inline BenchOptions parse_options(int argc, char *argv[]) {
+    BenchOptions options;
+    size_t max_threads = 2 * std::max(4u, std::thread::hardware_concurrency());
+    for (size_t n = 1; n <= max_threads; n *= 2) {
+        options.threads.push_back(n);
+    }
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (!strncmp(arg, "--threads=", 10)) {
+            options.threads = parse_list(arg + 10);
+        } else if (!strncmp(arg, "--cs=", 5)) {
+            options.cs_lengths = parse_list(arg + 5);
+        } else if (!strncmp(arg, "--duration=", 11)) {
+            options.duration = atof(arg + 11);
+        } else if (!strncmp(arg, "--samples=", 10)) {
+            options.samples = strtoul(arg + 10, nullptr, 10);
+        } else if (!strcmp(arg, "--perf")) {
+            options.perf = true;
+        } else {
+            fprintf(
+                stderr,
+                "Usage: %s [--threads=N,...] [--cs=N,...] [--duration=SECONDS]"
+                " [--samples=N] [--perf]\n",
+                argv[0]
+            );
+            exit(2);
+        }
+    }
+    if (getenv("BENCH_PERF")) {
+        options.perf = true;
+    }
+    return options;
+}
+
+inline uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+// Simulate a critical section of the given length.
+inline void busy_work(size_t iterations) {
+    for (size_t i = 0; i < iterations; i++) {
+        asm volatile("" ::: "memory");
+    }
+}
+
+// Hardware and software counters for the whole process, including the threads
+// spawned while counting. Only available if perf_event_open() is permitted;
+// otherwise, the counters are reported as null.
+class PerfCounters {
+public:
+    PerfCounters(bool enabled) {
+        if (!enabled) {
+            return;
+        }
+        cache_misses_fd = open(
+            PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, true
+        );
+        // Context switches only ever happen in the kernel, so excluding it
+        // would leave nothing to count.
+        context_switches_fd = open(
+            PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, false
+        );
+    }
+
+    ~PerfCounters() {
+        if (cache_misses_fd >= 0) {
+            close(cache_misses_fd);
+        }
+        if (context_switches_fd >= 0) {
+            close(context_switches_fd);
+        }
+    }
+
+    void start() {
+        for (int fd : { cache_misses_fd, context_switches_fd }) {
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+
+    void stop() {
+        cache_misses = read_counter(cache_misses_fd);
+        context_switches = read_counter(context_switches_fd);
+    }
+
+    // Formatted as JSON fields, to be appended to a record.
+    std::string json() const {
+        return ", \"cache_misses\": " + format(cache_misses) +
+            ", \"context_switches\": " + format(context_switches);
+    }
+
+private:
+    static int open(uint32_t type, uint64_t config, bool exclude_kernel) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = exclude_kernel;
+        attr.exclude_hv = 1;
+        return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    static int64_t read_counter(int fd) {
+        if (fd < 0) {
+            return -1;
+        }
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t value;
+        if (read(fd, &value, sizeof(value)) != sizeof(value)) {
+            return -1;
+        }
+        return value;
+    }
+
+    static std::string format(int64_t value) {
+        return value < 0 ? "null" : std::to_string(value);
+    }
+
+    int cache_misses_fd = -1;
+    int context_switches_fd = -1;
+    int64_t cache_misses = -1;
+    int64_t context_switches = -1;
+};
+
+inline void report(
+    const char *benchmark, const char *impl, const char *metric,
+    const std::string &params, double value, const char *unit,
+    const std::string &extra = ""
+) {
+    printf(
+        "{\"benchmark\": \"%s\", \"impl\": \"%s\", \"metric\": \"%s\"%s, "
+        "\"value\": %.3f, \"unit\": \"%s\"%s}\n",
+        benchmark, impl, metric, params.c_str(), value, unit, extra.c_str()
+    );
+    fflush(stdout);
+}
+
+inline std::string params(size_t threads, size_t cs) {
+    return ", \"threads\": " + std::to_string(threads) +
+        ", \"cs\": " + std::to_string(cs);
+}
+
+// Measure the average latency of a single operation with no contention.
+template<typename F>
+inline void measure_uncontended(
+    const char *benchmark, const char *impl, F &&op
+) {
+    constexpr size_t iterations = 1000000;
+    for (size_t i = 0; i < iterations / 10; i++) {
+        op();
+    }
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < iterations; i++) {
+        op();
+    }
+    uint64_t elapsed = now_ns() - start;
+    report(
+        benchmark, impl, "uncontended_latency", params(1, 0),
+        (double) elapsed / iterations, "ns/op"
+    );
+}
+
+// Run op(thread_index) in a loop on the given number of threads for a while,
+// and report the total throughput.
+template<typename F>
+inline void measure_throughput(
+    const BenchOptions &options, const char *benchmark, const char *impl,
+    size_t num_threads, size_t cs, F &&op, const std::string &extra_params = ""
+) {
+    std::atomic_bool go { false };
+    std::atomic_bool stop { false };
+    std::atomic_size_t ready { 0 };
+    std::atomic_uint64_t total { 0 };
+    PerfCounters counters { options.perf };
+    std::vector<std::thread> threads;
+
+    counters.start();
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([&, i] {
+            ready.fetch_add(1, std::memory_order_relaxed);
+            while (!go.load(std::memory_order_acquire)) {
+                sched_yield();
+            }
+            uint64_t ops = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                op(i);
+                ops++;
+            }
+            total.fetch_add(ops, std::memory_order_relaxed);
+        });
+    }
+    while (ready.load(std::memory_order_relaxed) != num_threads) {
+        sched_yield();
+    }
+    uint64_t start = now_ns();
+    go.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+    stop.store(true, std::memory_order_relaxed);
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    uint64_t elapsed = now_ns() - start;
+    counters.stop();
+
+    double ops_per_sec = total.load() * 1e9 / elapsed;
+    report(
+        benchmark, impl, "contended_throughput",
+        params(num_threads, cs) + extra_params, ops_per_sec, "ops/s", counters.json()
+    );
+}
+
+// Report the percentiles of a set of latency samples, in nanoseconds.
+inline void report_percentiles(
+    const char *benchmark, const char *impl, const char *metric,
+    const std::string &params, std::vector<uint64_t> &samples
+) {
+    if (samples.empty()) {
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    static const std::pair<const char *, double> percentiles[] = {
+        { "p50", 0.5 }, { "p90", 0.9 }, { "p99", 0.99 }, { "p999", 0.999 },
+        { "p9999", 0.9999 },
+    };
+    std::string extra;
+    for (auto [name, fraction] : percentiles) {
+        size_t index = std::min(
+            samples.size() - 1, (size_t) (fraction * samples.size())
+        );
+        extra += ", \"" + std::string(name) + "\": " +
+            std::to_string(samples[index]);
+    }
+    extra += ", \"samples\": " + std::to_string(samples.size());
+    report(
+        benchmark, impl, metric, params,
+        samples[samples.size() / 2], "ns", extra
+    );
+}
@@ -0,0 +1,370 @@
+#pragma once
+
+// Awaitable counterparts of Mutex, Semaphore, Event and CyclicBarrier, for
+// code running in C++20 coroutines. Where their blocking counterparts put the
+// whole thread to sleep on a futex, these suspend just the awaiting coroutine,
+// linking it into an intrusive list of waiters (the awaiter object lives in the
+// coroutine frame, so nothing gets allocated), and whoever releases the
+// primitive resumes the waiting coroutines directly, on its own thread, rather
+// than calling futex_wake(). No syscalls are made at all.
+//
+// Since resuming happens inline, a coroutine that releases a primitive may
+// run the next waiter's code before its own call returns; if that waiter then
+// releases the primitive too, it resumes the next one, and so on. Code that
+// needs to bound this should resume the coroutines on an executor instead.
+
+#if !defined(__cpp_impl_coroutine)
+#error "async.h requires C++20 coroutines"
+#endif
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include "spinlock.h"
+#include "util.h"
+
+class AsyncMutex {
+public:
+    class LockOperation {
+    public:
+        bool await_ready() noexcept {
+            return mutex.try_lock();
+        }
+        bool await_suspend(std::coroutine_handle<> handle) noexcept;
+        void await_resume() noexcept { }
+
+    private:
+        friend class AsyncMutex;
+        LockOperation(AsyncMutex &mutex) : mutex(mutex) { }
+
+        AsyncMutex &mutex;
+        std::coroutine_handle<> handle;
+        LockOperation *next;
+    };
+
+    // co_await mutex.lock_async();
+    LockOperation lock_async() {
+        return LockOperation(*this);
+    }
+    bool try_lock() {
+        uintptr_t state2 = not_locked;
+        return state.compare_exchange_strong(
+            state2, locked_no_waiters,
+            std::memory_order_acquire, std::memory_order_relaxed
+        );
+    }
+    // Hands the mutex over to the next waiter, if any, and resumes it.
+    void unlock();
+
+private:
+    // The state is either one of these, or a pointer to the most recently
+    // arrived waiter, which links to the one that arrived before it, and so
+    // on. Arriving waiters push themselves with a compare-and-swap; only
+    // the thread holding the mutex ever takes them off.
+    constexpr static uintptr_t not_locked = 1;
+    constexpr static uintptr_t locked_no_waiters = 0;
+    std::atomic_uintptr_t state { not_locked };
+    // The waiters that the holder has taken off, oldest first. Only ever
+    // touched by the thread holding the mutex.
+    LockOperation *waiters = nullptr;
+};
+
+inline bool AsyncMutex::LockOperation::await_suspend(
+    std::coroutine_handle<> handle
+) noexcept {
+    this->handle = handle;
+    uintptr_t state2 = mutex.state.load(std::memory_order_relaxed);
+    while (true) {
+        if (state2 == not_locked) {
+            bool have_exchanged = mutex.state.compare_exchange_weak(
+                state2, locked_no_waiters,
+                std::memory_order_acquire, std::memory_order_relaxed
+            );
+            if (have_exchanged) {
+                // Got it after all, so don't suspend.
+                return false;
+            }
+            continue;
+        }
+        next = reinterpret_cast<LockOperation *>(state2);
+        bool have_exchanged = mutex.state.compare_exchange_weak(
+            state2, reinterpret_cast<uintptr_t>(this),
+            std::memory_order_release, std::memory_order_relaxed
+        );
+        if (LIKELY(have_exchanged)) {
+            return true;
+        }
+    }
+}
+
+inline void AsyncMutex::unlock() {
+    LockOperation *waiter = waiters;
+    if (LIKELY(!waiter)) {
+        uintptr_t state2 = locked_no_waiters;
+        bool have_exchanged = state.compare_exchange_strong(
+            state2, not_locked,
+            std::memory_order_release, std::memory_order_relaxed
+        );
+        if (LIKELY(have_exchanged)) {
+            return;
+        }
+        // Some waiters have arrived; take them all, and put them in the order
+        // they have arrived in.
+        state2 = state.exchange(locked_no_waiters, std::memory_order_acquire);
+        LockOperation *stack = reinterpret_cast<LockOperation *>(state2);
+        while (stack) {
+            LockOperation *next = stack->next;
+            stack->next = waiter;
+            waiter = stack;
+            stack = next;
+        }
+    }
+    // The mutex stays locked, and now belongs to the waiter.
+    waiters = waiter->next;
+    waiter->handle.resume();
+}
+
+class AsyncSemaphore {
+public:
+    class DownOperation {
+    public:
+        bool await_ready() noexcept {
+            return semaphore.try_down();
+        }
+        bool await_suspend(std::coroutine_handle<> handle) noexcept;
+        void await_resume() noexcept { }
+
+    private:
+        friend class AsyncSemaphore;
+        DownOperation(AsyncSemaphore &semaphore) : semaphore(semaphore) { }
+
+        AsyncSemaphore &semaphore;
+        std::coroutine_handle<> handle;
+        DownOperation *next = nullptr;
+    };
+
+    AsyncSemaphore(int64_t initial_value) : count(initial_value) { }
+
+    // co_await semaphore.down_async();
+    DownOperation down_async() {
+        return DownOperation(*this);
+    }
+    bool try_down() {
+        int64_t count2 = count.load(std::memory_order_relaxed);
+        while (count2 > 0) {
+            bool have_exchanged = count.compare_exchange_weak(
+                count2, count2 - 1,
+                std::memory_order_acquire, std::memory_order_relaxed
+            );
+            if (LIKELY(have_exchanged)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    // Hands the unit over to the oldest waiter, if any, and resumes it.
+    void up();
+
+private:
+    // When negative, this is minus the number of coroutines that are waiting
+    // (or about to). Only those touch the list, so taking and releasing units
+    // while nobody waits is a single atomic operation.
+    std::atomic_int64_t count;
+    // The waiters, oldest first.
+    Spinlock lock;
+    DownOperation *head = nullptr;
+    DownOperation *tail = nullptr;
+    // Units handed over to waiters that haven't made it to the list yet.
+    size_t pending = 0;
+};
+
+inline bool AsyncSemaphore::DownOperation::await_suspend(
+    std::coroutine_handle<> handle
+) noexcept {
+    int64_t count2 = semaphore.count.fetch_sub(1, std::memory_order_acquire);
+    if (LIKELY(count2 > 0)) {
+        return false;
+    }
+    this->handle = handle;
+    semaphore.lock.lock();
+    if (semaphore.pending) {
+        // The unit has been handed over before we've made it to the list.
+        semaphore.pending--;
+        semaphore.lock.unlock();
+        return false;
+    }
+    if (semaphore.tail) {
+        semaphore.tail->next = this;
+    } else {
+        semaphore.head = this;
+    }
+    semaphore.tail = this;
+    semaphore.lock.unlock();
+    return true;
+}
+
+inline void AsyncSemaphore::up() {
+    int64_t count2 = count.fetch_add(1, std::memory_order_release);
+    if (LIKELY(count2 >= 0)) {
+        return;
+    }
+    // Somebody is waiting, or is about to.
+    lock.lock();
+    DownOperation *waiter = head;
+    if (waiter) {
+        head = waiter->next;
+        if (!head) {
+            tail = nullptr;
+        }
+    } else {
+        pending++;
+    }
+    lock.unlock();
+    if (waiter) {
+        waiter->handle.resume();
+    }
+}
+
+class AsyncEvent {
+public:
+    class WaitOperation {
+    public:
+        bool await_ready() noexcept {
+            return event.try_wait();
+        }
+        bool await_suspend(std::coroutine_handle<> handle) noexcept;
+        void await_resume() noexcept { }
+
+    private:
+        friend class AsyncEvent;
+        WaitOperation(AsyncEvent &event) : event(event) { }
+
+        AsyncEvent &event;
+        std::coroutine_handle<> handle;
+        WaitOperation *next;
+    };
+
+    // Resumes all the waiting coroutines.
+    void notify();
+    // co_await event.wait_async();
+    WaitOperation wait_async() {
+        return WaitOperation(*this);
+    }
+    bool try_wait() {
+        return state.load(std::memory_order_acquire) == set_state();
+    }
+
+private:
+    // The state is null if not notified, the address of the event itself if
+    // notified, or otherwise a pointer to the most recently arrived waiter,
+    // which links to the one that arrived before it, and so on.
+    uintptr_t set_state() const {
+        return reinterpret_cast<uintptr_t>(this);
+    }
+    std::atomic_uintptr_t state { 0 };
+};
+
+inline bool AsyncEvent::WaitOperation::await_suspend(
+    std::coroutine_handle<> handle
+) noexcept {
+    this->handle = handle;
+    uintptr_t state2 = event.state.load(std::memory_order_acquire);
+    do {
+        if (state2 == event.set_state()) {
+            return false;
+        }
+        next = reinterpret_cast<WaitOperation *>(state2);
+    } while (UNLIKELY(!event.state.compare_exchange_weak(
+        state2, reinterpret_cast<uintptr_t>(this),
+        std::memory_order_release, std::memory_order_acquire
+    )));
+    return true;
+}
+
+inline void AsyncEvent::notify() {
+    uintptr_t state2 = state.exchange(set_state(), std::memory_order_acq_rel);
+    if (state2 == set_state()) {
+        return;
+    }
+    // Resume them in the order they have arrived in.
+    WaitOperation *stack = reinterpret_cast<WaitOperation *>(state2);
+    WaitOperation *waiter = nullptr;
+    while (stack) {
+        WaitOperation *next = stack->next;
+        stack->next = waiter;
+        waiter = stack;
+        stack = next;
+    }
+    while (waiter) {
+        // Resuming it may well destroy it.
+        WaitOperation *next = waiter->next;
+        waiter->handle.resume();
+        waiter = next;
+    }
+}
+
+// A reusable barrier, like CyclicBarrier.
+class AsyncBarrier {
+public:
+    class ArriveOperation {
+    public:
+        bool await_ready() noexcept {
+            return false;
+        }
+        bool await_suspend(std::coroutine_handle<> handle) noexcept;
+        void await_resume() noexcept { }
+
+    private:
+        friend class AsyncBarrier;
+        ArriveOperation(AsyncBarrier &barrier) : barrier(barrier) { }
+
+        AsyncBarrier &barrier;
+        std::coroutine_handle<> handle;
+        ArriveOperation *next;
+    };
+
+    AsyncBarrier(size_t expected) : remaining(expected), expected(expected) { }
+
+    // co_await barrier.arrive_and_wait_async();
+    ArriveOperation arrive_and_wait_async() {
+        return ArriveOperation(*this);
+    }
+
+private:
+    std::atomic_size_t remaining;
+    const size_t expected;
+    // The coroutines that have arrived in this phase, most recent first.
+    std::atomic<ArriveOperation *> waiters { nullptr };
+};
+
+inline bool AsyncBarrier::ArriveOperation::await_suspend(
+    std::coroutine_handle<> handle
+) noexcept {
+    this->handle = handle;
+    // Push ourselves first, so that the last one to arrive finds us.
+    next = barrier.waiters.load(std::memory_order_relaxed);
+    while (UNLIKELY(!barrier.waiters.compare_exchange_weak(
+        next, this, std::memory_order_relaxed
+    ))) { }
+    size_t remaining2 = barrier.remaining.fetch_sub(
+        1, std::memory_order_acq_rel
+    );
+    if (LIKELY(remaining2 != 1)) {
+        return true;
+    }
+    // We're the last one. Nobody can arrive again until we resume them, so
+    // reset the barrier for the next phase first.
+    barrier.remaining.store(barrier.expected, std::memory_order_relaxed);
+    ArriveOperation *waiter = barrier.waiters.exchange(
+        nullptr, std::memory_order_relaxed
+    );
+    while (waiter) {
+        ArriveOperation *next = waiter->next;
+        if (waiter != this) {
+            waiter->handle.resume();
+        }
+        waiter = next;
+    }
+    return false;
+}
@@ -15,6 +15,14 @@ void Barrier::check_in() {
 }
 
 void Barrier::wait() {
+    wait_until(nullptr);
+}
+
+bool Barrier::wait_until(Deadline deadline) {
+    return wait_until(&deadline);
+}
+
+bool Barrier::wait_until(const Deadline *deadline) {
     uint32_t state2 = state.load(std::memory_order_acquire);
     while (UNLIKELY(state2 & ~need_to_wake_bit)) {
         if (!(state2 & need_to_wake_bit)) {
@@ -30,9 +38,14 @@ void Barrier::wait() {
             }
             state2 |= need_to_wake_bit;
         }
-        futex_wait((const uint32_t *) &state, state2, nullptr);
+        // Leaving the need_to_wake_bit set when giving up is harmless.
+        if (UNLIKELY(deadline_passed(deadline))) {
+            return false;
+        }
+        futex_wait_until((const uint32_t *) &state, state2, deadline);
         state2 = state.load(std::memory_order_acquire);
     }
+    return true;
 }
 
 bool Barrier::try_wait() {
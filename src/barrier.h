@@ -1,5 +1,8 @@
+#pragma once
+
 #include <atomic>
 #include <cstddef>
+#include "deadline.h"
 
 class Barrier {
 public:
@@ -12,7 +15,15 @@ public:
     void check_in_and_wait();
     bool check_in_and_try_wait();
 
+    bool wait_until(Deadline deadline);
+    template<typename Rep, typename Period>
+    bool wait_for(const std::chrono::duration<Rep, Period> &timeout) {
+        return wait_until(deadline_after(timeout));
+    }
+
 private:
+    bool wait_until(const Deadline *deadline);
+
     constexpr static uint32_t need_to_wake_bit = 1 << 31;
     std::atomic_uint32_t state;
 };
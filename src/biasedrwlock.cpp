@@ -0,0 +1,199 @@
+#include "biasedrwlock.h"
+#include "futex.h"
+#include "util.h"
+#include <sched.h>
+#include <cassert>
+#include <chrono>
+
+// How much longer than a revocation took to wait before biasing the lock
+// towards readers again. This bounds the time writers spend revoking to about
+// 1 / (1 + revocation_penalty) of the total.
+constexpr static uint64_t revocation_penalty = 9;
+
+static uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+static size_t current_slot() {
+    // This is cheap: glibc gets it from the rseq area without a syscall.
+    int cpu = sched_getcpu();
+    return (unsigned) cpu % BiasedRWLock::num_slots;
+}
+
+bool BiasedRWLock::try_lock_read_fast(ReadToken &token) {
+    if (UNLIKELY(!read_bias.load(std::memory_order_relaxed))) {
+        return false;
+    }
+    size_t slot = current_slot();
+    // Register in the slot first, and only then recheck the bias. A writer
+    // revoking the bias does the opposite: clears the bias, and only then
+    // looks at the slots. So it's impossible for both of us to miss each
+    // other; this is why both sides need sequential consistency.
+    slots[slot].readers.fetch_add(1, std::memory_order_seq_cst);
+    if (LIKELY(read_bias.load(std::memory_order_seq_cst))) {
+        token = ReadToken { slot };
+        return true;
+    }
+    // A writer is revoking the bias, back off.
+    unlock_read(ReadToken { slot });
+    return false;
+}
+
+BiasedRWLock::ReadToken BiasedRWLock::lock_read() {
+    ReadToken token;
+    if (LIKELY(try_lock_read_fast(token))) {
+        return token;
+    }
+    return lock_read_slow();
+}
+
+BiasedRWLock::ReadToken BiasedRWLock::lock_read_slow() {
+    lock.lock_read();
+    // While we hold the lock for reading, no writer can be active, so it's
+    // safe to turn the bias back on, provided it's been a while since it was
+    // last revoked. The next writer will revoke it again. Note that this
+    // store has to be a release one, so that the readers that take the fast
+    // path because of it see what the last writer has written.
+    if (!read_bias.load(std::memory_order_relaxed)) {
+        if (now() >= inhibit_until.load(std::memory_order_relaxed)) {
+            read_bias.store(true, std::memory_order_release);
+        }
+    }
+    return ReadToken { };
+}
+
+bool BiasedRWLock::try_lock_read(ReadToken &token) {
+    if (LIKELY(try_lock_read_fast(token))) {
+        return true;
+    }
+    if (!lock.try_lock_read()) {
+        return false;
+    }
+    token = ReadToken { };
+    return true;
+}
+
+void BiasedRWLock::unlock_read(ReadToken token) {
+    if (token.slot == no_slot) {
+        lock.unlock_read();
+        return;
+    }
+    slots[token.slot].readers.fetch_sub(1, std::memory_order_seq_cst);
+    if (LIKELY(read_bias.load(std::memory_order_seq_cst))) {
+        return;
+    }
+    // A writer might be waiting for the slots to drain, let it recheck.
+    // Same as above, the writer sets writer_waiting before looking at the
+    // slots, so either it sees our decrement, or we see its flag.
+    if (UNLIKELY(writer_waiting.load(std::memory_order_seq_cst))) {
+        if (writer_waiting.exchange(0, std::memory_order_relaxed)) {
+            futex_wake((const uint32_t *) &writer_waiting, 1);
+        }
+    }
+}
+
+uintptr_t BiasedRWLock::count_readers() const {
+    uintptr_t count = 0;
+    for (const Slot &slot : slots) {
+        count += slot.readers.load(std::memory_order_seq_cst);
+    }
+    return count;
+}
+
+void BiasedRWLock::wait_for_readers(uintptr_t own) {
+    // Readers that have registered in the slots are usually quick to leave,
+    // so poll for a little while first.
+    for (int i = 0; i < 100; i++) {
+        if (LIKELY(count_readers() == own)) {
+            return;
+        }
+        CPU_RELAX();
+    }
+    while (true) {
+        writer_waiting.store(1, std::memory_order_seq_cst);
+        if (count_readers() == own) {
+            break;
+        }
+        futex_wait((const uint32_t *) &writer_waiting, 1, nullptr);
+    }
+    writer_waiting.store(0, std::memory_order_relaxed);
+}
+
+void BiasedRWLock::revoke_bias() {
+    uint64_t start = now();
+    read_bias.store(false, std::memory_order_seq_cst);
+    wait_for_readers(0);
+    uint64_t end = now();
+    inhibit_until.store(
+        end + (end - start) * revocation_penalty, std::memory_order_relaxed
+    );
+}
+
+void BiasedRWLock::lock_write() {
+    lock.lock_write();
+    if (UNLIKELY(read_bias.load(std::memory_order_relaxed))) {
+        revoke_bias();
+    }
+}
+
+bool BiasedRWLock::try_lock_write() {
+    if (!lock.try_lock_write()) {
+        return false;
+    }
+    if (LIKELY(!read_bias.load(std::memory_order_relaxed))) {
+        return true;
+    }
+    // Readers might be registered in the slots, but we can't wait for them to
+    // leave. If there are any, put the bias back and give up.
+    read_bias.store(false, std::memory_order_seq_cst);
+    if (LIKELY(count_readers() == 0)) {
+        return true;
+    }
+    read_bias.store(true, std::memory_order_release);
+    lock.unlock_write();
+    return false;
+}
+
+void BiasedRWLock::unlock_write() {
+    assert(!read_bias.load(std::memory_order_relaxed));
+    lock.unlock_write();
+}
+
+bool BiasedRWLock::try_upgrade(ReadToken token) {
+    bool have_locked = token.slot == no_slot
+        ? lock.try_upgrade()
+        : lock.try_lock_write();
+    if (!have_locked) {
+        return false;
+    }
+    // Now only readers registered in the slots can remain, and
+    // we must be the only one of those, if we are one at all.
+    uintptr_t own = token.slot == no_slot ? 0 : 1;
+    bool was_biased = read_bias.load(std::memory_order_relaxed);
+    if (was_biased) {
+        read_bias.store(false, std::memory_order_seq_cst);
+    }
+    if (UNLIKELY(count_readers() != own)) {
+        // Somebody else is reading; undo everything.
+        if (was_biased) {
+            read_bias.store(true, std::memory_order_release);
+        }
+        if (token.slot == no_slot) {
+            lock.downgrade();
+        } else {
+            lock.unlock_write();
+        }
+        return false;
+    }
+    if (token.slot != no_slot) {
+        slots[token.slot].readers.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+BiasedRWLock::ReadToken BiasedRWLock::downgrade() {
+    lock.downgrade();
+    return ReadToken { };
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "cache_line.h"
+#include "rwlock.h"
+
+class BiasedRWLock {
+public:
+    // Remembers how a reader has taken the lock, so that it can be released the
+    // same way. Obtained from lock_read(), and passed back to unlock_read().
+    class ReadToken {
+    public:
+        ReadToken() = default;
+
+    private:
+        friend class BiasedRWLock;
+        explicit ReadToken(size_t slot) : slot(slot) { }
+        // Which slot the reader has registered in, or no_slot if it has taken
+        // the underlying lock instead.
+        size_t slot = no_slot;
+    };
+
+    ReadToken lock_read();
+    bool try_lock_read(ReadToken &token);
+    void unlock_read(ReadToken token);
+
+    void lock_write();
+    bool try_lock_write();
+    void unlock_write();
+
+    bool try_upgrade(ReadToken token);
+    ReadToken downgrade();
+
+    constexpr static size_t num_slots = 64;
+
+private:
+    constexpr static size_t no_slot = SIZE_MAX;
+
+    struct alignas(cache_line_size) Slot {
+        std::atomic_uintptr_t readers { 0 };
+    };
+
+    ReadToken lock_read_slow();
+    bool try_lock_read_fast(ReadToken &token);
+    void revoke_bias();
+    void wait_for_readers(uintptr_t own);
+    uintptr_t count_readers() const;
+
+    // Readers only read these while the bias is on, so keep them
+    // away from the slots and the underlying lock.
+    alignas(cache_line_size) std::atomic_bool read_bias { true };
+    // Set by a writer waiting for the slots to drain.
+    std::atomic_uint32_t writer_waiting { 0 };
+    // When the bias can be turned back on, in nanoseconds.
+    std::atomic_uint64_t inhibit_until { 0 };
+    alignas(cache_line_size) RWLock lock;
+    Slot slots[num_slots];
+};
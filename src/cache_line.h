@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+
+// The size of a cache line, or rather of the unit of false sharing: data that
+// is written by different threads should be kept this far apart. This is right
+// for most x86-64 and ARM processors. There's also
+// std::hardware_destructive_interference_size, but it is not stable across
+// compiler flags, which makes it unsuitable for use in a library's headers.
+constexpr size_t cache_line_size = 64;
@@ -0,0 +1,38 @@
+#include "channel.h"
+#include "futex.h"
+#include <algorithm>
+
+uint32_t ChannelBase::prepare_wait(Waiters &waiters) {
+    waiters.count.fetch_add(1, std::memory_order_relaxed);
+    // If we see the epoch bumped, we also see whatever happened before that.
+    uint32_t epoch = waiters.epoch.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return epoch;
+}
+
+void ChannelBase::wait(Waiters &waiters, uint32_t epoch) {
+    // If the epoch gets bumped after we've loaded it, this either
+    // fails right away, or we get woken up.
+    int rc = futex_wait((const uint32_t *) &waiters.epoch, epoch, nullptr);
+    if (rc != 0) {
+        // Nobody has woken us, so nobody has counted us out.
+        waiters.count.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void ChannelBase::cancel_wait(Waiters &waiters) {
+    waiters.count.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void ChannelBase::wake(Waiters &waiters, size_t n) {
+    waiters.epoch.fetch_add(1, std::memory_order_release);
+    int woken = futex_wake(
+        (const uint32_t *) &waiters.epoch, std::min(n, (size_t) INT_MAX)
+    );
+    // Count the threads we've woken out right away, rather than leaving it to
+    // them: it may be a while before they actually get to run, and until then,
+    // there's no point in making any more syscalls on their behalf.
+    if (woken > 0) {
+        waiters.count.fetch_sub(woken, std::memory_order_relaxed);
+    }
+}
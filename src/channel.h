@@ -0,0 +1,337 @@
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <optional>
+#include <utility>
+#include "cache_line.h"
+#include "util.h"
+
+class ChannelBase {
+protected:
+    // One side of a channel (the senders or the receivers), waiting for the
+    // other side to do something.
+    struct alignas(cache_line_size) Waiters {
+        // Bumped every time there might be something new for the waiters.
+        // This is the word they sleep on.
+        std::atomic_uint32_t epoch { 0 };
+        // How many threads are waiting (or about to).
+        std::atomic_uint32_t count { 0 };
+    };
+
+    // Count ourselves in, and return the epoch to wait on. The caller must
+    // check whatever it's about to wait for once again after this, and then
+    // either wait(), or cancel_wait() if there's no need to anymore.
+    static uint32_t prepare_wait(Waiters &waiters);
+    static void wait(Waiters &waiters, uint32_t epoch);
+    static void cancel_wait(Waiters &waiters);
+
+    // Let up to n waiters know there might be something new for them.
+    static void notify(Waiters &waiters, size_t n) {
+        // This pairs up with the fence in prepare_wait(): either we see them
+        // counted in, or they see what we've done when checking once again.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (UNLIKELY(waiters.count.load(std::memory_order_relaxed))) {
+            wake(waiters, n);
+        }
+    }
+    static void wake(Waiters &waiters, size_t n);
+};
+
+// A bounded multi-producer multi-consumer queue, passing items between threads.
+//
+// The items live in a ring buffer of slots, each of which has a sequence
+// number that tells whether the slot is ready to be written to or read from on
+// a given lap around the ring. Senders and receivers claim runs of consecutive
+// slots by advancing their position with a single compare-and-swap, and then
+// move the items in or out, without ever holding a lock. The threads only go
+// to sleep when the channel is full (or empty); in the steady state where it's
+// neither, nobody is waiting, and sending and receiving make no syscalls.
+template<typename T>
+class Channel : private ChannelBase {
+public:
+    // The capacity gets rounded up to a power of two.
+    explicit Channel(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size *= 2;
+        }
+        mask = size - 1;
+        slots.reset(new Slot[size]);
+        for (size_t i = 0; i < size; i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~Channel() {
+        size_t end = send_pos.load(std::memory_order_relaxed) & ~closed_bit;
+        for (size_t pos = recv_pos.load(std::memory_order_relaxed);
+            pos != end; pos++) {
+            Slot &slot = slots[pos & mask];
+            if (slot.sequence.load(std::memory_order_relaxed) == pos + 1) {
+                slot.item()->~T();
+            }
+        }
+    }
+
+    Channel(const Channel &) = delete;
+    Channel &operator = (const Channel &) = delete;
+
+    // Wait for a free slot, and move the item into the channel. Returns false,
+    // leaving the item alone, if the channel has been closed.
+    bool send(T &&item) {
+        T *first = &item;
+        return send_some(first, 1) == 1;
+    }
+    bool try_send(T &&item) {
+        T *first = &item;
+        if (!try_send_some(first, 1)) {
+            return false;
+        }
+        notify(receivers, 1);
+        return true;
+    }
+    // Move all the items into the channel, as few at a time as there are free
+    // slots, waking up the receivers once per run of slots. Returns how many
+    // have been sent; fewer than all of them if the channel has been closed.
+    template<typename ForwardIt>
+    size_t send_batch(ForwardIt first, ForwardIt last) {
+        return send_some(first, std::distance(first, last));
+    }
+
+    // Wait for an item. Returns nothing if the channel has been closed, and
+    // there are no more items left in it.
+    std::optional<T> recv() {
+        std::optional<T> result;
+        recv_some(1, [&result] (T &&item) {
+            result.emplace(std::move(item));
+        });
+        return result;
+    }
+    std::optional<T> try_recv() {
+        std::optional<T> result;
+        bool received = try_recv_some(1, [&result] (T &&item) {
+            result.emplace(std::move(item));
+        });
+        if (received) {
+            notify(senders, 1);
+        }
+        return result;
+    }
+    // Wait for at least one item, and then take as many as are available, up
+    // to max_items. Returns how many have been received; zero if the channel
+    // has been closed, and there are no more items left in it.
+    template<typename OutputIt>
+    size_t recv_batch(OutputIt out, size_t max_items) {
+        return recv_some(max_items, [&out] (T &&item) {
+            *out = std::move(item);
+            ++out;
+        });
+    }
+
+    // Make any further sends fail, and wake up everybody who's waiting. The
+    // items that are already in the channel (or on their way in, from sends
+    // that have claimed their slots already) can still be received, after
+    // which receiving fails too.
+    void close() {
+        // Setting the bit in the send position rather than in a flag of its
+        // own means that a sender either claims its slots before the channel
+        // is closed, and the receivers wait for them, or fails to.
+        send_pos.fetch_or(closed_bit, std::memory_order_relaxed);
+        notify(senders, INT_MAX);
+        notify(receivers, INT_MAX);
+    }
+
+private:
+    // Set in the send position once the channel is closed. The positions
+    // never get anywhere near it; it would take centuries of sending.
+    constexpr static size_t closed_bit = ~(SIZE_MAX >> 1);
+
+    struct Slot {
+        // If the sequence number is equal to the position of the slot on
+        // this lap, the slot is free; if it's one more than that, it holds
+        // an item; otherwise, it's still busy from the previous lap.
+        std::atomic_size_t sequence;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T *item() {
+            return std::launder(reinterpret_cast<T *>(storage));
+        }
+    };
+
+    template<typename ForwardIt>
+    size_t send_some(ForwardIt &first, size_t count) {
+        size_t sent = 0;
+        while (sent < count) {
+            size_t n = try_send_some(first, count - sent);
+            if (LIKELY(n)) {
+                sent += n;
+                notify(receivers, n);
+                continue;
+            }
+            if (UNLIKELY(is_closed())) {
+                break;
+            }
+            uint32_t epoch = prepare_wait(senders);
+            if (is_closed() || !full()) {
+                cancel_wait(senders);
+                continue;
+            }
+            wait(senders, epoch);
+        }
+        return sent;
+    }
+
+    template<typename Take>
+    size_t recv_some(size_t max_items, Take &&take) {
+        while (true) {
+            size_t n = try_recv_some(max_items, take);
+            if (LIKELY(n)) {
+                notify(senders, n);
+                if (UNLIKELY(drained())) {
+                    // We took the last ones; whoever is still waiting for
+                    // them has to give up too.
+                    notify(receivers, INT_MAX);
+                }
+                return n;
+            }
+            // Once the channel is closed, keep waiting for the sends that
+            // have claimed their slots before then, but not for any others.
+            if (UNLIKELY(drained())) {
+                return 0;
+            }
+            uint32_t epoch = prepare_wait(receivers);
+            if (drained() || !empty()) {
+                cancel_wait(receivers);
+                continue;
+            }
+            wait(receivers, epoch);
+        }
+    }
+
+    // Claim as many free slots as we can (up to count), and move the items
+    // into them, advancing first. Returns how many items we've sent; none if
+    // the channel has been closed.
+    template<typename ForwardIt>
+    size_t try_send_some(ForwardIt &first, size_t count) {
+        size_t pos = send_pos.load(std::memory_order_relaxed);
+        size_t n;
+        while (true) {
+            if (UNLIKELY(pos & closed_bit)) {
+                return 0;
+            }
+            size_t sequence = 0;
+            for (n = 0; n < count && n <= mask; n++) {
+                Slot &slot = slots[(pos + n) & mask];
+                sequence = slot.sequence.load(std::memory_order_acquire);
+                if (sequence != pos + n) {
+                    break;
+                }
+            }
+            if (UNLIKELY(n == 0)) {
+                if ((intptr_t) (sequence - pos) < 0 || count == 0) {
+                    // Full.
+                    return 0;
+                }
+                // Somebody has claimed this slot already.
+                pos = send_pos.load(std::memory_order_relaxed);
+                continue;
+            }
+            bool have_exchanged = send_pos.compare_exchange_weak(
+                pos, pos + n, std::memory_order_relaxed
+            );
+            if (LIKELY(have_exchanged)) {
+                break;
+            }
+        }
+        for (size_t i = 0; i < n; i++, ++first) {
+            Slot &slot = slots[(pos + i) & mask];
+            new (slot.storage) T(std::move(*first));
+            slot.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+        return n;
+    }
+
+    // Claim as many full slots as we can (up to max_items), and pass the items
+    // to take(). Returns how many items we've received.
+    template<typename Take>
+    size_t try_recv_some(size_t max_items, Take &&take) {
+        size_t pos = recv_pos.load(std::memory_order_relaxed);
+        size_t n;
+        while (true) {
+            size_t sequence = 0;
+            for (n = 0; n < max_items && n <= mask; n++) {
+                Slot &slot = slots[(pos + n) & mask];
+                sequence = slot.sequence.load(std::memory_order_acquire);
+                if (sequence != pos + n + 1) {
+                    break;
+                }
+            }
+            if (UNLIKELY(n == 0)) {
+                if ((intptr_t) (sequence - (pos + 1)) < 0 || max_items == 0) {
+                    // Empty.
+                    return 0;
+                }
+                // Somebody has claimed this slot already.
+                pos = recv_pos.load(std::memory_order_relaxed);
+                continue;
+            }
+            bool have_exchanged = recv_pos.compare_exchange_weak(
+                pos, pos + n, std::memory_order_relaxed
+            );
+            if (LIKELY(have_exchanged)) {
+                break;
+            }
+        }
+        for (size_t i = 0; i < n; i++) {
+            Slot &slot = slots[(pos + i) & mask];
+            T *item = slot.item();
+            take(std::move(*item));
+            item->~T();
+            // Free the slot for the next lap.
+            slot.sequence.store(pos + i + mask + 1, std::memory_order_release);
+        }
+        return n;
+    }
+
+    bool is_closed() const {
+        return send_pos.load(std::memory_order_relaxed) & closed_bit;
+    }
+
+    // Whether the channel has been closed, and all the items sent before then
+    // have been received.
+    bool drained() const {
+        size_t end = send_pos.load(std::memory_order_relaxed);
+        return (end & closed_bit) &&
+            recv_pos.load(std::memory_order_relaxed) == (end & ~closed_bit);
+    }
+
+    bool full() const {
+        size_t pos = send_pos.load(std::memory_order_relaxed);
+        size_t sequence = slots[pos & mask].sequence.load(
+            std::memory_order_acquire
+        );
+        return (intptr_t) (sequence - pos) < 0;
+    }
+
+    bool empty() const {
+        size_t pos = recv_pos.load(std::memory_order_relaxed);
+        size_t sequence = slots[pos & mask].sequence.load(
+            std::memory_order_acquire
+        );
+        return (intptr_t) (sequence - (pos + 1)) < 0;
+    }
+
+    // The senders and the receivers each get their own cache lines.
+    alignas(cache_line_size) std::atomic_size_t send_pos { 0 };
+    alignas(cache_line_size) std::atomic_size_t recv_pos { 0 };
+    Waiters senders;
+    Waiters receivers;
+    size_t mask;
+    std::unique_ptr<Slot[]> slots;
+};
@@ -0,0 +1,59 @@
+#include "cohortlock.h"
+#include "util.h"
+
+CohortLock::CohortLock(const NumaTopology &topology, uint32_t max_batch)
+    : topology(topology), max_batch(max_batch),
+      cohorts(new Cohort[topology.num_nodes()]) { }
+
+void CohortLock::lock() {
+    size_t node = topology.current_node();
+    Cohort &cohort = cohorts[node];
+    // Let the holder know we're here before we start waiting, so that it
+    // leaves the global mutex locked for us.
+    cohort.waiting.fetch_add(1, std::memory_order_relaxed);
+    cohort.local.lock();
+    cohort.waiting.fetch_sub(1, std::memory_order_relaxed);
+    if (!cohort.global_held) {
+        global.lock();
+        cohort.global_held = true;
+        cohort.batch = 0;
+    }
+    holder_node = node;
+}
+
+bool CohortLock::try_lock() {
+    size_t node = topology.current_node();
+    Cohort &cohort = cohorts[node];
+    if (!cohort.local.try_lock()) {
+        return false;
+    }
+    if (!cohort.global_held) {
+        if (!global.try_lock()) {
+            cohort.local.unlock();
+            return false;
+        }
+        cohort.global_held = true;
+        cohort.batch = 0;
+    }
+    holder_node = node;
+    return true;
+}
+
+void CohortLock::unlock() {
+    Cohort &cohort = cohorts[holder_node];
+    // If we see nobody waiting, but somebody shows up right after, that's
+    // fine: they find global_held cleared, and take the global mutex
+    // themselves. But if we do see someone, they're committed to taking the
+    // local mutex, and will find the global one taken on their behalf. Since
+    // the mutexes don't remember who has locked them, it's fine for them to
+    // unlock the global mutex that we've locked.
+    uint32_t waiting = cohort.waiting.load(std::memory_order_relaxed);
+    if (waiting != 0 && cohort.batch < max_batch) {
+        cohort.batch++;
+        cohort.local.unlock();
+        return;
+    }
+    cohort.global_held = false;
+    global.unlock();
+    cohort.local.unlock();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "cache_line.h"
+#include "mutex.h"
+#include "numa.h"
+
+// A NUMA-aware lock, after Dice, Marathe and Shavit's lock cohorting. There's
+// a local mutex for each NUMA node, and a global one. A thread first takes the
+// local mutex of its node, and then the global one, unless another thread from
+// the same node (its cohort) has left it locked for it. On unlock, if there are
+// other threads of the cohort waiting, the global mutex stays locked, and only
+// the local one is released, so the lock keeps passing around the node and the
+// data it protects stays in that node's caches. To keep the other nodes from
+// starving, the lock only passes around the same node max_batch times in a row.
+class CohortLock {
+public:
+    // The topology must outlive the lock.
+    explicit CohortLock(
+        const NumaTopology &topology = NumaTopology::system(),
+        uint32_t max_batch = 64
+    );
+
+    // Only used for statistics; see stats.h.
+    void set_name([[maybe_unused]] const char *name) {
+        global.set_name(name);
+    }
+
+    void lock();
+    bool try_lock();
+    void unlock();
+
+private:
+    struct alignas(cache_line_size) Cohort {
+        Mutex local;
+        // How many threads of the cohort are waiting for the local mutex.
+        std::atomic_uint32_t waiting { 0 };
+        // The rest is protected by the local mutex. Whether the cohort is
+        // holding the global mutex, and how many times in a row the lock
+        // has been passed around the cohort.
+        bool global_held = false;
+        uint32_t batch = 0;
+    };
+
+    Mutex global;
+    const NumaTopology &topology;
+    uint32_t max_batch;
+    std::unique_ptr<Cohort[]> cohorts;
+    // The node of the thread holding the lock, which might not be the one
+    // it's running on by the time it unlocks. Only accessed by the holder.
+    size_t holder_node = 0;
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "parkinglot.h"
+#include "util.h"
+
+// The mutex algorithm, working on two bits of a word that may be shared with
+// other, unrelated data; the other bits are never modified. This lets you
+// embed a mutex into the header of an object that you already have. However,
+// since the threads wait on the address of the word, two locks must not share
+// a word.
+template<typename T, T locked_bit, T parked_bit>
+class LockAlgorithm {
+public:
+    static void lock(std::atomic<T> &word) {
+        T word2 = word.load(std::memory_order_relaxed);
+        if (LIKELY(!(word2 & locked_bit))) {
+            bool have_exchanged = word.compare_exchange_weak(
+                word2, word2 | locked_bit,
+                std::memory_order_acquire, std::memory_order_relaxed
+            );
+            if (LIKELY(have_exchanged)) {
+                return;
+            }
+        }
+        lock_slow(word, nullptr);
+    }
+
+    static bool try_lock(std::atomic<T> &word) {
+        T word2 = word.load(std::memory_order_relaxed);
+        while (!(word2 & locked_bit)) {
+            bool have_exchanged = word.compare_exchange_weak(
+                word2, word2 | locked_bit,
+                std::memory_order_acquire, std::memory_order_relaxed
+            );
+            if (LIKELY(have_exchanged)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool try_lock_until(std::atomic<T> &word, Deadline deadline) {
+        if (LIKELY(try_lock(word))) {
+            return true;
+        }
+        return lock_slow(word, &deadline);
+    }
+
+    static void unlock(std::atomic<T> &word) {
+        T word2 = word.load(std::memory_order_relaxed);
+        if (LIKELY(!(word2 & parked_bit))) {
+            bool have_exchanged = word.compare_exchange_weak(
+                word2, word2 & ~locked_bit,
+                std::memory_order_release, std::memory_order_relaxed
+            );
+            if (LIKELY(have_exchanged)) {
+                return;
+            }
+        }
+        unlock_slow(word);
+    }
+
+private:
+    static bool lock_slow(std::atomic<T> &word, const Deadline *deadline) {
+        // Poll for a little while first, unless somebody is already parked.
+        for (int i = 0; i < 40; i++) {
+            T word2 = word.load(std::memory_order_relaxed);
+            if (word2 & parked_bit) {
+                break;
+            }
+            if (!(word2 & locked_bit) && word.compare_exchange_weak(
+                word2, word2 | locked_bit,
+                std::memory_order_acquire, std::memory_order_relaxed
+            )) {
+                return true;
+            }
+            CPU_RELAX();
+        }
+
+        while (true) {
+            T word2 = word.load(std::memory_order_relaxed);
+            if (!(word2 & locked_bit)) {
+                // Note that unlike with Mutex, we don't have to commit to
+                // waking anybody up when we unlock it: the parked_bit says
+                // whether there are threads parked, not who's responsible for
+                // waking them.
+                bool have_exchanged = word.compare_exchange_weak(
+                    word2, word2 | locked_bit,
+                    std::memory_order_acquire, std::memory_order_relaxed
+                );
+                if (LIKELY(have_exchanged)) {
+                    return true;
+                }
+                continue;
+            }
+            if (!(word2 & parked_bit)) {
+                bool have_exchanged = word.compare_exchange_weak(
+                    word2, word2 | parked_bit, std::memory_order_relaxed
+                );
+                if (UNLIKELY(!have_exchanged)) {
+                    continue;
+                }
+            }
+            auto validate = [&word] {
+                T word2 = word.load(std::memory_order_relaxed);
+                return (word2 & locked_bit) && (word2 & parked_bit);
+            };
+            if (!deadline) {
+                ParkingLot::park(&word, validate);
+            } else if (!ParkingLot::park_until(&word, validate, *deadline)) {
+                // We may be leaving the parked_bit set with nobody parked, but
+                // the next unlock() is going to notice that and clear it.
+                if (deadline_passed(deadline)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    static void unlock_slow(std::atomic<T> &word) {
+        // Unlock it while the queue is locked, so that nobody can park in
+        // the meantime, and leave the parked_bit set if there are more.
+        ParkingLot::unpark_one(&word, [&word] (UnparkResult result) {
+            T word2 = word.load(std::memory_order_relaxed);
+            T desired;
+            do {
+                desired = word2 & ~locked_bit & ~parked_bit;
+                if (result.may_have_more) {
+                    desired |= parked_bit;
+                }
+            } while (UNLIKELY(!word.compare_exchange_weak(
+                word2, desired,
+                std::memory_order_release, std::memory_order_relaxed
+            )));
+        });
+    }
+};
+
+// A mutex that only takes a single byte.
+class CompactMutex {
+public:
+    void lock() {
+        Algorithm::lock(state);
+    }
+    bool try_lock() {
+        return Algorithm::try_lock(state);
+    }
+    void unlock() {
+        Algorithm::unlock(state);
+    }
+
+    bool try_lock_until(Deadline deadline) {
+        return Algorithm::try_lock_until(state, deadline);
+    }
+    template<typename Rep, typename Period>
+    bool try_lock_for(const std::chrono::duration<Rep, Period> &timeout) {
+        return try_lock_until(deadline_after(timeout));
+    }
+
+private:
+    using Algorithm = LockAlgorithm<uint8_t, 1, 2>;
+    std::atomic_uint8_t state { 0 };
+};
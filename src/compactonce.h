@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "parkinglot.h"
+#include "util.h"
+
+// The once algorithm, working on a two-bit field of a word that may be shared
+// with other data, including other onces.
+template<typename T, unsigned shift>
+class OnceAlgorithm {
+public:
+    template<typename Callback>
+    static void perform(std::atomic<T> &word, Callback &&callback) {
+        if (LIKELY(is_done(word))) {
+            return;
+        }
+        perform_slow(word, callback, nullptr);
+    }
+
+    // Returns false if another thread is performing the callback, and has not
+    // completed it by the deadline.
+    template<typename Callback>
+    static bool perform_until(
+        std::atomic<T> &word, Callback &&callback, Deadline deadline
+    ) {
+        if (LIKELY(is_done(word))) {
+            return true;
+        }
+        return perform_slow(word, callback, &deadline);
+    }
+
+private:
+    enum : T {
+        INITIAL = 0,
+        PERFORMING = 1,
+        DONE = 2,
+        PERFORMING_PARKED = 3,
+    };
+    constexpr static T mask = T(3) << shift;
+
+    static T field(T word2) {
+        return (word2 & mask) >> shift;
+    }
+    static T with_field(T word2, T value) {
+        return (word2 & ~mask) | (value << shift);
+    }
+
+    static bool is_done(std::atomic<T> &word) {
+        return field(word.load(std::memory_order_acquire)) == DONE;
+    }
+
+    template<typename Callback>
+    static bool perform_slow(
+        std::atomic<T> &word, Callback &callback, const Deadline *deadline
+    ) {
+        T word2 = word.load(std::memory_order_acquire);
+        while (true) {
+            switch (field(word2)) {
+            case DONE:
+                return true;
+            case INITIAL:
+                if (UNLIKELY(!word.compare_exchange_weak(
+                    word2, with_field(word2, PERFORMING),
+                    std::memory_order_acquire, std::memory_order_acquire
+                ))) {
+                    continue;
+                }
+                callback();
+                // Now, record that we're done, and wake up everyone
+                // who has parked waiting for us.
+                word2 = word.load(std::memory_order_relaxed);
+                while (UNLIKELY(!word.compare_exchange_weak(
+                    word2, with_field(word2, DONE),
+                    std::memory_order_release, std::memory_order_relaxed
+                )));
+                if (field(word2) == PERFORMING_PARKED) {
+                    ParkingLot::unpark_all(&word);
+                }
+                return true;
+            case PERFORMING:
+                if (UNLIKELY(!word.compare_exchange_weak(
+                    word2, with_field(word2, PERFORMING_PARKED),
+                    std::memory_order_acquire, std::memory_order_acquire
+                ))) {
+                    continue;
+                }
+                word2 = with_field(word2, PERFORMING_PARKED);
+                // Fallthrough.
+            case PERFORMING_PARKED: {
+                if (UNLIKELY(deadline_passed(deadline))) {
+                    return false;
+                }
+                auto validate = [&word] {
+                    T word2 = word.load(std::memory_order_relaxed);
+                    return field(word2) == PERFORMING_PARKED;
+                };
+                if (!deadline) {
+                    ParkingLot::park(&word, validate);
+                } else {
+                    ParkingLot::park_until(&word, validate, *deadline);
+                }
+                word2 = word.load(std::memory_order_acquire);
+                break;
+            }
+            }
+        }
+    }
+};
+
+// A once that only takes two bits, stored in a byte of its own.
+class CompactOnce {
+public:
+    template<typename Callback>
+    void perform(Callback &&callback) {
+        Algorithm::perform(state, callback);
+    }
+
+    // Returns false if another thread is performing the callback, and has not
+    // completed it by the deadline.
+    template<typename Callback>
+    bool perform_until(Callback &&callback, Deadline deadline) {
+        return Algorithm::perform_until(state, callback, deadline);
+    }
+    template<typename Callback, typename Rep, typename Period>
+    bool perform_for(
+        Callback &&callback, const std::chrono::duration<Rep, Period> &timeout
+    ) {
+        return perform_until(callback, deadline_after(timeout));
+    }
+
+private:
+    using Algorithm = OnceAlgorithm<uint8_t, 0>;
+    std::atomic_uint8_t state { 0 };
+};
@@ -0,0 +1,180 @@
+#include "compactrwlock.h"
+#include "parkinglot.h"
+#include <cassert>
+
+// Unlike RWLock, this lock simply prefers writers: when there are writers
+// waiting, newly arriving readers wait too, and when a writer unlocks the
+// lock, it's the next writer that gets woken up, if there is one. The readers
+// are only woken up once there are no more writers waiting.
+
+bool CompactRWLock::try_lock_read_until(Deadline deadline) {
+    if (LIKELY(try_lock_read())) {
+        return true;
+    }
+    return lock_read_slow(&deadline);
+}
+
+bool CompactRWLock::lock_read_slow(const Deadline *deadline) {
+    while (true) {
+        uint16_t state2 = state.load(std::memory_order_relaxed);
+        if (!(state2 & (locked_write_bit | writers_parked_bit))) {
+            assert((state2 & count_mask) != count_mask);
+            bool have_exchanged = state.compare_exchange_weak(
+                state2, state2 + 1,
+                std::memory_order_acquire, std::memory_order_relaxed
+            );
+            if (LIKELY(have_exchanged)) {
+                return true;
+            }
+            continue;
+        }
+        if (!(state2 & readers_parked_bit)) {
+            bool have_exchanged = state.compare_exchange_weak(
+                state2, state2 | readers_parked_bit,
+                std::memory_order_relaxed
+            );
+            if (UNLIKELY(!have_exchanged)) {
+                continue;
+            }
+        }
+        auto validate = [this] {
+            uint16_t state2 = state.load(std::memory_order_relaxed);
+            return (state2 & readers_parked_bit) &&
+                (state2 & (locked_write_bit | writers_parked_bit));
+        };
+        if (!deadline) {
+            ParkingLot::park(readers_address(), validate);
+        } else if (!ParkingLot::park_until(
+            readers_address(), validate, *deadline
+        )) {
+            // Leaving the readers_parked_bit set is fine, it only
+            // means somebody will try to wake nobody later.
+            if (deadline_passed(deadline)) {
+                return false;
+            }
+        }
+    }
+}
+
+bool CompactRWLock::try_lock_write_until(Deadline deadline) {
+    if (LIKELY(try_lock_write())) {
+        return true;
+    }
+    return lock_write_slow(&deadline);
+}
+
+bool CompactRWLock::lock_write_slow(const Deadline *deadline) {
+    while (true) {
+        uint16_t state2 = state.load(std::memory_order_relaxed);
+        if (!(state2 & (locked_write_bit | count_mask))) {
+            bool have_exchanged = state.compare_exchange_weak(
+                state2, state2 | locked_write_bit,
+                std::memory_order_acquire, std::memory_order_relaxed
+            );
+            if (LIKELY(have_exchanged)) {
+                return true;
+            }
+            continue;
+        }
+        if (!(state2 & writers_parked_bit)) {
+            bool have_exchanged = state.compare_exchange_weak(
+                state2, state2 | writers_parked_bit,
+                std::memory_order_relaxed
+            );
+            if (UNLIKELY(!have_exchanged)) {
+                continue;
+            }
+        }
+        auto validate = [this] {
+            uint16_t state2 = state.load(std::memory_order_relaxed);
+            return (state2 & writers_parked_bit) &&
+                (state2 & (locked_write_bit | count_mask));
+        };
+        if (!deadline) {
+            ParkingLot::park(writers_address(), validate);
+        } else if (!ParkingLot::park_until(
+            writers_address(), validate, *deadline
+        )) {
+            // Giving up leaves the writers_parked_bit set, which keeps new
+            // readers out until the lock is released. Whoever releases it will
+            // find no writer to wake, clear the bit and wake the readers.
+            if (deadline_passed(deadline)) {
+                return false;
+            }
+        }
+    }
+}
+
+bool CompactRWLock::try_upgrade() {
+    uint16_t state2 = state.load(std::memory_order_relaxed);
+    do {
+        assert(!(state2 & locked_write_bit));
+        // We can only upgrade if we're the only reader.
+        if ((state2 & count_mask) != 1) {
+            return false;
+        }
+    } while (UNLIKELY(!state.compare_exchange_weak(
+        state2, (state2 - 1) | locked_write_bit,
+        std::memory_order_acquire, std::memory_order_relaxed
+    )));
+    return true;
+}
+
+void CompactRWLock::downgrade() {
+    uint16_t state2 = state.load(std::memory_order_relaxed);
+    do {
+        assert(state2 & locked_write_bit);
+    } while (UNLIKELY(!state.compare_exchange_weak(
+        state2, (state2 & ~locked_write_bit) + 1,
+        std::memory_order_release, std::memory_order_relaxed
+    )));
+    // If there are writers waiting, the readers keep waiting too; we're going
+    // to wake a writer once we unlock the lock.
+    if (UNLIKELY(state2 & readers_parked_bit)) {
+        if (!(state2 & writers_parked_bit)) {
+            wake_readers();
+        }
+    }
+}
+
+void CompactRWLock::unlock_write_slow() {
+    uint16_t state2 = state.fetch_and(
+        (uint16_t) ~locked_write_bit, std::memory_order_release
+    );
+    assert(state2 & locked_write_bit);
+    if (state2 & writers_parked_bit) {
+        wake_writer();
+    } else if (state2 & readers_parked_bit) {
+        wake_readers();
+    }
+}
+
+void CompactRWLock::wake_writer() {
+    // Clear the writers_parked_bit if we're waking up the last writer. This
+    // has to happen with the queue locked, so that no other writer can park
+    // in between.
+    UnparkResult result = ParkingLot::unpark_one(
+        writers_address(), [this] (UnparkResult result) {
+            if (!result.may_have_more) {
+                state.fetch_and(~writers_parked_bit, std::memory_order_relaxed);
+            }
+        }
+    );
+    if (LIKELY(result.did_unpark)) {
+        return;
+    }
+    // The writers must have all timed out,
+    // so it's the readers' turn now.
+    wake_readers();
+}
+
+void CompactRWLock::wake_readers() {
+    // A reader that sees the bit cleared is not going to park; and the ones
+    // that have parked already are going to get unparked below.
+    uint16_t state2 = state.fetch_and(
+        ~readers_parked_bit, std::memory_order_relaxed
+    );
+    if (state2 & readers_parked_bit) {
+        ParkingLot::unpark_all(readers_address());
+    }
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "deadline.h"
+#include "util.h"
+
+// A readers-writer lock that only takes two bytes, built on the parking lot.
+class CompactRWLock {
+public:
+    void lock_read();
+    bool try_lock_read();
+    void unlock_read();
+
+    void lock_write();
+    bool try_lock_write();
+    void unlock_write();
+
+    bool try_upgrade();
+    void downgrade();
+
+    bool try_lock_read_until(Deadline deadline);
+    template<typename Rep, typename Period>
+    bool try_lock_read_for(const std::chrono::duration<Rep, Period> &timeout) {
+        return try_lock_read_until(deadline_after(timeout));
+    }
+
+    bool try_lock_write_until(Deadline deadline);
+    template<typename Rep, typename Period>
+    bool try_lock_write_for(const std::chrono::duration<Rep, Period> &timeout) {
+        return try_lock_write_until(deadline_after(timeout));
+    }
+
+private:
+    bool lock_read_slow(const Deadline *deadline);
+    bool lock_write_slow(const Deadline *deadline);
+    void unlock_write_slow();
+    void wake_writer();
+    void wake_readers();
+
+    // Readers and writers park on different addresses, so that they can be
+    // woken up separately. Both addresses are inside the lock itself, so they
+    // can't collide with any other lock.
+    const void *readers_address() const {
+        return &state;
+    }
+    const void *writers_address() const {
+        return (const char *) &state + 1;
+    }
+
+    // The lower bits hold the number of readers holding the lock.
+    constexpr static uint16_t locked_write_bit = 1 << 15;
+    constexpr static uint16_t writers_parked_bit = 1 << 14;
+    constexpr static uint16_t readers_parked_bit = 1 << 13;
+    constexpr static uint16_t count_mask = readers_parked_bit - 1;
+    std::atomic_uint16_t state { 0 };
+};
+
+inline void CompactRWLock::lock_read() {
+    uint16_t state2 = state.load(std::memory_order_relaxed);
+    // Disallow new readers when there are waiting writers.
+    if (LIKELY(!(state2 & (locked_write_bit | writers_parked_bit)))) {
+        bool have_exchanged = state.compare_exchange_weak(
+            state2, state2 + 1,
+            std::memory_order_acquire, std::memory_order_relaxed
+        );
+        if (LIKELY(have_exchanged)) {
+            return;
+        }
+    }
+    lock_read_slow(nullptr);
+}
+
+inline bool CompactRWLock::try_lock_read() {
+    uint16_t state2 = state.load(std::memory_order_relaxed);
+    if (UNLIKELY(state2 & (locked_write_bit | writers_parked_bit))) {
+        return false;
+    }
+    bool have_exchanged = state.compare_exchange_strong(
+        state2, state2 + 1,
+        std::memory_order_acquire, std::memory_order_relaxed
+    );
+    return LIKELY(have_exchanged);
+}
+
+inline void CompactRWLock::unlock_read() {
+    uint16_t state2 = state.fetch_sub(1, std::memory_order_release);
+    // Readers only park when a writer holds the lock or is waiting for it, so
+    // if we were the last reader, we only have to care about the writers.
+    bool last = (state2 & count_mask) == 1;
+    if (UNLIKELY(last && (state2 & writers_parked_bit))) {
+        wake_writer();
+    }
+}
+
+inline void CompactRWLock::lock_write() {
+    uint16_t state2 = state.load(std::memory_order_relaxed);
+    if (LIKELY(!(state2 & (locked_write_bit | count_mask)))) {
+        bool have_exchanged = state.compare_exchange_weak(
+            state2, state2 | locked_write_bit,
+            std::memory_order_acquire, std::memory_order_relaxed
+        );
+        if (LIKELY(have_exchanged)) {
+            return;
+        }
+    }
+    lock_write_slow(nullptr);
+}
+
+inline bool CompactRWLock::try_lock_write() {
+    uint16_t state2 = state.load(std::memory_order_relaxed);
+    if (UNLIKELY(state2 & (locked_write_bit | count_mask))) {
+        return false;
+    }
+    bool have_exchanged = state.compare_exchange_strong(
+        state2, state2 | locked_write_bit,
+        std::memory_order_acquire, std::memory_order_relaxed
+    );
+    return LIKELY(have_exchanged);
+}
+
+inline void CompactRWLock::unlock_write() {
+    uint16_t state2 = state.load(std::memory_order_relaxed);
+    if (LIKELY(!(state2 & (writers_parked_bit | readers_parked_bit)))) {
+        bool have_exchanged = state.compare_exchange_weak(
+            state2, state2 & ~locked_write_bit,
+            std::memory_order_release, std::memory_order_relaxed
+        );
+        if (LIKELY(have_exchanged)) {
+            return;
+        }
+    }
+    unlock_write_slow();
+}
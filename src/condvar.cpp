@@ -4,29 +4,53 @@
 #include "util.h"
 #include <cstdint>
 #include <climits>
+#include <cerrno>
+#include <cassert>
 
 CondVar::CondVar(Mutex &mutex)
-    : mutex(mutex) { }
+    : mutex_offset((intptr_t) &mutex - (intptr_t) this) { }
+
+Mutex &CondVar::mutex() const {
+    return *(Mutex *) ((intptr_t) this + mutex_offset);
+}
 
 void CondVar::wait() {
     uint32_t state2 = state.fetch_or(
         need_to_wake_all_bit | need_to_wake_one_bit,
         std::memory_order_relaxed
     ) | need_to_wake_all_bit | need_to_wake_one_bit;
-    mutex.unlock();
+    mutex().unlock();
     futex_wait((const uint32_t *) &state, state2, nullptr);
     // Re-lock the mutex, but make sure to try to wake somebody up when we
     // unlock it. This is because notify_all() requeues a bunch of threads to
     // wait on the mutex without making them register with the mutex properly.
     // This is fine, as long as the one thread that it does wake itself commits
     // to waking somebody up on unlock, so that's what we do.
-    mutex.lock_pessimistic();
+    mutex().lock_pessimistic();
 }
 
-void CondVar::wait(std::function<bool()> condition) {
-    while (!condition()) {
-        wait();
+bool CondVar::wait_until(Deadline deadline) {
+    // Same as above. Note that we have to re-lock the mutex even if we have
+    // timed out. The need_to_wake_one_bit we have set will be cleared by the
+    // next notify_one() call that finds nobody to wake.
+    uint32_t state2 = state.fetch_or(
+        need_to_wake_all_bit | need_to_wake_one_bit,
+        std::memory_order_relaxed
+    ) | need_to_wake_all_bit | need_to_wake_one_bit;
+    mutex().unlock();
+    int rc = futex_wait_until((const uint32_t *) &state, state2, &deadline);
+    bool timed_out = rc != 0 && errno == ETIMEDOUT;
+    if (timed_out) {
+        // We might have been requeued onto the mutex by notify_one() and
+        // timed out there, waiting for the notifier to unlock it. Then the
+        // notification was meant for us, and nobody else is going to get it,
+        // so don't report a timeout if there has been one since we started
+        // waiting (possibly spuriously, if it came after the deadline).
+        uint32_t state3 = state.load(std::memory_order_relaxed);
+        timed_out = (state3 & ~(increment - 1)) == (state2 & ~(increment - 1));
     }
+    mutex().lock_pessimistic();
+    return !timed_out;
 }
 
 void CondVar::notify_one() {
@@ -49,7 +73,7 @@ void CondVar::notify_one() {
         return;
     }
     // ...try to wake someone...
-    int woken = futex_wake((const uint32_t *) &state, 1);
+    int woken = move_to_mutex(state2 & ~need_to_wake_one_bit, 1);
     // ...and if we have woken someone, put the bit back.
     if (woken) {
         state.fetch_or(need_to_wake_one_bit, std::memory_order_relaxed);
@@ -61,13 +85,65 @@ void CondVar::notify_all() {
         increment, std::memory_order_relaxed
     ) + increment;
     if (UNLIKELY(state2 & need_to_wake_all_bit)) {
-        state.fetch_and(
-            ~(need_to_wake_all_bit | need_to_wake_one_bit),
-            std::memory_order_relaxed
+        constexpr uint32_t bits = need_to_wake_all_bit | need_to_wake_one_bit;
+        state2 = state.fetch_and(~bits, std::memory_order_relaxed) & ~bits;
+        move_to_mutex(state2, INT_MAX);
+    }
+}
+
+// Get up to count waiters going, provided the state is still state2; returns
+// how many there were. If the mutex is unlocked, we wake one of them, and
+// requeue the rest to wait on the mutex (the one we wake commits to waking
+// them up when it unlocks the mutex, see wait()). But most of the time, the
+// mutex is locked by whoever is notifying us. Then, a waiter that we woke up
+// would immediately go back to sleep waiting for the mutex, so we requeue all
+// of them instead, and they only wake up once it's unlocked (this is known as
+// wait morphing).
+int CondVar::move_to_mutex(uint32_t state2, int count) {
+    Mutex &mutex2 = mutex();
+    while (true) {
+        bool locked = mutex2.state.load(std::memory_order_relaxed) !=
+            Mutex::UNLOCKED;
+        int number_to_wake = locked ? 0 : 1;
+        int rc = futex_cmp_requeue(
+            (const uint32_t *) &state, number_to_wake,
+            (const uint32_t *) &mutex2.state, count - number_to_wake, state2
         );
-        futex_requeue(
-            (const uint32_t *) &state, 1,
-            (const uint32_t *) &mutex.state, INT_MAX
+        if (LIKELY(rc >= 0)) {
+            if (locked && rc != 0) {
+                make_mutex_wake(mutex2);
+            }
+            return rc;
+        }
+        // The state has changed since. We still have to notify the threads
+        // that have been waiting (and maybe a few more), so retry.
+        assert(errno == EAGAIN);
+        state2 = state.load(std::memory_order_relaxed);
+    }
+}
+
+// We have requeued some threads onto the mutex, but they haven't registered
+// with it the way lock() would, so make sure whoever unlocks it next wakes
+// one of them. The one that wakes up then goes through lock_pessimistic(),
+// and so on. If the mutex has been unlocked in the meantime, it's up to us.
+void CondVar::make_mutex_wake(Mutex &mutex2) {
+    uint32_t state2 = mutex2.state.load(std::memory_order_relaxed);
+    while (true) {
+        if (state2 >= Mutex::LOCKED_NEED_TO_WAKE) {
+            // Including LOCKED_STARVING and HANDED_OFF: once the mutex is
+            // taken over, it's going to be LOCKED_NEED_TO_WAKE or
+            // LOCKED_STARVING again.
+            return;
+        }
+        if (state2 == Mutex::UNLOCKED) {
+            futex_wake((const uint32_t *) &mutex2.state, 1);
+            return;
+        }
+        bool have_exchanged = mutex2.state.compare_exchange_weak(
+            state2, Mutex::LOCKED_NEED_TO_WAKE, std::memory_order_relaxed
         );
+        if (LIKELY(have_exchanged)) {
+            return;
+        }
     }
 }
@@ -1,5 +1,9 @@
+#pragma once
+
 #include <atomic>
-#include <functional>
+#include <cstdint>
+#include <utility>
+#include "deadline.h"
 
 class Mutex;
 
@@ -8,7 +12,41 @@ public:
     CondVar(Mutex &mutex);
 
     void wait();
-    void wait(std::function<bool()> condition);
+    // The condition is a template parameter rather than an std::function, so
+    // that it can be inlined, and never needs to be allocated.
+    template<typename Condition>
+    void wait(Condition &&condition) {
+        while (!condition()) {
+            wait();
+        }
+    }
+
+    // Returns false if the deadline has passed before this thread was woken
+    // up. Either way, the mutex is locked again when this returns.
+    bool wait_until(Deadline deadline);
+    // Returns the last value of the condition.
+    template<typename Condition>
+    bool wait_until(Deadline deadline, Condition &&condition) {
+        while (!condition()) {
+            if (!wait_until(deadline)) {
+                return condition();
+            }
+        }
+        return true;
+    }
+    template<typename Rep, typename Period>
+    bool wait_for(const std::chrono::duration<Rep, Period> &timeout) {
+        return wait_until(deadline_after(timeout));
+    }
+    template<typename Rep, typename Period, typename Condition>
+    bool wait_for(
+        const std::chrono::duration<Rep, Period> &timeout,
+        Condition &&condition
+    ) {
+        return wait_until(
+            deadline_after(timeout), std::forward<Condition>(condition)
+        );
+    }
 
     void notify_one();
     void notify_all();
@@ -17,6 +55,13 @@ private:
     constexpr static uint32_t need_to_wake_one_bit = 1;
     constexpr static uint32_t need_to_wake_all_bit = 2;
     constexpr static uint32_t increment = 4;
-    Mutex &mutex;
+    Mutex &mutex() const;
+    int move_to_mutex(uint32_t state2, int count);
+    static void make_mutex_wake(Mutex &mutex2);
+
+    // The mutex is stored as an offset from the condition variable rather
+    // than as a reference, so that when they're both in memory shared between
+    // processes, it works no matter where each process has mapped it.
+    intptr_t mutex_offset;
     std::atomic_uint32_t state { 0 };
 };
@@ -0,0 +1,57 @@
+#include "cyclicbarrier.h"
+#include "futex.h"
+#include "util.h"
+#include <climits>
+#include <cassert>
+
+CyclicBarrierBase::CyclicBarrierBase(size_t expected)
+    : generation(0), remaining(expected), expected(expected) {
+    assert(expected > 0 && expected <= UINT32_MAX);
+}
+
+bool CyclicBarrierBase::arrive(uint32_t &generation2, bool drop) {
+    // The generation can not change until we arrive,
+    // so this is the generation we're arriving in.
+    generation2 = generation.load(
+        std::memory_order_relaxed
+    ) & ~need_to_wake_bit;
+    if (drop) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    // Synchronize with everybody who has arrived before us
+    // (including their drops), if we turn out to be the last.
+    uint32_t remaining2 = remaining.fetch_sub(1, std::memory_order_acq_rel);
+    assert(remaining2 != 0);
+    return remaining2 == 1;
+}
+
+void CyclicBarrierBase::complete(uint32_t generation2) {
+    // Nobody else can arrive before we bump the generation,
+    // so it's safe to reset everything for the next phase.
+    expected -= dropped.exchange(0, std::memory_order_relaxed);
+    remaining.store(expected, std::memory_order_relaxed);
+    uint32_t state2 = generation.exchange(
+        generation2 + one_generation, std::memory_order_release
+    );
+    if (state2 & need_to_wake_bit) {
+        futex_wake((const uint32_t *) &generation, INT_MAX);
+    }
+}
+
+void CyclicBarrierBase::wait(uint32_t generation2) {
+    uint32_t state2 = generation.load(std::memory_order_acquire);
+    while (UNLIKELY((state2 & ~need_to_wake_bit) == generation2)) {
+        if (!(state2 & need_to_wake_bit)) {
+            bool have_exchanged = generation.compare_exchange_weak(
+                state2, state2 | need_to_wake_bit,
+                std::memory_order_acquire, std::memory_order_acquire
+            );
+            if (UNLIKELY(!have_exchanged)) {
+                continue;
+            }
+            state2 |= need_to_wake_bit;
+        }
+        futex_wait((const uint32_t *) &generation, state2, nullptr);
+        state2 = generation.load(std::memory_order_acquire);
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// The default completion function, which does nothing.
+struct NoCompletion {
+    void operator()() { }
+};
+
+class CyclicBarrierBase {
+protected:
+    CyclicBarrierBase(size_t expected);
+
+    // Returns whether we're the last one to arrive, in which case the caller
+    // runs the completion function and calls complete(); otherwise, unless
+    // dropping out, the caller waits for the phase to end.
+    bool arrive(uint32_t &generation, bool drop);
+    void complete(uint32_t generation);
+    void wait(uint32_t generation);
+
+private:
+    // The threads wait on the generation, which gets bumped every time a phase
+    // ends. The lowest bit of it tells whether anyone's actually waiting.
+    constexpr static uint32_t need_to_wake_bit = 1;
+    constexpr static uint32_t one_generation = 2;
+    std::atomic_uint32_t generation;
+    // How many threads are yet to arrive in this phase.
+    std::atomic_uint32_t remaining;
+    // How many threads have dropped out during this phase; they are no longer
+    // expected starting with the next one.
+    std::atomic_uint32_t dropped { 0 };
+    // Only touched by the last thread to arrive.
+    uint32_t expected;
+};
+
+// Unlike a Barrier, a CyclicBarrier can be reused: once all the expected
+// threads arrive, the phase ends, everybody is let through, and the barrier
+// starts waiting for them to arrive again. The last thread to arrive runs the
+// completion function before anybody else gets released.
+template<typename Completion = NoCompletion>
+class CyclicBarrier : private CyclicBarrierBase {
+public:
+    explicit CyclicBarrier(
+        size_t expected, Completion completion = Completion()
+    ) : CyclicBarrierBase(expected), completion(std::move(completion)) { }
+
+    void arrive_and_wait() {
+        uint32_t generation;
+        if (arrive(generation, false)) {
+            completion();
+            complete(generation);
+        } else {
+            wait(generation);
+        }
+    }
+
+    // Arrive without waiting, and stop participating in later phases.
+    void arrive_and_drop() {
+        uint32_t generation;
+        if (arrive(generation, true)) {
+            completion();
+            complete(generation);
+        }
+    }
+
+private:
+    Completion completion;
+};
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <chrono>
+
+// All the timed operations take absolute deadlines on the monotonic clock,
+// which is what std::chrono::steady_clock is on Linux. Relative timeouts are
+// converted into deadlines right away, so that restarting a wait after a
+// spurious wake-up does not extend it.
+using Deadline = std::chrono::steady_clock::time_point;
+
+template<typename Rep, typename Period>
+inline Deadline deadline_after(
+    const std::chrono::duration<Rep, Period> &timeout
+) {
+    return std::chrono::steady_clock::now() +
+        std::chrono::ceil<std::chrono::steady_clock::duration>(timeout);
+}
+
+// A null deadline means waiting for as long as it takes.
+inline bool deadline_passed(const Deadline *deadline) {
+    return deadline && std::chrono::steady_clock::now() >= *deadline;
+}
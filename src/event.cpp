@@ -16,6 +16,14 @@ void Event::notify() {
 }
 
 void Event::wait() {
+    wait_until(nullptr);
+}
+
+bool Event::wait_until(Deadline deadline) {
+    return wait_until(&deadline);
+}
+
+bool Event::wait_until(const Deadline *deadline) {
     uint32_t state2 = UNSET_NO_WAITERS;
     bool have_exchanged = state.compare_exchange_strong(
         state2, UNSET,
@@ -33,9 +41,16 @@ void Event::wait() {
     }
 
     while (UNLIKELY(state2 != SET)) {
-        futex_wait((const uint32_t *) &state, state2, nullptr);
+        // If we give up, we leave the state as UNSET, even though there might
+        // be no more waiters. This only means notify() will make a futex_wake()
+        // call that wakes nobody.
+        if (UNLIKELY(deadline_passed(deadline))) {
+            return false;
+        }
+        futex_wait_until((const uint32_t *) &state, state2, deadline);
         state2 = state.load(std::memory_order_acquire);
     }
+    return true;
 }
 
 bool Event::try_wait() {
@@ -1,4 +1,7 @@
+#pragma once
+
 #include <atomic>
+#include "deadline.h"
 
 class Event {
 public:
@@ -6,7 +9,16 @@ public:
     void wait();
     bool try_wait();
 
+    bool wait_until(Deadline deadline);
+    template<typename Rep, typename Period>
+    bool wait_for(const std::chrono::duration<Rep, Period> &timeout) {
+        return wait_until(deadline_after(timeout));
+    }
+
 private:
+    friend class Waitable;
+    bool wait_until(const Deadline *deadline);
+
     enum {
         UNSET_NO_WAITERS,
         UNSET,
@@ -1,25 +1,44 @@
+#pragma once
+
 #include <linux/futex.h>
 #include <sys/syscall.h>
 #include <unistd.h>
+#include <cerrno>
 #include <cstdint>
+#include <ctime>
+#include "deadline.h"
 
-struct timespec;
+// Private futexes are keyed by address within the process, which is cheaper
+// for the kernel to look up, but means they don't work across processes that
+// map the same memory. Building with SYNC_PRIMITIVES_PROCESS_SHARED (the
+// "process_shared" build option) switches every primitive over to shared
+// futexes, which are keyed by the underlying page instead. This is a
+// compile-time choice so that no operation has to branch on it.
+#ifdef SYNC_PRIMITIVES_PROCESS_SHARED
+constexpr int futex_private_flag = 0;
+#else
+constexpr int futex_private_flag = FUTEX_PRIVATE_FLAG;
+#endif
 
 static inline int futex_wait(
     const uint32_t *uaddr, int val, struct timespec *timeout
 ) {
-    return syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, val, timeout);
+    return syscall(
+        SYS_futex, uaddr, FUTEX_WAIT | futex_private_flag, val, timeout
+    );
 }
 
 static inline int futex_wake(const uint32_t *uaddr, int number) {
-    return syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, number);
+    return syscall(SYS_futex, uaddr, FUTEX_WAKE | futex_private_flag, number);
 }
 
 static inline int futex_wait_bitset(
-    const uint32_t *uaddr, int val, struct timespec *timeout, uint32_t mask
+    const uint32_t *uaddr, int val, const struct timespec *timeout,
+    uint32_t mask
 ) {
     return syscall(
-        SYS_futex, uaddr, FUTEX_WAIT_BITSET_PRIVATE, val, timeout, 0, mask
+        SYS_futex, uaddr, FUTEX_WAIT_BITSET | futex_private_flag,
+        val, timeout, 0, mask
    );
 }
 
@@ -27,16 +46,166 @@ static inline int futex_wake_bitset(
     const uint32_t *uaddr, int number, uint32_t mask
 ) {
     return syscall(
-        SYS_futex, uaddr, FUTEX_WAKE_BITSET_PRIVATE, number, 0, 0, mask
+        SYS_futex, uaddr, FUTEX_WAKE_BITSET | futex_private_flag,
+        number, 0, 0, mask
     );
 }
 
-static inline int futex_requeue(
+// Wake up to number_to_wake threads waiting on uaddr, and move up to
+// number_to_requeue more over to wait on uaddr2 instead, if *uaddr is
+// still val (otherwise, fail with EAGAIN, like FUTEX_WAIT does). Returns
+// how many threads have been woken up and requeued in total.
+static inline int futex_cmp_requeue(
     const uint32_t *uaddr, int number_to_wake,
-    const uint32_t *uaadr2, int number_to_requeue
+    const uint32_t *uaddr2, int number_to_requeue, uint32_t val
 ) {
     return syscall(
-        SYS_futex, uaddr, FUTEX_REQUEUE_PRIVATE,
-        number_to_wake, number_to_requeue, uaadr2
-   );
+        SYS_futex, uaddr, FUTEX_CMP_REQUEUE | futex_private_flag,
+        number_to_wake, number_to_requeue, uaddr2, val
+    );
+}
+
+// Unlike FUTEX_WAIT, FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC
+// timeout, which is exactly what a Deadline is.
+static inline struct timespec deadline_to_timespec(Deadline deadline) {
+    int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        deadline.time_since_epoch()
+    ).count();
+    if (ns < 0) {
+        ns = 0;
+    }
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    return ts;
+}
+
+// Wait until the deadline, or indefinitely if there's no deadline.
+static inline int futex_wait_bitset_until(
+    const uint32_t *uaddr, int val, const Deadline *deadline, uint32_t mask
+) {
+    if (!deadline) {
+        return futex_wait_bitset(uaddr, val, nullptr, mask);
+    }
+    struct timespec ts = deadline_to_timespec(*deadline);
+    return futex_wait_bitset(uaddr, val, &ts, mask);
+}
+
+static inline int futex_wait_until(
+    const uint32_t *uaddr, int val, const Deadline *deadline
+) {
+    return futex_wait_bitset_until(
+        uaddr, val, deadline, FUTEX_BITSET_MATCH_ANY
+    );
+}
+
+// FUTEX_WAITV (Linux 5.16+) waits on several futexes at once. The system
+// headers may be too old to know about it, so spell out its ABI ourselves.
+#ifndef SYS_futex_waitv
+#define SYS_futex_waitv 449
+#endif
+
+struct futex_waitv_entry {
+    uint64_t val;
+    uint64_t uaddr;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+// 32-bit futex word; FUTEX_WAITV uses the same private flag as the rest.
+constexpr uint32_t futex_waitv_flags = 2 | futex_private_flag;
+// The most futexes a single FUTEX_WAITV call can wait on.
+constexpr size_t futex_waitv_max = 128;
+
+static inline futex_waitv_entry futex_waitv_make_entry(
+    const uint32_t *uaddr, uint32_t val
+) {
+    return { val, (uint64_t) (uintptr_t) uaddr, futex_waitv_flags, 0 };
+}
+
+// Returns the index of the futex that got woken up, or -1 with errno set, like
+// with FUTEX_WAIT; in particular, ENOSYS means the kernel is too old.
+static inline int futex_waitv_until(
+    const futex_waitv_entry *waiters, size_t count, const Deadline *deadline
+) {
+    if (!deadline) {
+        return syscall(SYS_futex_waitv, waiters, count, 0, nullptr, 0);
+    }
+    struct timespec ts = deadline_to_timespec(*deadline);
+    return syscall(
+        SYS_futex_waitv, waiters, count, 0, &ts, CLOCK_MONOTONIC
+    );
+}
+
+// Priority-inheritance futexes. The futex word holds the thread ID of the
+// owner (plus the FUTEX_WAITERS bit, which the kernel maintains), and the
+// kernel boosts the owner to the priority of the highest-priority waiter.
+#ifndef FUTEX_LOCK_PI2
+#define FUTEX_LOCK_PI2 13
+#endif
+
+// FUTEX_LOCK_PI2 (Linux 5.14+) takes an absolute CLOCK_MONOTONIC timeout;
+// FUTEX_LOCK_PI only takes CLOCK_REALTIME ones, so convert the deadline
+// and hope the clock doesn't jump in the meantime.
+static inline int futex_lock_pi_until(
+    const uint32_t *uaddr, const Deadline *deadline
+) {
+    if (!deadline) {
+        return syscall(
+            SYS_futex, uaddr, FUTEX_LOCK_PI | futex_private_flag, 0, nullptr
+        );
+    }
+    struct timespec ts = deadline_to_timespec(*deadline);
+    int rc = syscall(
+        SYS_futex, uaddr, FUTEX_LOCK_PI2 | futex_private_flag, 0, &ts
+    );
+    if (rc == 0 || errno != ENOSYS) {
+        return rc;
+    }
+    auto realtime = std::chrono::system_clock::now() +
+        (*deadline - std::chrono::steady_clock::now());
+    int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        realtime.time_since_epoch()
+    ).count();
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    return syscall(
+        SYS_futex, uaddr, FUTEX_LOCK_PI | futex_private_flag, 0, &ts
+    );
+}
+
+static inline int futex_trylock_pi(const uint32_t *uaddr) {
+    return syscall(SYS_futex, uaddr, FUTEX_TRYLOCK_PI | futex_private_flag);
+}
+
+static inline int futex_unlock_pi(const uint32_t *uaddr) {
+    return syscall(SYS_futex, uaddr, FUTEX_UNLOCK_PI | futex_private_flag);
+}
+
+// Wait on uaddr, to be requeued onto the PI futex uaddr2 and have the kernel
+// acquire it on our behalf. Returns 0 if that has happened.
+static inline int futex_wait_requeue_pi_until(
+    const uint32_t *uaddr, int val, const Deadline *deadline,
+    const uint32_t *uaddr2
+) {
+    struct timespec ts;
+    if (deadline) {
+        ts = deadline_to_timespec(*deadline);
+    }
+    return syscall(
+        SYS_futex, uaddr, FUTEX_WAIT_REQUEUE_PI | futex_private_flag, val,
+        deadline ? &ts : nullptr, uaddr2
+    );
+}
+
+// Wake one waiter (by acquiring uaddr2 for it, or requeueing it there), and
+// requeue up to number_to_requeue more, if *uaddr is still val.
+static inline int futex_cmp_requeue_pi(
+    const uint32_t *uaddr, int number_to_requeue,
+    const uint32_t *uaddr2, int val
+) {
+    return syscall(
+        SYS_futex, uaddr, FUTEX_CMP_REQUEUE_PI | futex_private_flag,
+        1, number_to_requeue, uaddr2, val
+    );
 }
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "once.h"
+
+// A slot for a value that gets initialized at most once, stored inline. Once
+// it's there, getting at the value is a single load-acquire, inline.
+template<typename T>
+class OnceCell {
+public:
+    OnceCell() = default;
+    OnceCell(const OnceCell &) = delete;
+    OnceCell &operator=(const OnceCell &) = delete;
+
+    ~OnceCell() {
+        if (once.is_done()) {
+            value()->~T();
+        }
+    }
+
+    // Returns nullptr if the value has not been initialized yet.
+    T *get() {
+        return once.is_done() ? value() : nullptr;
+    }
+
+    // Initialize the value with whatever the initializer returns, unless
+    // it has already been initialized. If the initializer throws, the cell
+    // stays empty, and the next caller retries.
+    template<typename Init>
+    T &get_or_init(Init &&init) {
+        once.perform([this, &init] {
+            new (storage) T(std::forward<Init>(init)());
+        });
+        return *value();
+    }
+
+    // Returns false if the cell already had a value.
+    template<typename... Args>
+    bool emplace(Args &&...args) {
+        bool have_set = false;
+        once.perform([&] {
+            new (storage) T(std::forward<Args>(args)...);
+            have_set = true;
+        });
+        return have_set;
+    }
+
+private:
+    T *value() {
+        return std::launder(reinterpret_cast<T *>(storage));
+    }
+
+    Once once;
+    alignas(T) unsigned char storage[sizeof(T)];
+};
+
+// A value that gets initialized on first use, by calling the initializer.
+//
+//     static Lazy config { [] { return Config::load(); } };
+//     config->verbose ...
+template<typename T, typename Init = T (*)()>
+class Lazy {
+public:
+    explicit Lazy(Init init) : init(std::move(init)) { }
+
+    T &get() {
+        return cell.get_or_init(init);
+    }
+    T &operator*() {
+        return get();
+    }
+    T *operator->() {
+        return &get();
+    }
+
+private:
+    OnceCell<T> cell;
+    Init init;
+};
+
+template<typename Init>
+Lazy(Init) -> Lazy<std::invoke_result_t<Init &>, Init>;
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+#include "cache_line.h"
+#include "util.h"
+
+// A fixed table of N locks (Mutex, RWLock, or anything with the same API),
+// with keys hashed onto them: the usual way to protect a big hash map without
+// having a lock per bucket. Our locks are tiny, so packed into a plain array,
+// many of them would share a cache line, and threads locking unrelated keys
+// would still be bouncing it between them. So, each lock gets a cache line of
+// its own here.
+//
+// To lock several keys at once, get their shards with shards_of(), and lock
+// them with lock_all() and friends; they lock the shards in increasing order,
+// which is what keeps two threads locking overlapping sets from deadlocking.
+// The same shard is only locked once, even if several keys map onto it.
+//
+// The table also counts, for each shard, how many times a thread had to wait
+// for it. If the counts keep growing, N is too small, or a few keys are hot.
+template<typename Lock, size_t N>
+class LockStripe {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+    // Indices of shards, sorted and without duplicates.
+    template<size_t K>
+    class Shards {
+    public:
+        const size_t *begin() const {
+            return indices.data();
+        }
+        const size_t *end() const {
+            return indices.data() + count;
+        }
+
+    private:
+        friend class LockStripe;
+        std::array<size_t, K> indices;
+        size_t count = 0;
+    };
+
+    static constexpr size_t size() {
+        return N;
+    }
+
+    // std::hash is the identity for integers, so mix the bits up before
+    // taking the top ones (this is Fibonacci hashing).
+    template<typename Key, typename Hash = std::hash<Key>>
+    static size_t shard_of(const Key &key) {
+        if constexpr (N == 1) {
+            return 0;
+        } else {
+            uint64_t hash = Hash {}(key);
+            return (hash * 0x9e3779b97f4a7c15) >> (64 - log2(N));
+        }
+    }
+
+    template<typename... Keys>
+    static Shards<sizeof...(Keys)> shards_of(const Keys &...keys) {
+        Shards<sizeof...(Keys)> shards;
+        // Insertion sort, since there are only a few of them.
+        for (size_t index : { shard_of(keys)... }) {
+            size_t i = shards.count;
+            while (i > 0 && shards.indices[i - 1] > index) {
+                i--;
+            }
+            if (i > 0 && shards.indices[i - 1] == index) {
+                continue;
+            }
+            std::move_backward(
+                shards.indices.begin() + i,
+                shards.indices.begin() + shards.count,
+                shards.indices.begin() + shards.count + 1
+            );
+            shards.indices[i] = index;
+            shards.count++;
+        }
+        return shards;
+    }
+
+    template<typename Iterator>
+    static std::vector<size_t> shards_of_range(Iterator begin, Iterator end) {
+        std::vector<size_t> shards;
+        for (; begin != end; ++begin) {
+            shards.push_back(shard_of(*begin));
+        }
+        std::sort(shards.begin(), shards.end());
+        shards.erase(std::unique(shards.begin(), shards.end()), shards.end());
+        return shards;
+    }
+
+    Lock &shard(size_t index) {
+        return slots[index].lock;
+    }
+    template<typename Key>
+    Lock &shard_for(const Key &key) {
+        return shard(shard_of(key));
+    }
+
+    // For mutexes.
+    template<typename Key>
+    void lock(const Key &key) {
+        acquire(shard_of(key), &Lock::try_lock, &Lock::lock);
+    }
+    template<typename Key>
+    bool try_lock(const Key &key) {
+        return shard_for(key).try_lock();
+    }
+    template<typename Key>
+    void unlock(const Key &key) {
+        shard_for(key).unlock();
+    }
+
+    template<typename ShardList>
+    void lock_all(const ShardList &shards) {
+        for (size_t index : shards) {
+            acquire(index, &Lock::try_lock, &Lock::lock);
+        }
+    }
+    template<typename ShardList>
+    void unlock_all(const ShardList &shards) {
+        for (size_t index : shards) {
+            shard(index).unlock();
+        }
+    }
+
+    // For read-write locks.
+    template<typename Key>
+    void lock_read(const Key &key) {
+        acquire(shard_of(key), &Lock::try_lock_read, &Lock::lock_read);
+    }
+    template<typename Key>
+    void unlock_read(const Key &key) {
+        shard_for(key).unlock_read();
+    }
+    template<typename Key>
+    void lock_write(const Key &key) {
+        acquire(shard_of(key), &Lock::try_lock_write, &Lock::lock_write);
+    }
+    template<typename Key>
+    void unlock_write(const Key &key) {
+        shard_for(key).unlock_write();
+    }
+
+    template<typename ShardList>
+    void lock_all_read(const ShardList &shards) {
+        for (size_t index : shards) {
+            acquire(index, &Lock::try_lock_read, &Lock::lock_read);
+        }
+    }
+    template<typename ShardList>
+    void unlock_all_read(const ShardList &shards) {
+        for (size_t index : shards) {
+            shard(index).unlock_read();
+        }
+    }
+    template<typename ShardList>
+    void lock_all_write(const ShardList &shards) {
+        for (size_t index : shards) {
+            acquire(index, &Lock::try_lock_write, &Lock::lock_write);
+        }
+    }
+    template<typename ShardList>
+    void unlock_all_write(const ShardList &shards) {
+        for (size_t index : shards) {
+            shard(index).unlock_write();
+        }
+    }
+
+    // How many times a thread has had to wait for the shard.
+    uint64_t contention(size_t index) const {
+        return slots[index].contended.load(std::memory_order_relaxed);
+    }
+    void reset_contention() {
+        for (Slot &slot : slots) {
+            slot.contended.store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    static constexpr unsigned log2(size_t n) {
+        return n == 1 ? 0 : 1 + log2(n / 2);
+    }
+
+    // Only count the contention when we see it, so that the fast path doesn't
+    // write to anything but the lock. The counter shares its cache line with
+    // the lock, which is about to be written to by the waiter anyway.
+    template<typename TryAcquire, typename Acquire>
+    void acquire(size_t index, TryAcquire try_acquire, Acquire acquire2) {
+        Slot &slot = slots[index];
+        if (UNLIKELY(!(slot.lock.*try_acquire)())) {
+            slot.contended.fetch_add(1, std::memory_order_relaxed);
+            (slot.lock.*acquire2)();
+        }
+    }
+
+    struct alignas(cache_line_size) Slot {
+        Lock lock;
+        std::atomic_uint64_t contended { 0 };
+    };
+    std::array<Slot, N> slots;
+};
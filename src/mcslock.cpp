@@ -0,0 +1,115 @@
+#include "mcslock.h"
+#include "util.h"
+#include <sched.h>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+// Wait for the given predicate to become true. Since the thread we're waiting
+// for might not be running, start yielding if it takes too long.
+template<typename F>
+static void spin_until(F &&predicate) {
+    int times = 0;
+    while (!predicate()) {
+        if (UNLIKELY(times++ > 100)) {
+            sched_yield();
+        } else {
+            CPU_RELAX();
+        }
+    }
+}
+
+void MCSLock::lock(Node &node) {
+    node.next.store(nullptr, std::memory_order_relaxed);
+    node.locked.store(true, std::memory_order_relaxed);
+    // Enqueue ourselves. If there was nobody in the queue, we've got the lock.
+    Node *prev = tail.exchange(&node, std::memory_order_acq_rel);
+    if (LIKELY(prev == nullptr)) {
+        return;
+    }
+    // Otherwise, let the previous waiter know where to find us, and wait for
+    // it to hand the lock over to us.
+    prev->next.store(&node, std::memory_order_release);
+    spin_until([&node] {
+        return !node.locked.load(std::memory_order_acquire);
+    });
+}
+
+bool MCSLock::try_lock(Node &node) {
+    node.next.store(nullptr, std::memory_order_relaxed);
+    Node *expected = nullptr;
+    bool have_locked = tail.compare_exchange_strong(
+        expected, &node,
+        std::memory_order_acquire, std::memory_order_relaxed
+    );
+    return LIKELY(have_locked);
+}
+
+void MCSLock::unlock(Node &node) {
+    Node *next = node.next.load(std::memory_order_acquire);
+    if (LIKELY(next == nullptr)) {
+        // If we're the last one in the queue, just empty it.
+        Node *expected = &node;
+        bool have_exchanged = tail.compare_exchange_strong(
+            expected, nullptr,
+            std::memory_order_release, std::memory_order_relaxed
+        );
+        if (LIKELY(have_exchanged)) {
+            return;
+        }
+        // Somebody has enqueued themselves after us, but hasn't linked their
+        // node to ours yet. They're about to do that.
+        spin_until([&node, &next] {
+            next = node.next.load(std::memory_order_acquire);
+            return next != nullptr;
+        });
+    }
+    // Hand the lock over. Note that once we do that, the next waiter can
+    // return and free its node, so we must not touch it afterwards.
+    next->locked.store(false, std::memory_order_release);
+}
+
+// The per-thread node cache, and a bitmask of which nodes are in use.
+static thread_local MCSLock::Node cached_nodes[MCSLock::max_held_per_thread];
+static thread_local uint32_t cached_nodes_in_use = 0;
+constexpr static uint32_t all_cached_nodes =
+    (1u << MCSLock::max_held_per_thread) - 1;
+
+static MCSLock::Node *take_cached_node() {
+    if (UNLIKELY(cached_nodes_in_use == all_cached_nodes)) {
+        fprintf(stderr, "MCSLock: too many locks held by this thread\n");
+        abort();
+    }
+    size_t index = __builtin_ctz(~cached_nodes_in_use);
+    cached_nodes_in_use |= 1u << index;
+    return &cached_nodes[index];
+}
+
+static void return_cached_node(MCSLock::Node *node) {
+    size_t index = node - cached_nodes;
+    assert(cached_nodes_in_use & (1u << index));
+    cached_nodes_in_use &= ~(1u << index);
+}
+
+void MCSLock::lock() {
+    Node *node = take_cached_node();
+    lock(*node);
+    cached_node = node;
+}
+
+bool MCSLock::try_lock() {
+    Node *node = take_cached_node();
+    if (UNLIKELY(!try_lock(*node))) {
+        return_cached_node(node);
+        return false;
+    }
+    cached_node = node;
+    return true;
+}
+
+void MCSLock::unlock() {
+    Node *node = cached_node;
+    unlock(*node);
+    return_cached_node(node);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include "cache_line.h"
+
+class MCSLock {
+public:
+    // A waiter's place in the queue. Each waiting thread spins on the locked
+    // flag of its own node, so that handing the lock over only touches the
+    // cache lines of the two threads involved. A node must stay alive, and
+    // must not be used for anything else, from the call to lock() (or
+    // a successful try_lock()) until the matching unlock() returns.
+    struct alignas(cache_line_size) Node {
+        std::atomic<Node *> next { nullptr };
+        std::atomic_bool locked { false };
+    };
+
+    void lock(Node &node);
+    bool try_lock(Node &node);
+    void unlock(Node &node);
+
+    // The same, using a node from a small per-thread cache. A thread can
+    // hold at most max_held_per_thread locks this way at the same time.
+    void lock();
+    bool try_lock();
+    void unlock();
+
+    constexpr static size_t max_held_per_thread = 8;
+
+    // Holds the lock for as long as it exists, keeping the node right here.
+    class Guard {
+    public:
+        explicit Guard(MCSLock &lock) : lock(lock) {
+            lock.lock(node);
+        }
+        ~Guard() {
+            lock.unlock(node);
+        }
+        Guard(const Guard &) = delete;
+        Guard &operator = (const Guard &) = delete;
+
+    private:
+        MCSLock &lock;
+        Node node;
+    };
+
+private:
+    // The last node in the queue, or nullptr if the lock is not held.
+    std::atomic<Node *> tail { nullptr };
+    // The node from the per-thread cache that the holder has used to lock, if
+    // any. Only accessed by the thread holding the lock.
+    Node *cached_node = nullptr;
+};
@@ -2,81 +2,259 @@
 #include "futex.h"
 #include "util.h"
 #include <cstdint>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <sched.h>
 
-void Mutex::lock() {
-    // Fast path: attempt to claim the mutex without waiting.
-    uint32_t state2 = UNLOCKED;
-    bool have_exchanged = state.compare_exchange_strong(
-        state2, LOCKED_NO_NEED_TO_WAKE,
-        std::memory_order_acquire, std::memory_order_relaxed
-    );
+// Never poll the mutex more than this many times before going to sleep, no
+// matter how successful spinning has been recently.
+constexpr static uint32_t max_spins = 100;
 
-    if (LIKELY(have_exchanged)) {
-        // We grabbed the mutex the fast way, awesome!
-        return;
+// How long a thread can wait for the mutex before it gets handed the mutex
+// directly, instead of competing for it with the threads that keep barging in.
+constexpr static uint64_t starvation_threshold_ns = 1000000;
+
+static uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+static bool detect_multiprocessor() {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        return true;
     }
+    return CPU_COUNT(&set) > 1;
+}
 
-    // Important: the slow path *always* sets the state to LOCKED_NEED_TO_WAKE
-    // (not LOCKED_NO_NEED_TO_WAKE), even if it observes the state being
-    // UNLOCKED at some point. This is so that if a thread goes to sleep here
-    // in lock(), it will always make sure to wake up the next one in line when
-    // it gets to unlock(). Without this guarantee, waking just one sleeping
-    // thread in unlock() would not be enough, since that wouldn't guarantee the
-    // other sleeping threads will eventually get woken up, too.
-    //
-    // Note that LOCKED_NO_NEED_TO_WAKE does not necessarily imply that there
-    // are no waiters, only that the thread holding the mutex is not responsible
-    // for waking them up (perhaps some other thread is). In the same way,
-    // LOCKED_NEED_TO_WAKE does not necessarily imply that there are waiters,
-    // only that the thread holding the mutex is responsible for trying to wake
-    // someone up (whether there is in fact someone to wake up or not).
-
-    if (state2 != LOCKED_NEED_TO_WAKE) {
-        state2 = state.exchange(LOCKED_NEED_TO_WAKE, std::memory_order_acquire);
+// Spinning only makes sense if the thread holding the mutex can be running
+// concurrently with us, so don't bother on a single CPU.
+static const bool is_multiprocessor = detect_multiprocessor();
+
+bool Mutex::spin(uint32_t desired) {
+    if (!is_multiprocessor) {
+        return false;
     }
+    // Use a budget of about twice the number of polls that it has recently
+    // taken to grab the mutex, plus some slack so that a lock that has never
+    // been contended gets a chance to learn anything at all.
+    uint32_t spins2 = spins.load(std::memory_order_relaxed);
+    uint32_t budget = std::min(max_spins, spins2 * 2 + 10);
 
-    while (UNLIKELY(state2 != UNLOCKED)) {
-        futex_wait((const uint32_t *) &state, LOCKED_NEED_TO_WAKE, nullptr);
-        state2 = state.exchange(LOCKED_NEED_TO_WAKE, std::memory_order_acquire);
+    for (uint32_t i = 0; i < budget; i++) {
+        CPU_RELAX();
+        uint32_t state2 = state.load(std::memory_order_relaxed);
+        if (state2 >= LOCKED_NEED_TO_WAKE) {
+            // Somebody has already given up and gone to sleep. Either the
+            // critical section is long, or the thread holding the mutex is not
+            // running at the moment; in both cases, spinning is likely to be a
+            // waste of time. Besides, we'd be competing with sleeping threads
+            // that have been waiting for longer.
+            break;
+        }
+        if (state2 != UNLOCKED) {
+            continue;
+        }
+        bool have_exchanged = state.compare_exchange_weak(
+            state2, desired,
+            std::memory_order_acquire, std::memory_order_relaxed
+        );
+        if (LIKELY(have_exchanged)) {
+            // Move the estimate towards what it took this time. This is racy
+            // with respect to other spinning threads, but it's just a hint.
+            spins.store(
+                (int) spins2 + ((int) i - (int) spins2) / 8,
+                std::memory_order_relaxed
+            );
+            return true;
+        }
     }
+
+    // Spinning didn't help, so spin less the next time.
+    spins.store(spins2 - spins2 / 8, std::memory_order_relaxed);
+    return false;
+}
+
+bool Mutex::try_lock_until(Deadline deadline) {
+    if (LIKELY(try_lock())) {
+        return true;
+    }
+    return lock_slow(state.load(std::memory_order_relaxed), &deadline);
+}
+
+bool Mutex::lock_slow(uint32_t state2, const Deadline *deadline) {
+    STATS(stats.record_slow_path());
+    STATS(uint64_t wait_start = LockStats::now());
+
+    // Critical sections tend to be short, so unless somebody is already
+    // sleeping, spin for a little while in the hope that the mutex gets
+    // released soon. This saves a trip to the kernel and a context switch.
+    if (state2 < LOCKED_NEED_TO_WAKE && spin(LOCKED_NO_NEED_TO_WAKE)) {
+        STATS(stats.record_wait(wait_start));
+        STATS(stats.record_acquired(LockStats::now()));
+        return true;
+    }
+    return lock_contended(deadline, false);
 }
 
 void Mutex::lock_pessimistic() {
     // Same as above, but do not even attempt to jump to LOCKED_NO_NEED_TO_WAKE.
-    // This method is used by CondVar::wait(), see the comment there.
-    uint32_t state2 = state.exchange(
-        LOCKED_NEED_TO_WAKE, std::memory_order_acquire
-    );
+    // This method is used by CondVar::wait(), see the comment there. The thread
+    // may have been requeued onto the mutex and then woken up by unlock(), in
+    // which case it has to be prepared to take over a handed-off mutex.
+    STATS(stats.record_slow_path());
+    STATS(uint64_t wait_start = LockStats::now());
 
-    while (UNLIKELY(state2 != UNLOCKED)) {
-        futex_wait((const uint32_t *) &state, LOCKED_NEED_TO_WAKE, nullptr);
-        state2 = state.exchange(LOCKED_NEED_TO_WAKE, std::memory_order_acquire);
+    if (spin(LOCKED_NEED_TO_WAKE)) {
+        STATS(stats.record_wait(wait_start));
+        STATS(stats.record_acquired(LockStats::now()));
+        return;
     }
+    lock_contended(nullptr, true);
 }
 
-bool Mutex::try_lock() {
-    uint32_t expected = UNLOCKED;
-    bool have_locked = state.compare_exchange_strong(
-        expected, LOCKED_NO_NEED_TO_WAKE,
-        std::memory_order_acquire, std::memory_order_relaxed
-    );
-    return LIKELY(have_locked);
+bool Mutex::lock_contended(const Deadline *deadline, bool woken) {
+    STATS(uint64_t wait_start = LockStats::now());
+    uint64_t sleep_start = woken ? now() : 0;
+    uint32_t state2 = state.load(std::memory_order_relaxed);
+
+    while (true) {
+        // Once we have been sleeping for too long, switch the mutex into the
+        // starvation mode, where it's handed over to the waiting threads in
+        // order, and the threads that are just arriving have to queue up.
+        bool starving = woken && now() - sleep_start > starvation_threshold_ns;
+        if (try_lock_waiting(state2, woken, starving)) {
+            STATS(stats.record_wait(wait_start));
+            STATS(stats.record_acquired(LockStats::now()));
+            return true;
+        }
+        // Giving up is fine at this point: we have made sure the state is
+        // LOCKED_NEED_TO_WAKE (or LOCKED_STARVING), so whoever holds the mutex
+        // will wake up the next thread in line when unlocking it, even if it
+        // was going to be us. At worst, it will try to wake up nobody. Note
+        // that we only get here once we've checked whether we have been handed
+        // the mutex, so we don't leave with it.
+        if (UNLIKELY(deadline_passed(deadline))) {
+            STATS(stats.record_wait(wait_start));
+            return false;
+        }
+        if (!woken) {
+            sleep_start = now();
+        }
+        STATS(stats.record_sleep());
+        futex_wait_until((const uint32_t *) &state, state2, deadline);
+        woken = true;
+        state2 = state.load(std::memory_order_relaxed);
+    }
+}
+
+// Try to lock the mutex as a thread that is prepared to wait for it: either
+// grab it, or make sure that whoever holds it is going to wake us up, and
+// leave state2 set to the state to wait on. Only the threads that have been
+// woken up may take over a handed-off mutex.
+//
+// Important: this *always* sets the state to LOCKED_NEED_TO_WAKE (not
+// LOCKED_NO_NEED_TO_WAKE), even if it observes the state being UNLOCKED at
+// some point. This is so that if a thread goes to sleep in lock(), it will
+// always make sure to wake up the next one in line when it gets to unlock().
+// Without this guarantee, waking just one sleeping thread in unlock() would
+// not be enough, since that wouldn't guarantee the other sleeping threads
+// will eventually get woken up, too.
+//
+// Note that LOCKED_NO_NEED_TO_WAKE does not necessarily imply that there are
+// no waiters, only that the thread holding the mutex is not responsible for
+// waking them up (perhaps some other thread is). In the same way,
+// LOCKED_NEED_TO_WAKE does not necessarily imply that there are waiters, only
+// that the thread holding the mutex is responsible for trying to wake someone
+// up (whether there is in fact someone to wake up or not).
+bool Mutex::try_lock_waiting(uint32_t &state2, bool woken, bool starving) {
+    while (true) {
+        uint32_t desired;
+        std::memory_order order = std::memory_order_relaxed;
+        switch (state2) {
+        case UNLOCKED:
+            desired = LOCKED_NEED_TO_WAKE;
+            order = std::memory_order_acquire;
+            break;
+        case HANDED_OFF:
+            if (!woken) {
+                return false;
+            }
+            // Stay in the starvation mode only for as long as there are
+            // threads that have been waiting for too long.
+            desired = starving ? LOCKED_STARVING : LOCKED_NEED_TO_WAKE;
+            order = std::memory_order_acquire;
+            break;
+        case LOCKED_NO_NEED_TO_WAKE:
+            desired = starving ? LOCKED_STARVING : LOCKED_NEED_TO_WAKE;
+            break;
+        case LOCKED_NEED_TO_WAKE:
+            if (!starving) {
+                return false;
+            }
+            desired = LOCKED_STARVING;
+            break;
+        case LOCKED_STARVING:
+            return false;
+        default:
+            UNREACHABLE();
+        }
+        bool have_exchanged = state.compare_exchange_weak(
+            state2, desired, order, std::memory_order_relaxed
+        );
+        if (!have_exchanged) {
+            continue;
+        }
+        if (order == std::memory_order_acquire) {
+            return true;
+        }
+        state2 = desired;
+    }
+}
+
+void Mutex::unlock_slow(uint32_t state2) {
+    uint32_t desired;
+    do {
+        assert(state2 != UNLOCKED && state2 != HANDED_OFF);
+        // In the starvation mode, keep the mutex locked, so that nobody can
+        // barge in before the thread we're about to wake up takes it over.
+        desired = state2 == LOCKED_STARVING ? HANDED_OFF : UNLOCKED;
+    } while (UNLIKELY(!state.compare_exchange_weak(
+        state2, desired, std::memory_order_release, std::memory_order_relaxed
+    )));
+    if (state2 == LOCKED_STARVING) {
+        hand_off();
+    } else if (state2 == LOCKED_NEED_TO_WAKE) {
+        wake();
+    }
+}
+
+void Mutex::wake() {
+    // Wake just one thread up. Since the thread was sleeping, it has taken
+    // the slow path in lock(), which means it'll eventually wake the next
+    // thread up, and so on. This means we're fine here waking just one of
+    // the threads and not all of them.
+    STATS(int woken =) futex_wake((const uint32_t *) &state, 1);
+    STATS(stats.record_wake(woken));
 }
 
-void Mutex::unlock() {
-    uint32_t state2 = state.exchange(UNLOCKED, std::memory_order_release);
-    switch (EXPECT(state2, LOCKED_NO_NEED_TO_WAKE)) {
-    case UNLOCKED:
-        UNREACHABLE();
-        break;
-    case LOCKED_NO_NEED_TO_WAKE:
-        break;
-    case LOCKED_NEED_TO_WAKE:
-        // Wake just one thread up. Since the thread was sleeping, it has taken
-        // the slow path in lock(), which means it'll eventually wake the next
-        // thread up, and so on. This means we're fine here waking just one of
-        // the threads and not all of them.
-        futex_wake((const uint32_t *) &state, 1);
-        break;
+// The mutex is HANDED_OFF; get a thread to take it over.
+void Mutex::hand_off() {
+    int woken = futex_wake((const uint32_t *) &state, 1);
+    STATS(stats.record_wake(woken));
+    if (LIKELY(woken != 0)) {
+        return;
+    }
+    // The starving threads must have given up, so unlock the mutex for real.
+    // Unless it has been taken over after all (by a thread that was awake),
+    // wake up whoever has gone to sleep on the handed-off mutex since.
+    uint32_t state2 = HANDED_OFF;
+    bool have_exchanged = state.compare_exchange_strong(
+        state2, UNLOCKED, std::memory_order_release, std::memory_order_relaxed
+    );
+    if (have_exchanged) {
+        wake();
     }
 }
@@ -1,19 +1,106 @@
+#pragma once
+
 #include <atomic>
+#include "deadline.h"
+#include "stats.h"
+#include "util.h"
 
 class Mutex {
 public:
+#ifdef SYNC_PRIMITIVES_STATS
+    explicit Mutex(
+        const char *file = __builtin_FILE(), int line = __builtin_LINE()
+    )
+        : stats("Mutex", file, line) { }
+#endif
+    // Only used for statistics; see stats.h.
+    void set_name([[maybe_unused]] const char *name) {
+        STATS(stats.set_name(name));
+    }
+
+    // The fast paths are defined below, so that they can be inlined.
     void lock();
     bool try_lock();
     void unlock();
 
+    bool try_lock_until(Deadline deadline);
+    template<typename Rep, typename Period>
+    bool try_lock_for(const std::chrono::duration<Rep, Period> &timeout) {
+        return try_lock_until(deadline_after(timeout));
+    }
+
 private:
     friend class CondVar;
+    friend class Waitable;
+    bool lock_slow(uint32_t state2, const Deadline *deadline);
     void lock_pessimistic();
+    bool lock_contended(const Deadline *deadline, bool woken);
+    bool try_lock_waiting(uint32_t &state2, bool woken, bool starving);
+    void unlock_slow(uint32_t state2);
+    void wake();
+    void hand_off();
+    bool spin(uint32_t desired);
 
     enum {
         UNLOCKED,
         LOCKED_NO_NEED_TO_WAKE,
         LOCKED_NEED_TO_WAKE,
+        // Like LOCKED_NEED_TO_WAKE, but some thread has been waiting for too
+        // long, so the mutex is to be handed over to a waiting thread directly
+        // on unlock, instead of letting whoever's first grab it.
+        LOCKED_STARVING,
+        // Still locked, on behalf of some thread that has been woken up to
+        // take it over, but hasn't yet.
+        HANDED_OFF,
     };
     std::atomic_uint32_t state { UNLOCKED };
+    // How many times spinning has recently had to poll the mutex before
+    // it could grab it; see Mutex::spin().
+    std::atomic_uint16_t spins { 0 };
+    STATS(LockStats stats;)
 };
+
+inline void Mutex::lock() {
+    // Fast path: attempt to claim the mutex without waiting.
+    uint32_t state2 = UNLOCKED;
+    bool have_exchanged = state.compare_exchange_strong(
+        state2, LOCKED_NO_NEED_TO_WAKE,
+        std::memory_order_acquire, std::memory_order_relaxed
+    );
+
+    if (LIKELY(have_exchanged)) {
+        // We grabbed the mutex the fast way, awesome!
+        STATS(stats.record_fast_path());
+        STATS(stats.record_acquired(LockStats::now()));
+        return;
+    }
+
+    lock_slow(state2, nullptr);
+}
+
+inline bool Mutex::try_lock() {
+    uint32_t expected = UNLOCKED;
+    bool have_locked = state.compare_exchange_strong(
+        expected, LOCKED_NO_NEED_TO_WAKE,
+        std::memory_order_acquire, std::memory_order_relaxed
+    );
+    STATS(if (have_locked) {
+        stats.record_fast_path();
+        stats.record_acquired(LockStats::now());
+    })
+    return LIKELY(have_locked);
+}
+
+inline void Mutex::unlock() {
+    STATS(stats.record_released());
+    // This has to be a compare-and-swap rather than an exchange, since in the
+    // starvation mode, we must not unlock the mutex at all.
+    uint32_t state2 = LOCKED_NO_NEED_TO_WAKE;
+    bool have_exchanged = state.compare_exchange_strong(
+        state2, UNLOCKED, std::memory_order_release, std::memory_order_relaxed
+    );
+    if (LIKELY(have_exchanged)) {
+        return;
+    }
+    unlock_slow(state2);
+}
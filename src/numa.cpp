@@ -0,0 +1,80 @@
+#include "numa.h"
+#include "util.h"
+#include <sched.h>
+#include <dirent.h>
+#include <cstdio>
+
+constexpr static const char *nodes_path = "/sys/devices/system/node";
+
+const NumaTopology &NumaTopology::system() {
+    static const NumaTopology topology;
+    return topology;
+}
+
+NumaTopology::NumaTopology() {
+    DIR *dir = opendir(nodes_path);
+    if (!dir) {
+        // Not built with CONFIG_NUMA, so there's just the one node.
+        return;
+    }
+    while (struct dirent *entry = readdir(dir)) {
+        unsigned node;
+        char rest;
+        if (sscanf(entry->d_name, "node%u%c", &node, &rest) != 1) {
+            continue;
+        }
+        char path[64];
+        snprintf(path, sizeof(path), "%s/node%u/cpulist", nodes_path, node);
+        FILE *file = fopen(path, "r");
+        if (!file) {
+            continue;
+        }
+        if (node >= num_nodes2) {
+            num_nodes2 = node + 1;
+        }
+        // The list looks like "0-3,8-11".
+        unsigned first, last;
+        while (fscanf(file, "%u", &first) == 1) {
+            last = first;
+            int separator = fgetc(file);
+            if (separator == '-') {
+                if (fscanf(file, "%u", &last) != 1) {
+                    break;
+                }
+                separator = fgetc(file);
+            }
+            if (last >= node_of_cpu.size()) {
+                node_of_cpu.resize(last + 1, 0);
+            }
+            for (unsigned cpu = first; cpu <= last; cpu++) {
+                node_of_cpu[cpu] = node;
+            }
+            if (separator != ',') {
+                break;
+            }
+        }
+        fclose(file);
+    }
+    closedir(dir);
+}
+
+size_t NumaTopology::current_node() const {
+    if (fake_current_node) {
+        return fake_current_node() % num_nodes2;
+    }
+    if (num_nodes2 == 1) {
+        return 0;
+    }
+    // This is cheap: glibc gets the CPU from the rseq area without a syscall,
+    // and then we look its node up in the table.
+    int cpu = sched_getcpu();
+    if (LIKELY(cpu >= 0 && (size_t) cpu < node_of_cpu.size())) {
+        return node_of_cpu[cpu];
+    }
+    // A CPU that has been hotplugged since we read the table.
+    unsigned cpu2, node;
+    if (getcpu(&cpu2, &node) != 0 || node >= num_nodes2) {
+        return 0;
+    }
+    return node;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Which NUMA node the calling thread is running on. The real topology comes
+// from /sys/devices/system/node; a made-up one can be used to exercise the
+// NUMA-aware primitives on a machine that only has a single node.
+class NumaTopology {
+public:
+    using CurrentNode = size_t (*)();
+
+    // A made-up topology with the given number of nodes, where the current
+    // node is whatever the function returns.
+    NumaTopology(size_t num_nodes, CurrentNode current_node)
+        : num_nodes2(num_nodes), fake_current_node(current_node) { }
+
+    // The actual topology of the machine, read once.
+    static const NumaTopology &system();
+
+    size_t num_nodes() const {
+        return num_nodes2;
+    }
+    // The thread may get migrated to another node right after this returns,
+    // so this is only ever a hint.
+    size_t current_node() const;
+
+private:
+    NumaTopology();
+
+    size_t num_nodes2 = 1;
+    CurrentNode fake_current_node = nullptr;
+    std::vector<uint16_t> node_of_cpu;
+};
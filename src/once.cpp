@@ -3,7 +3,9 @@
 #include "util.h"
 #include <climits>
 
-void Once::perform(std::function<void ()> callback) {
+bool Once::perform_slow(
+    void (*invoke2)(void *), void *callback, const Deadline *deadline
+) {
     uint32_t state2 = INITIAL;
     bool have_exchanged = state.compare_exchange_strong(
         state2, PERFORMING_NO_WAITERS,
@@ -12,35 +14,60 @@ void Once::perform(std::function<void ()> callback) {
 #endif
         std::memory_order_acquire
     );
-
-    if (UNLIKELY(have_exchanged)) {
-        // We saw INITIAL and changed it to PERFORMING_NO_WAITERS;
-        // we should perform the operation now.
-        callback();
-        // Now, record that we're done.
-        state2 = state.exchange(DONE, std::memory_order_release);
-        switch (EXPECT(state2, PERFORMING_NO_WAITERS)) {
-        case PERFORMING_NO_WAITERS:
-            // Nothing to do!
-            break;
-        case PERFORMING:
-            // Wake everyone who's waiting for us.
-            futex_wake((const uint32_t *) &state, INT_MAX);
-            break;
-        default:
-            UNREACHABLE();
-            break;
+    while (true) {
+        if (UNLIKELY(have_exchanged)) {
+            // We saw INITIAL and changed it to PERFORMING_NO_WAITERS (or
+            // PERFORMING); we should perform the operation now.
+            try {
+                invoke2(callback);
+            } catch (...) {
+                // Put things back the way they were, and let the waiters (if
+                // any) have a go at it instead. All of them: if we woke up
+                // just one, a newcomer (such as ourselves, retrying) could
+                // get in first with PERFORMING_NO_WAITERS, and then nobody
+                // would wake up the rest of them.
+                state2 = state.exchange(INITIAL, std::memory_order_relaxed);
+                if (state2 == PERFORMING) {
+                    futex_wake((const uint32_t *) &state, INT_MAX);
+                }
+                throw;
+            }
+            // Now, record that we're done.
+            state2 = state.exchange(DONE, std::memory_order_release);
+            switch (EXPECT(state2, PERFORMING_NO_WAITERS)) {
+            case PERFORMING_NO_WAITERS:
+                // Nothing to do!
+                break;
+            case PERFORMING:
+                // Wake everyone who's waiting for us.
+                futex_wake((const uint32_t *) &state, INT_MAX);
+                break;
+            default:
+                UNREACHABLE();
+                break;
+            }
+            // We're all done here!
+            return true;
         }
-        // We're all done here!
-        return;
-    }
 
-    while (true) {
         // Alright, let's see what the state is (was).
         switch (EXPECT(state2, DONE)) {
         case DONE:
             // Awesome, nothing to do then.
-            return;
+            return true;
+        case INITIAL:
+            // The callback has thrown, and everyone who was waiting for it
+            // has been woken up to retry it. Whoever loses the race marks
+            // the state PERFORMING again before going back to sleep, so we
+            // can start out with PERFORMING_NO_WAITERS like the first time.
+            have_exchanged = state.compare_exchange_weak(
+                state2, PERFORMING_NO_WAITERS,
+#ifdef SUPPORTS_STRONGER_FAILURE_ORDERING
+                std::memory_order_relaxed,
+#endif
+                std::memory_order_acquire
+            );
+            continue;
         case PERFORMING_NO_WAITERS:
             have_exchanged = state.compare_exchange_weak(
                 state2, PERFORMING,
@@ -54,11 +81,17 @@ void Once::perform(std::function<void ()> callback) {
                 // reevaluate without waiting.
                 continue;
             }
+            have_exchanged = false;
             state2 = PERFORMING;
             // Fallthrough.
         case PERFORMING:
-            // Let's wait for it.
-            futex_wait((const uint32_t *) &state, state2, nullptr);
+            // Let's wait for it, unless we have run out of time. The state
+            // stays PERFORMING even if we were the only waiter, which just
+            // means an unnecessary futex_wake() call later.
+            if (UNLIKELY(deadline_passed(deadline))) {
+                return false;
+            }
+            futex_wait_until((const uint32_t *) &state, state2, deadline);
             // We have been woken up, but that might
             // have been spurious. Reevaluate.
             state2 = state.load(std::memory_order_acquire);
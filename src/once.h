@@ -1,11 +1,60 @@
+#pragma once
+
 #include <atomic>
-#include <functional>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include "deadline.h"
+#include "util.h"
 
 class Once {
 public:
-    void perform(std::function<void()> callback);
+    // If the callback throws, the exception propagates out of perform(), and
+    // the once goes back to its initial state, so that the next caller (or
+    // one of the threads that have been waiting) performs the callback again.
+    template<typename Callback>
+    void perform(Callback &&callback) {
+        if (LIKELY(is_done())) {
+            return;
+        }
+        perform_slow(invoke<Callback>, (void *) &callback, nullptr);
+    }
+
+    // Returns false if another thread is performing the callback, and has not
+    // completed it by the deadline.
+    template<typename Callback>
+    bool perform_until(Callback &&callback, Deadline deadline) {
+        if (LIKELY(is_done())) {
+            return true;
+        }
+        return perform_slow(invoke<Callback>, (void *) &callback, &deadline);
+    }
+    template<typename Callback, typename Rep, typename Period>
+    bool perform_for(
+        Callback &&callback, const std::chrono::duration<Rep, Period> &timeout
+    ) {
+        return perform_until(
+            std::forward<Callback>(callback), deadline_after(timeout)
+        );
+    }
+
+    // Whether the callback has been performed. If this returns true, the
+    // calling thread sees everything written by the callback.
+    bool is_done() const {
+        return state.load(std::memory_order_acquire) == DONE;
+    }
 
 private:
+    // The slow path is out of line, so it gets the callback type-erased, but
+    // without the allocation that std::function might need.
+    template<typename Callback>
+    static void invoke(void *callback) {
+        (*(std::remove_reference_t<Callback> *) callback)();
+    }
+    bool perform_slow(
+        void (*invoke2)(void *), void *callback, const Deadline *deadline
+    );
+
     enum {
         INITIAL,
         DONE,
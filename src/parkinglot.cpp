@@ -0,0 +1,194 @@
+#include "parkinglot.h"
+#include "spinlock.h"
+#include "cache_line.h"
+#include "futex.h"
+#include "util.h"
+#include <atomic>
+#include <cstdint>
+#include <cassert>
+
+namespace {
+
+// What we know about a parked thread. There's exactly one of these per thread,
+// since a thread can only be parked on one address at a time.
+struct ParkedThread {
+    const void *address;
+    ParkedThread *next;
+    // Set once the thread has been dequeued and can go on. The thread sleeps
+    // on this with a futex.
+    std::atomic_uint32_t unparked { 0 };
+};
+
+// Each bucket holds a queue of threads parked on all the addresses that hash
+// to it. The buckets are protected with spinlocks, rather than with mutexes,
+// both because the critical sections are very short, and so that all of this
+// is constant-initialized and can be used before any constructors run.
+struct alignas(cache_line_size) Bucket {
+    Spinlock lock;
+    ParkedThread *head = nullptr;
+    ParkedThread *tail = nullptr;
+};
+
+}
+
+// There's no way to grow the table, so make it large enough for the number of
+// threads that could be parked at the same time.
+constexpr static size_t num_buckets = 1024;
+static Bucket buckets[num_buckets];
+
+static thread_local ParkedThread this_thread;
+
+static Bucket &bucket_for(const void *address) {
+    // Fibonacci hashing.
+    uint64_t hash = (uintptr_t) address * 0x9e3779b97f4a7c15ull;
+    return buckets[hash >> 54];
+}
+static_assert(num_buckets == 1 << (64 - 54), "Fix the hash function");
+
+// Remove the thread from the queue; the bucket must be locked. Returns whether
+// the thread has been found in the queue.
+static bool dequeue(Bucket &bucket, ParkedThread *thread) {
+    ParkedThread *prev = nullptr;
+    for (ParkedThread *t = bucket.head; t; prev = t, t = t->next) {
+        if (t != thread) {
+            continue;
+        }
+        if (prev) {
+            prev->next = t->next;
+        } else {
+            bucket.head = t->next;
+        }
+        if (bucket.tail == t) {
+            bucket.tail = prev;
+        }
+        return true;
+    }
+    return false;
+}
+
+static void wake(ParkedThread *thread) {
+    thread->unparked.store(1, std::memory_order_release);
+    // Note that as soon as we set unparked, the thread may go on and even
+    // exit, so this may end up waking nobody, or whatever else happens to be
+    // waiting on this address by then. Futex users have to be prepared for
+    // spurious wakeups anyway, so that's fine.
+    futex_wake((const uint32_t *) &thread->unparked, 1);
+}
+
+bool ParkingLot::park_impl(
+    const void *address, bool (*validate)(void *), void *context,
+    const Deadline *deadline
+) {
+    Bucket &bucket = bucket_for(address);
+    ParkedThread *me = &this_thread;
+
+    bucket.lock.lock();
+    if (!validate(context)) {
+        bucket.lock.unlock();
+        return false;
+    }
+    me->address = address;
+    me->next = nullptr;
+    me->unparked.store(0, std::memory_order_relaxed);
+    if (bucket.tail) {
+        bucket.tail->next = me;
+    } else {
+        bucket.head = me;
+    }
+    bucket.tail = me;
+    bucket.lock.unlock();
+
+    while (me->unparked.load(std::memory_order_acquire) == 0) {
+        if (UNLIKELY(deadline_passed(deadline))) {
+            // Take ourselves out of the queue, unless somebody is already in
+            // the process of unparking us, in which case we're going to let
+            // them finish.
+            bucket.lock.lock();
+            bool have_dequeued = dequeue(bucket, me);
+            bucket.lock.unlock();
+            if (have_dequeued) {
+                return false;
+            }
+            deadline = nullptr;
+            continue;
+        }
+        futex_wait_until((const uint32_t *) &me->unparked, 0, deadline);
+    }
+    return true;
+}
+
+UnparkResult ParkingLot::unpark_one_impl(
+    const void *address,
+    void (*callback)(UnparkResult, void *), void *context
+) {
+    Bucket &bucket = bucket_for(address);
+    UnparkResult result;
+    ParkedThread *thread = nullptr;
+
+    bucket.lock.lock();
+    for (ParkedThread *t = bucket.head; t; t = t->next) {
+        if (t->address != address) {
+            continue;
+        }
+        if (thread) {
+            result.may_have_more = true;
+            break;
+        }
+        thread = t;
+    }
+    if (thread) {
+        dequeue(bucket, thread);
+        result.did_unpark = true;
+    }
+    if (callback) {
+        callback(result, context);
+    }
+    bucket.lock.unlock();
+
+    if (thread) {
+        wake(thread);
+    }
+    return result;
+}
+
+size_t ParkingLot::unpark_all(const void *address) {
+    Bucket &bucket = bucket_for(address);
+    ParkedThread *threads = nullptr;
+    ParkedThread **last = &threads;
+    size_t count = 0;
+
+    bucket.lock.lock();
+    ParkedThread *prev = nullptr;
+    for (ParkedThread *t = bucket.head; t; ) {
+        ParkedThread *next = t->next;
+        if (t->address != address) {
+            prev = t;
+            t = next;
+            continue;
+        }
+        // Move it over to our own list.
+        if (prev) {
+            prev->next = next;
+        } else {
+            bucket.head = next;
+        }
+        if (bucket.tail == t) {
+            bucket.tail = prev;
+        }
+        t->next = nullptr;
+        *last = t;
+        last = &t->next;
+        count++;
+        t = next;
+    }
+    bucket.lock.unlock();
+
+    while (threads) {
+        // Read the next pointer before waking the thread up,
+        // since it may go on and park itself again right away.
+        ParkedThread *next = threads->next;
+        wake(threads);
+        threads = next;
+    }
+    return count;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include "deadline.h"
+
+// A parking lot, after the one in WebKit: a global hash table of queues of
+// threads waiting ("parked") on arbitrary addresses. This is much like what the
+// kernel does for futexes, except the queues live in user space, and so the
+// addresses don't have to point to 32-bit words: they can be anything at all,
+// such as a single byte holding a couple of lock bits. In exchange, it's the
+// primitive's responsibility to remember whether there are any threads parked,
+// typically in a bit of its own.
+
+struct UnparkResult {
+    // Whether a thread has been unparked.
+    bool did_unpark = false;
+    // Whether there may be more threads still parked on the same address.
+    bool may_have_more = false;
+};
+
+class ParkingLot {
+public:
+    // Park the calling thread on the address until it's unparked, provided
+    // validate() returns true. validate() is called with the queue for this
+    // address locked, which means any thread unparking threads from the same
+    // address will either happen entirely before it, or see us parked. Returns
+    // whether the thread has been unparked (as opposed to validation failing).
+    template<typename Validate>
+    static bool park(const void *address, Validate &&validate) {
+        return park_impl(address, call<Validate>, &validate, nullptr);
+    }
+    // Same, but also gives up at the deadline, and returns false then.
+    template<typename Validate>
+    static bool park_until(
+        const void *address, Validate &&validate, Deadline deadline
+    ) {
+        return park_impl(address, call<Validate>, &validate, &deadline);
+    }
+
+    // Unpark one of the threads parked on the address (the one that has been
+    // waiting for the longest). Before waking the thread up, callback() is
+    // called with the queue locked and with the result, which lets the caller
+    // atomically update its own record of whether there are threads parked.
+    template<typename Callback>
+    static UnparkResult unpark_one(const void *address, Callback &&callback) {
+        return unpark_one_impl(address, call_with_result<Callback>, &callback);
+    }
+    static UnparkResult unpark_one(const void *address) {
+        return unpark_one_impl(address, nullptr, nullptr);
+    }
+
+    // Unpark all the threads parked on the address, and return their number.
+    static size_t unpark_all(const void *address);
+
+private:
+    template<typename F>
+    static bool call(void *f) {
+        return (*(std::remove_reference_t<F> *) f)();
+    }
+    template<typename F>
+    static void call_with_result(UnparkResult result, void *f) {
+        (*(std::remove_reference_t<F> *) f)(result);
+    }
+
+    static bool park_impl(
+        const void *address, bool (*validate)(void *), void *context,
+        const Deadline *deadline
+    );
+    static UnparkResult unpark_one_impl(
+        const void *address,
+        void (*callback)(UnparkResult, void *), void *context
+    );
+};
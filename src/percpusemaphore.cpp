@@ -0,0 +1,215 @@
+#include "percpusemaphore.h"
+#include "util.h"
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cassert>
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#endif
+
+// The critical section below is written in x86-64 assembly, and it needs glibc
+// (2.35 or later) to have registered the rseq area for each thread.
+#if defined(__x86_64__) && defined(RSEQ_SIG)
+#define HAVE_RSEQ 1
+#endif
+
+static_assert(sizeof(std::atomic_uint32_t) == sizeof(uint32_t));
+
+// Registers us for membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ), which
+// disable_caches() relies on. This only has to be done once per process.
+static bool rseq_usable() {
+#ifdef HAVE_RSEQ
+    static bool usable = [] {
+        if (__rseq_size == 0) {
+            // Disabled with the glibc.pthread.rseq tunable, or unsupported
+            // by the kernel.
+            return false;
+        }
+        int rc = syscall(
+            SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_RSEQ,
+            0, 0
+        );
+        return rc == 0;
+    }();
+    return usable;
+#else
+    return false;
+#endif
+}
+
+PerCpuSemaphore::PerCpuSemaphore(size_t initial_value, uint32_t cache_size)
+    : central(initial_value), cache_size(cache_size) {
+    if (rseq_usable()) {
+        num_caches = get_nprocs_conf();
+        caches.reset(new Cache[num_caches]);
+    }
+}
+
+// Add delta to the count in the cache of the CPU we're running on, unless the
+// caches are disabled, or the count would end up below zero or above the cache
+// size. This is the restartable sequence: the kernel knows where it starts and
+// where it commits (the store), and if it preempts us (or delivers a signal) in
+// between, it makes us jump to the abort handler, which starts over, on
+// whatever CPU we're now running on.
+bool PerCpuSemaphore::try_add_local(int32_t delta) {
+#ifdef HAVE_RSEQ
+    if (UNLIKELY(num_caches == 0)) {
+        return false;
+    }
+    static_assert(sizeof(Cache) == 64, "the code below multiplies by 64");
+    struct rseq *area = (struct rseq *) (
+        (char *) __builtin_thread_pointer() + __rseq_offset
+    );
+    uint32_t added;
+    asm volatile (
+        // The descriptor of the critical section: version, flags, start,
+        // length, and the abort handler.
+        ".pushsection __rseq_cs, \"aw\"\n"
+        ".balign 32\n"
+        "3:\n"
+        ".long 0, 0\n"
+        ".quad 1f, 2f - 1f, 4f\n"
+        ".popsection\n"
+        "0:\n"
+        "xorl %[added], %[added]\n"
+        "leaq 3b(%%rip), %%rax\n"
+        "movq %%rax, %c[rseq_cs](%[area])\n"
+        "1:\n"
+        "movl %c[cpu_id](%[area]), %%eax\n"
+        "cmpl %[num_caches], %%eax\n"
+        "jae 5f\n"
+        "cmpl $0, (%[disabled])\n"
+        "jne 5f\n"
+        "shlq $6, %%rax\n"
+        "addq %[caches], %%rax\n"
+        "movl (%%rax), %%ecx\n"
+        "addl %[delta], %%ecx\n"
+        // Unsigned, so that going below zero also counts as going above.
+        "cmpl %[limit], %%ecx\n"
+        "ja 5f\n"
+        "movl %%ecx, (%%rax)\n"
+        "2:\n"
+        "movl $1, %[added]\n"
+        "jmp 5f\n"
+        // The kernel checks that the abort handler is preceded by the
+        // signature, which is embedded in an undefined instruction.
+        ".byte 0x0f, 0xb9, 0x3d\n"
+        ".long %c[signature]\n"
+        "4:\n"
+        "jmp 0b\n"
+        "5:\n"
+        : [added] "=&r" (added)
+        : [area] "r" (area),
+          [rseq_cs] "i" (offsetof(struct rseq, rseq_cs)),
+          [cpu_id] "i" (offsetof(struct rseq, cpu_id)),
+          [signature] "i" (RSEQ_SIG),
+          [num_caches] "r" (num_caches),
+          [disabled] "r" (&disabled),
+          [caches] "r" (caches.get()),
+          [delta] "r" (delta),
+          [limit] "r" (cache_size)
+        : "rax", "rcx", "memory", "cc"
+    );
+    return added;
+#else
+    (void) delta;
+    return false;
+#endif
+}
+
+bool PerCpuSemaphore::try_down_fast() {
+    if (LIKELY(try_add_local(-1))) {
+        return true;
+    }
+    // Our cache is empty; refill it from the central semaphore, if there's
+    // enough there. If we get migrated in the meantime, and the new CPU's
+    // cache has no room, give the units back.
+    uint32_t batch = cache_size / 2;
+    bool enabled = !disabled.load(std::memory_order_relaxed);
+    if (num_caches != 0 && enabled && batch > 1 && central.try_down(batch)) {
+        if (!try_add_local(batch - 1)) {
+            central.up(batch - 1);
+        }
+        return true;
+    }
+    return central.try_down();
+}
+
+void PerCpuSemaphore::disable_caches() {
+    disabling_lock.lock();
+    if (disablers++ == 0 && num_caches != 0) {
+        disabled.store(1, std::memory_order_relaxed);
+        // Restart any critical section that's in progress right now (and
+        // execute a memory barrier on every CPU). After this, they all see
+        // the flag, and leave the caches alone.
+        syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ, 0, 0);
+        uint32_t total = 0;
+        for (uint32_t i = 0; i < num_caches; i++) {
+            total += caches[i].count.exchange(0, std::memory_order_relaxed);
+        }
+        if (total != 0) {
+            central.up(total);
+        }
+    }
+    disabling_lock.unlock();
+}
+
+void PerCpuSemaphore::enable_caches() {
+    disabling_lock.lock();
+    assert(disablers > 0);
+    if (--disablers == 0) {
+        disabled.store(0, std::memory_order_relaxed);
+    }
+    disabling_lock.unlock();
+}
+
+void PerCpuSemaphore::down() {
+    down_until(nullptr);
+}
+
+bool PerCpuSemaphore::try_down() {
+    if (LIKELY(try_down_fast())) {
+        return true;
+    }
+    // The units might still be sitting in other CPUs' caches.
+    disable_caches();
+    bool have_taken = central.try_down();
+    enable_caches();
+    return have_taken;
+}
+
+bool PerCpuSemaphore::down_until(Deadline deadline) {
+    return down_until(&deadline);
+}
+
+bool PerCpuSemaphore::down_until(const Deadline *deadline) {
+    if (LIKELY(try_down_fast())) {
+        return true;
+    }
+    disable_caches();
+    bool have_taken = true;
+    if (deadline) {
+        have_taken = central.down_until(*deadline);
+    } else {
+        central.down();
+    }
+    enable_caches();
+    return have_taken;
+}
+
+void PerCpuSemaphore::up() {
+    if (LIKELY(try_add_local(1))) {
+        return;
+    }
+    // Our cache is full (or the caches are disabled). Move half of it over
+    // to the central semaphore.
+    uint32_t batch = cache_size / 2;
+    if (batch > 0 && try_add_local(-(int32_t) batch)) {
+        central.up(batch + 1);
+        return;
+    }
+    central.up();
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "cache_line.h"
+#include "deadline.h"
+#include "mutex.h"
+#include "semaphore.h"
+
+// A semaphore for when there are lots of units to go around, such as a pool of
+// thousands of connections. Then, the threads taking and releasing units don't
+// have to wait for each other, but with a plain Semaphore, they all still keep
+// modifying the same word, which becomes the bottleneck.
+//
+// Here, each CPU keeps a cache of up to cache_size units, which the threads
+// running on it take units from and release units to, using restartable
+// sequences (rseq): a thread modifies the cache of the CPU it runs on with
+// plain loads and stores, and if it gets preempted or migrated to another CPU
+// midway, the kernel makes it start over. Only when the cache runs empty or
+// overflows does the thread move a batch of units between it and a central
+// Semaphore.
+//
+// Before a thread goes to sleep waiting for units (or fails try_down()), it
+// has to make sure there are none left in any of the caches. So it disables
+// the caches, interrupts any thread that is in the middle of modifying one,
+// moves all the cached units to the central semaphore, and only then waits on
+// it. The caches stay disabled for as long as any thread is waiting, so that
+// up() releases units to the central semaphore, where they're seen by the
+// waiting threads.
+//
+// Without rseq support (in the kernel, glibc, or for the architecture), this
+// is just a Semaphore.
+class PerCpuSemaphore {
+public:
+    explicit PerCpuSemaphore(size_t initial_value, uint32_t cache_size = 64);
+
+    // Only used for statistics; see stats.h.
+    void set_name([[maybe_unused]] const char *name) {
+        central.set_name(name);
+    }
+
+    void down();
+    bool try_down();
+    void up();
+
+    bool down_until(Deadline deadline);
+    template<typename Rep, typename Period>
+    bool down_for(const std::chrono::duration<Rep, Period> &timeout) {
+        return down_until(deadline_after(timeout));
+    }
+
+private:
+    struct alignas(cache_line_size) Cache {
+        std::atomic_uint32_t count { 0 };
+    };
+
+    bool down_until(const Deadline *deadline);
+    bool try_down_fast();
+    bool try_add_local(int32_t delta);
+    void disable_caches();
+    void enable_caches();
+
+    Semaphore central;
+    uint32_t cache_size;
+    // Zero if rseq is not available.
+    uint32_t num_caches = 0;
+    std::unique_ptr<Cache[]> caches;
+    // Read by everyone all the time, so it gets a cache line of its own.
+    alignas(cache_line_size) std::atomic_uint32_t disabled { 0 };
+    // How many threads need the caches disabled.
+    alignas(cache_line_size) Mutex disabling_lock;
+    uint32_t disablers = 0;
+};
@@ -0,0 +1,72 @@
+#include "picondvar.h"
+#include "pimutex.h"
+#include "futex.h"
+#include "util.h"
+#include <climits>
+#include <cerrno>
+
+PICondVar::PICondVar(PIMutex &mutex)
+    : mutex(mutex) { }
+
+void PICondVar::wait() {
+    wait_until(nullptr);
+}
+
+bool PICondVar::wait_until(Deadline deadline) {
+    return wait_until(&deadline);
+}
+
+bool PICondVar::wait_until(const Deadline *deadline) {
+    // Count ourselves in before reading the sequence number: a notifier that
+    // doesn't see us counted in has bumped it before we read it, and so it's
+    // not a notification we should be woken up by.
+    waiters.fetch_add(1, std::memory_order_seq_cst);
+    uint32_t sequence2 = sequence.load(std::memory_order_seq_cst);
+    mutex.unlock();
+    int rc = futex_wait_requeue_pi_until(
+        (const uint32_t *) &sequence, sequence2, deadline,
+        (const uint32_t *) &mutex.state
+    );
+    bool timed_out = rc != 0 && errno == ETIMEDOUT;
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+    if (LIKELY(rc == 0)) {
+        // The kernel has acquired the mutex for us.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return true;
+    }
+    // The sequence number has changed before we got to sleep, or we've
+    // timed out (or got interrupted), so lock the mutex ourselves.
+    mutex.lock();
+    return !timed_out;
+}
+
+void PICondVar::notify_one() {
+    notify(0);
+}
+
+void PICondVar::notify_all() {
+    notify(INT_MAX);
+}
+
+void PICondVar::notify(int number_to_requeue) {
+    uint32_t sequence2 = sequence.fetch_add(
+        1, std::memory_order_seq_cst
+    ) + 1;
+    if (LIKELY(waiters.load(std::memory_order_seq_cst) == 0)) {
+        return;
+    }
+    // Wake up one waiter, taking the mutex for it if it's free, and requeue
+    // the rest onto the mutex (where the kernel will hand it over to them one
+    // by one). If the sequence number changes under us, another notification
+    // has come in, so retry with the new one.
+    while (true) {
+        int rc = futex_cmp_requeue_pi(
+            (const uint32_t *) &sequence, number_to_requeue,
+            (const uint32_t *) &mutex.state, sequence2
+        );
+        if (LIKELY(rc >= 0 || errno != EAGAIN)) {
+            return;
+        }
+        sequence2 = sequence.load(std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+#include "deadline.h"
+
+class PIMutex;
+
+// A condition variable for use with a PIMutex. It works like CondVar, except
+// waking up doesn't make the woken threads race for the mutex (which would
+// lose track of priorities): notifying moves the waiters over to the mutex's
+// PI futex with FUTEX_CMP_REQUEUE_PI, and the kernel acquires the mutex on
+// behalf of each waiter in turn, in priority order, before waking it up.
+class PICondVar {
+public:
+    PICondVar(PIMutex &mutex);
+
+    void wait();
+    template<typename Condition>
+    void wait(Condition &&condition) {
+        while (!condition()) {
+            wait();
+        }
+    }
+
+    // Returns false if the deadline has passed before this thread was woken
+    // up. Either way, the mutex is locked again when this returns.
+    bool wait_until(Deadline deadline);
+    template<typename Condition>
+    bool wait_until(Deadline deadline, Condition &&condition) {
+        while (!condition()) {
+            if (!wait_until(deadline)) {
+                return condition();
+            }
+        }
+        return true;
+    }
+    template<typename Rep, typename Period>
+    bool wait_for(const std::chrono::duration<Rep, Period> &timeout) {
+        return wait_until(deadline_after(timeout));
+    }
+    template<typename Rep, typename Period, typename Condition>
+    bool wait_for(
+        const std::chrono::duration<Rep, Period> &timeout,
+        Condition &&condition
+    ) {
+        return wait_until(
+            deadline_after(timeout), std::forward<Condition>(condition)
+        );
+    }
+
+    void notify_one();
+    void notify_all();
+
+private:
+    bool wait_until(const Deadline *deadline);
+    void notify(int number_to_requeue);
+
+    PIMutex &mutex;
+    // Bumped by every notification; this is what the waiters sleep on.
+    std::atomic_uint32_t sequence { 0 };
+    // How many threads are waiting (or about to), so that notifying nobody
+    // makes no syscalls.
+    std::atomic_uint32_t waiters { 0 };
+};
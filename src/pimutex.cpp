@@ -0,0 +1,77 @@
+#include "pimutex.h"
+#include "futex.h"
+#include "util.h"
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+uint32_t current_tid_slow() {
+    static int registered = pthread_atfork(nullptr, nullptr, [] {
+        cached_tid = 0;
+    });
+    (void) registered;
+    cached_tid = syscall(SYS_gettid);
+    return cached_tid;
+}
+
+bool PIMutex::try_lock_until(Deadline deadline) {
+    if (LIKELY(try_lock())) {
+        return true;
+    }
+    return lock_slow(&deadline);
+}
+
+bool PIMutex::lock_slow(const Deadline *deadline) {
+    while (true) {
+        // The kernel either acquires the mutex for us right away (if it has
+        // been released in the meantime), or sets FUTEX_WAITERS and puts us
+        // to sleep, lending our priority to the owner. Either way, when this
+        // returns 0, the state holds our thread ID, and we own the mutex.
+        int rc = futex_lock_pi_until((const uint32_t *) &state, deadline);
+        if (LIKELY(rc == 0)) {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return true;
+        }
+        if (errno == ETIMEDOUT) {
+            return false;
+        }
+        // Interrupted, or the owner was exiting; retry. Anything else (say,
+        // a corrupted state, or the kernel running out of memory for the
+        // PI state) leaves us without the mutex, and there's no way to
+        // report that from lock().
+        if (UNLIKELY(errno != EINTR && errno != EAGAIN)) {
+            perror("PIMutex: FUTEX_LOCK_PI");
+            abort();
+        }
+    }
+}
+
+bool PIMutex::try_lock_slow() {
+    uint32_t state2 = state.load(std::memory_order_relaxed);
+    if (state2 & FUTEX_TID_MASK) {
+        // Somebody holds it.
+        return false;
+    }
+    // There's no owner, but there are some bits set that only the kernel
+    // knows how to deal with.
+    if (futex_trylock_pi((const uint32_t *) &state) == 0) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return true;
+    }
+    return false;
+}
+
+void PIMutex::unlock_slow() {
+    assert(
+        (state.load(std::memory_order_relaxed) & FUTEX_TID_MASK)
+        == current_tid()
+    );
+    // The FUTEX_WAITERS bit is set, so let the kernel hand the mutex over to
+    // the highest-priority waiter, and drop any priority we've inherited.
+    std::atomic_thread_fence(std::memory_order_release);
+    futex_unlock_pi((const uint32_t *) &state);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "deadline.h"
+#include "util.h"
+
+// The kernel identifies the owner of a PI futex by its thread ID. Getting it
+// is a syscall, so cache it. The thread of a child process created by fork()
+// inherits the cache, but gets a new thread ID, so the child forgets it.
+inline thread_local uint32_t cached_tid = 0;
+uint32_t current_tid_slow();
+
+inline uint32_t current_tid() {
+    if (UNLIKELY(!cached_tid)) {
+        return current_tid_slow();
+    }
+    return cached_tid;
+}
+
+// A mutex with priority inheritance: while a thread waits for the mutex, the
+// thread holding it runs with (at least) the waiter's priority, so that a
+// low-priority thread holding the mutex can't be preempted indefinitely by
+// medium-priority threads, leaving a high-priority waiter stalled.
+//
+// For that, the kernel needs to know who holds the mutex, so instead of the
+// enum that Mutex uses, the state is the thread ID of the owner, or zero when
+// unlocked. Locking and unlocking without contention is still a single
+// compare-and-swap; otherwise, the kernel takes over, with FUTEX_LOCK_PI and
+// FUTEX_UNLOCK_PI, and sets the FUTEX_WAITERS bit in the state, which makes
+// the unlocking thread take the slow path too.
+class PIMutex {
+public:
+    // The fast paths are defined below, so that they can be inlined.
+    void lock();
+    bool try_lock();
+    void unlock();
+
+    bool try_lock_until(Deadline deadline);
+    template<typename Rep, typename Period>
+    bool try_lock_for(const std::chrono::duration<Rep, Period> &timeout) {
+        return try_lock_until(deadline_after(timeout));
+    }
+
+private:
+    friend class PICondVar;
+    bool lock_slow(const Deadline *deadline);
+    bool try_lock_slow();
+    void unlock_slow();
+
+    std::atomic_uint32_t state { 0 };
+};
+
+inline void PIMutex::lock() {
+    uint32_t state2 = 0;
+    bool have_exchanged = state.compare_exchange_strong(
+        state2, current_tid(),
+        std::memory_order_acquire, std::memory_order_relaxed
+    );
+    if (LIKELY(have_exchanged)) {
+        return;
+    }
+    lock_slow(nullptr);
+}
+
+inline bool PIMutex::try_lock() {
+    uint32_t state2 = 0;
+    bool have_exchanged = state.compare_exchange_strong(
+        state2, current_tid(),
+        std::memory_order_acquire, std::memory_order_relaxed
+    );
+    if (LIKELY(have_exchanged)) {
+        return true;
+    }
+    return try_lock_slow();
+}
+
+inline void PIMutex::unlock() {
+    uint32_t state2 = current_tid();
+    bool have_exchanged = state.compare_exchange_strong(
+        state2, 0, std::memory_order_release, std::memory_order_relaxed
+    );
+    if (UNLIKELY(!have_exchanged)) {
+        unlock_slow();
+    }
+}
@@ -0,0 +1,233 @@
+#include "rcu.h"
+#include "event.h"
+#include "futex.h"
+#include "mutex.h"
+#include "once.h"
+#include "util.h"
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <climits>
+#include <thread>
+
+// How many times synchronize() polls a reader's slot before going to sleep.
+constexpr static int spin_limit = 100;
+
+// The registered readers. The lock also serializes the updaters, and is never
+// taken by readers other than when they register and unregister, so it's
+// fine for it to be a single global one.
+struct RCU::Registry {
+    Mutex lock;
+    Reader *readers = nullptr;
+};
+
+// Leaked on purpose, since the reclaimer thread may still be running when
+// the static destructors are.
+RCU::Registry &RCU::registry() {
+    static Registry *registry2 = new Registry;
+    return *registry2;
+}
+
+// Unregisters the thread's reader when the thread exits.
+class RCU::ReaderRegistration {
+public:
+    ~ReaderRegistration() {
+        if (!reader) {
+            return;
+        }
+        Registry &registry2 = registry();
+        registry2.lock.lock();
+        if (reader->prev) {
+            reader->prev->next = reader->next;
+        } else {
+            registry2.readers = reader->next;
+        }
+        if (reader->next) {
+            reader->next->prev = reader->prev;
+        }
+        registry2.lock.unlock();
+        delete reader;
+        RCU::reader = nullptr;
+    }
+
+    Reader *reader = nullptr;
+};
+
+RCU::Reader *RCU::register_reader() {
+    static thread_local ReaderRegistration registration;
+    Reader *reader2 = new Reader;
+    Registry &registry2 = registry();
+    registry2.lock.lock();
+    reader2->next = registry2.readers;
+    if (registry2.readers) {
+        registry2.readers->prev = reader2;
+    }
+    registry2.readers = reader2;
+    registry2.lock.unlock();
+    registration.reader = reader2;
+    reader = reader2;
+    return reader2;
+}
+
+void RCU::updater_fence() {
+    if (membarrier_enabled.load(std::memory_order_relaxed)) {
+        // Executes a full memory barrier on every CPU currently running one
+        // of our threads. The ones that aren't running will execute one
+        // when they get scheduled.
+        syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+    } else {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+bool RCU::enable_membarrier() {
+    if (membarrier_enabled.load(std::memory_order_relaxed)) {
+        return true;
+    }
+    long commands = syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+    if (commands < 0 || !(commands & MEMBARRIER_CMD_PRIVATE_EXPEDITED)) {
+        return false;
+    }
+    int rc = syscall(
+        SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0
+    );
+    if (rc != 0) {
+        return false;
+    }
+    // Flip the flag while holding the lock, so that no synchronize() is in
+    // progress: any reader that sees the flag and skips its fence is then
+    // sure to be seen by an updater that issues a membarrier() instead.
+    Registry &registry2 = registry();
+    registry2.lock.lock();
+    membarrier_enabled.store(true, std::memory_order_relaxed);
+    registry2.lock.unlock();
+    return true;
+}
+
+bool RCU::is_waiting_for(const Reader *reader, uint64_t epoch) {
+    // Acquire whatever the reader has read in its critical section, so that
+    // it's ordered before whatever the caller does to the old version.
+    uint64_t epoch2 = reader->epoch.load(std::memory_order_acquire);
+    return epoch2 != 0 && epoch2 < epoch;
+}
+
+void RCU::wait_for(const Reader *reader, uint64_t epoch) {
+    // Read-side critical sections are supposed to be short, so poll for a
+    // little while first.
+    for (int i = 0; i < spin_limit; i++) {
+        CPU_RELAX();
+        if (!is_waiting_for(reader, epoch)) {
+            return;
+        }
+    }
+    while (true) {
+        // Ask the readers to wake us up when they leave, and then recheck.
+        // This is the other side of the fence in read_unlock().
+        updater_waiting.store(1, std::memory_order_relaxed);
+        updater_fence();
+        if (!is_waiting_for(reader, epoch)) {
+            break;
+        }
+        futex_wait((const uint32_t *) &updater_waiting, 1, nullptr);
+    }
+    updater_waiting.store(0, std::memory_order_relaxed);
+}
+
+void RCU::wake_updater() {
+    // Several readers may get here at once; only one of them has to wake it.
+    if (updater_waiting.exchange(0, std::memory_order_relaxed)) {
+        futex_wake((const uint32_t *) &updater_waiting, INT_MAX);
+    }
+}
+
+void RCU::synchronize() {
+    Registry &registry2 = registry();
+    registry2.lock.lock();
+    // Make sure the readers that we find not reading are going to see
+    // whatever the caller has published before calling us. This is the
+    // other side of the fence in read_lock().
+    updater_fence();
+    uint64_t epoch = global_epoch.fetch_add(1, std::memory_order_relaxed);
+    epoch++;
+    Reader *reader2 = registry2.readers;
+    for (; reader2; reader2 = reader2->next) {
+        if (is_waiting_for(reader2, epoch)) {
+            wait_for(reader2, epoch);
+        }
+    }
+    registry2.lock.unlock();
+}
+
+struct RCU::Reclaimer {
+    // Callbacks waiting for a grace period, pushed onto a lock-free stack.
+    static inline std::atomic<Callback *> pending { nullptr };
+    // Set by the reclaimer when it's about to go to sleep.
+    static inline std::atomic_uint32_t sleeping { 0 };
+    static inline Once started;
+};
+
+void RCU::enqueue(Callback *callback) {
+    Reclaimer::started.perform([] {
+        std::thread(reclaim).detach();
+    });
+    Callback *head = Reclaimer::pending.load(std::memory_order_relaxed);
+    do {
+        callback->next = head;
+    } while (UNLIKELY(!Reclaimer::pending.compare_exchange_weak(
+        head, callback, std::memory_order_release, std::memory_order_relaxed
+    )));
+    // Either we see the reclaimer going to sleep, or it sees our callback.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (UNLIKELY(Reclaimer::sleeping.load(std::memory_order_relaxed))) {
+        if (Reclaimer::sleeping.exchange(0, std::memory_order_relaxed)) {
+            futex_wake((const uint32_t *) &Reclaimer::sleeping, 1);
+        }
+    }
+}
+
+void RCU::reclaim() {
+    while (true) {
+        Callback *batch = Reclaimer::pending.exchange(
+            nullptr, std::memory_order_acquire
+        );
+        if (!batch) {
+            Reclaimer::sleeping.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!Reclaimer::pending.load(std::memory_order_relaxed)) {
+                futex_wait(
+                    (const uint32_t *) &Reclaimer::sleeping, 1, nullptr
+                );
+            }
+            Reclaimer::sleeping.store(0, std::memory_order_relaxed);
+            continue;
+        }
+        // Everything that has been queued up while we've been busy with the
+        // previous batch shares a single grace period.
+        synchronize();
+        // The stack is in reverse order; run the callbacks in the order they
+        // were queued in.
+        Callback *reversed = nullptr;
+        while (batch) {
+            Callback *next = batch->next;
+            batch->next = reversed;
+            reversed = batch;
+            batch = next;
+        }
+        while (reversed) {
+            Callback *next = reversed->next;
+            reversed->run();
+            delete reversed;
+            reversed = next;
+        }
+    }
+}
+
+void RCU::barrier() {
+    // The callbacks run in order, so once ours has run, so have all the
+    // ones queued up before it.
+    Event done;
+    call([&done] {
+        done.notify();
+    });
+    done.wait();
+}
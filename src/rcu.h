@@ -0,0 +1,157 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include "cache_line.h"
+#include "util.h"
+
+// Read-copy-update. Readers of a shared data structure mark their read-side
+// critical sections with RCU::read_lock() and RCU::read_unlock(), which only
+// write to the reading thread's own cache line, so any number of readers can
+// run in parallel without slowing each other down. An updater publishes a new
+// version of the data (say, by atomically storing a pointer to it), and then
+// calls RCU::synchronize(), which waits for all the readers that might still
+// be looking at the old version to leave their critical sections; after that,
+// the old version can be freed. Or, instead of waiting, the updater can call
+// RCU::retire() or RCU::call() to have the old version freed later, on a
+// background thread.
+//
+// There's a single, global RCU domain. Every thread that reads gets its own
+// epoch slot, registered on first use. A reader copies the global epoch into
+// its slot when entering an (outermost) critical section, and zeroes it when
+// leaving. synchronize() bumps the global epoch, and waits until every slot is
+// either zero (the thread is not reading), or holds the new epoch (the thread
+// has started reading after the bump, so it sees the new version). The epoch
+// is 64 bits wide, so it never wraps around.
+class RCU {
+public:
+    // Critical sections can nest. Don't call synchronize() from inside one.
+    static void read_lock();
+    static void read_unlock();
+
+    // Wait for all the critical sections that are in progress to end.
+    static void synchronize();
+
+    // Run the callback, or delete the object, on the background thread once
+    // all the critical sections in progress have ended. The callbacks queued
+    // up in the meantime all share the same grace period.
+    template<typename F>
+    static void call(F &&f) {
+        enqueue(new FunctionCallback<std::decay_t<F>>(std::forward<F>(f)));
+    }
+    template<typename T>
+    static void retire(T *object) {
+        call([object] { delete object; });
+    }
+    // Wait for all the callbacks queued so far to run.
+    static void barrier();
+
+    // Have synchronize() make the readers execute a memory barrier with
+    // membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED), so that they don't have
+    // to execute one themselves in read_lock() and read_unlock(). This makes
+    // synchronize() more expensive, since it interrupts every CPU running
+    // one of our threads, so it's only worth it for read-mostly workloads.
+    // There's no going back once it's enabled. Returns false if the kernel
+    // doesn't support it.
+    static bool enable_membarrier();
+
+private:
+    struct alignas(cache_line_size) Reader {
+        // The epoch this thread has entered its critical section in, or zero.
+        std::atomic_uint64_t epoch { 0 };
+        Reader *prev = nullptr;
+        Reader *next = nullptr;
+    };
+
+    class Callback {
+    public:
+        virtual ~Callback() = default;
+        virtual void run() = 0;
+
+    private:
+        friend class RCU;
+        Callback *next = nullptr;
+    };
+
+    template<typename F>
+    class FunctionCallback final : public Callback {
+    public:
+        FunctionCallback(F &&f) : f(std::move(f)) { }
+        FunctionCallback(const F &f) : f(f) { }
+        void run() override {
+            f();
+        }
+
+    private:
+        F f;
+    };
+
+    struct Registry;
+    class ReaderRegistration;
+    struct Reclaimer;
+
+    static Registry &registry();
+    static Reader *register_reader();
+    static void wake_updater();
+    static void enqueue(Callback *callback);
+    static void reclaim();
+    static bool is_waiting_for(const Reader *reader, uint64_t epoch);
+    static void wait_for(const Reader *reader, uint64_t epoch);
+
+    // The fence a reader needs between writing its slot and reading the
+    // data (or the updater_waiting flag). With membarrier, synchronize()
+    // makes the CPU execute it on the reader's behalf, and only the compiler
+    // needs to be kept from reordering things.
+    static void reader_fence() {
+        if (membarrier_enabled.load(std::memory_order_relaxed)) {
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+        } else {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+    static void updater_fence();
+
+    static inline thread_local Reader *reader = nullptr;
+    static inline thread_local uint32_t nesting = 0;
+
+    static inline std::atomic_uint64_t global_epoch { 1 };
+    // Set by synchronize() when it's going to sleep waiting for a reader.
+    static inline std::atomic_uint32_t updater_waiting { 0 };
+    static inline std::atomic_bool membarrier_enabled { false };
+};
+
+inline void RCU::read_lock() {
+    if (UNLIKELY(nesting++ != 0)) {
+        return;
+    }
+    Reader *reader2 = reader;
+    if (UNLIKELY(!reader2)) {
+        reader2 = register_reader();
+    }
+    // The epoch we read may already be stale, if synchronize() is bumping it
+    // right now. That's fine: it will just wait for us, even though we're
+    // going to see the new version.
+    reader2->epoch.store(
+        global_epoch.load(std::memory_order_relaxed),
+        std::memory_order_relaxed
+    );
+    // Make sure the updater sees our slot, or we see what it has published
+    // before looking at the slots (or both). This is the classic store-load
+    // pattern, so it needs a full fence on both sides.
+    reader_fence();
+}
+
+inline void RCU::read_unlock() {
+    if (UNLIKELY(--nesting != 0)) {
+        return;
+    }
+    // Let the updater free what we've been reading.
+    reader->epoch.store(0, std::memory_order_release);
+    // Same as above, but between the slot and the updater_waiting flag.
+    reader_fence();
+    if (UNLIKELY(updater_waiting.load(std::memory_order_relaxed))) {
+        wake_updater();
+    }
+}
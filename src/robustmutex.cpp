@@ -0,0 +1,64 @@
+#include "robustmutex.h"
+#include "futex.h"
+#include "util.h"
+#include <cassert>
+#include <cerrno>
+
+RobustMutex::RobustMutex() {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    // A robust mutex only makes sense in shared memory, but a process-shared
+    // pthread mutex works in private memory just as well.
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    [[maybe_unused]] int rc = pthread_mutex_init(&mutex, &attr);
+    assert(rc == 0);
+    pthread_mutexattr_destroy(&attr);
+}
+
+RobustMutex::~RobustMutex() {
+    pthread_mutex_destroy(&mutex);
+}
+
+static RobustMutex::LockResult to_lock_result(int rc) {
+    switch (rc) {
+    case 0:
+        return RobustMutex::ACQUIRED;
+    case EOWNERDEAD:
+        return RobustMutex::OWNER_DIED;
+    case ENOTRECOVERABLE:
+        return RobustMutex::NOT_RECOVERABLE;
+    case EBUSY:
+    case ETIMEDOUT:
+        return RobustMutex::BUSY;
+    default:
+        // EDEADLK is not reported for a default-type mutex, and EAGAIN only
+        // for recursive ones.
+        UNREACHABLE();
+    }
+}
+
+RobustMutex::LockResult RobustMutex::lock() {
+    return to_lock_result(pthread_mutex_lock(&mutex));
+}
+
+RobustMutex::LockResult RobustMutex::try_lock() {
+    return to_lock_result(pthread_mutex_trylock(&mutex));
+}
+
+RobustMutex::LockResult RobustMutex::try_lock_until(Deadline deadline) {
+    // The same absolute CLOCK_MONOTONIC time that the futexes take.
+    struct timespec ts = deadline_to_timespec(deadline);
+    return to_lock_result(
+        pthread_mutex_clocklock(&mutex, CLOCK_MONOTONIC, &ts)
+    );
+}
+
+void RobustMutex::unlock() {
+    pthread_mutex_unlock(&mutex);
+}
+
+void RobustMutex::mark_consistent() {
+    [[maybe_unused]] int rc = pthread_mutex_consistent(&mutex);
+    assert(rc == 0);
+}
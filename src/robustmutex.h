@@ -0,0 +1,62 @@
+#pragma once
+
+#include <pthread.h>
+#include "deadline.h"
+
+// A mutex that survives its owner dying while holding it, meant for memory
+// shared between processes, where one of them crashing must not leave the
+// others deadlocked forever.
+//
+// Owner death is detected by the kernel: every thread registers a "robust
+// list" with it (set_robust_list), into which it links the robust mutexes it
+// holds, and when the thread exits, the kernel walks the list, sets the
+// FUTEX_OWNER_DIED bit in each futex word still held, and wakes a waiter.
+// The catch is that there's only one such list per thread, and the C library
+// has already registered its own, which the kernel walks with a single fixed
+// layout for all the entries. So we can't have a list of our own without
+// breaking the pthread robust mutexes of every thread we touch; instead, this
+// wraps a robust, process-shared pthread mutex, which participates in the C
+// library's list.
+//
+// Unlike the other primitives, this one has to be constructed in place, once,
+// by whoever sets the shared memory up; the other processes then use it
+// without constructing it again.
+class RobustMutex {
+public:
+    enum LockResult {
+        // We hold the mutex.
+        ACQUIRED,
+        // We hold the mutex, but its previous owner has died holding it, so
+        // whatever it protects may be inconsistent. Repair it and call
+        // mark_consistent() before unlocking; unlocking without doing so
+        // leaves the mutex permanently unusable.
+        OWNER_DIED,
+        // Somebody has unlocked the mutex without making it consistent
+        // after its owner has died. Nobody can ever hold it again.
+        NOT_RECOVERABLE,
+        // The mutex is held by someone else (only from try_lock() and
+        // try_lock_until()).
+        BUSY,
+    };
+
+    RobustMutex();
+    ~RobustMutex();
+    RobustMutex(const RobustMutex &) = delete;
+    RobustMutex &operator = (const RobustMutex &) = delete;
+
+    LockResult lock();
+    LockResult try_lock();
+    void unlock();
+    // Declare that the state protected by the mutex has been repaired after
+    // lock() has returned OWNER_DIED.
+    void mark_consistent();
+
+    LockResult try_lock_until(Deadline deadline);
+    template<typename Rep, typename Period>
+    LockResult try_lock_for(const std::chrono::duration<Rep, Period> &timeout) {
+        return try_lock_until(deadline_after(timeout));
+    }
+
+private:
+    pthread_mutex_t mutex;
+};
@@ -4,30 +4,57 @@
 #include <climits>
 #include <cassert>
 
-void RWLock::lock_read() {
+// The lock is phase-fair: read phases, during which any number of readers can
+// hold the lock, alternate with write phases, during which one writer holds it.
+// When a writer is waiting, newly arriving readers wait too, so that the read
+// phase ends; and when a write phase ends, the readers that have been waiting
+// for it are let in before the next writer. This way, neither readers nor
+// writers can starve the other side: a thread waits for at most one phase of
+// the other kind (and the current phase of its own kind) before it's let in.
+//
+// Readers and writers record the fact that they're waiting in separate bits,
+// so that whoever releases the lock knows whom to wake.
+
+bool RWLock::try_lock_read_until(Deadline deadline) {
+    return lock_read_until(&deadline);
+}
+
+bool RWLock::lock_read_until(const Deadline *deadline) {
     uint32_t state2 = state.load(std::memory_order_relaxed);
+    // Whether a write phase has ended since we've started waiting, meaning
+    // it's our turn now, even if more writers are waiting.
+    bool our_turn = false;
+    uint32_t our_phase = 0;
+    STATS(uint64_t wait_start = 0);
 
     while (true) {
-        // Disallow new readers when there are waiting writers.
-        if (LIKELY(!(state2 & (locked_write_bit | need_to_wake_bit)))) {
-            // Nobody is writing or waiting to write, let's attempt
-            // to take the lock.
-            uint32_t count = state2;
-            uint32_t desired = count + 1;
-            bool have_exchanged = state.compare_exchange_strong(
-                state2, desired,
+        bool can_enter = !(state2 & locked_write_bit) && (
+            LIKELY(!(state2 & writers_waiting_bit)) || our_turn
+        );
+        if (LIKELY(can_enter)) {
+            assert((state2 & count_mask) != count_mask);
+            bool have_exchanged = state.compare_exchange_weak(
+                state2, state2 + 1,
                 std::memory_order_acquire, std::memory_order_relaxed
             );
             if (UNLIKELY(!have_exchanged)) {
                 // Reevaluate.
                 continue;
             }
-            return;
+            STATS(if (wait_start) {
+                stats.record_wait(wait_start);
+            } else {
+                stats.record_fast_path();
+            })
+            return true;
         }
+        STATS(if (!wait_start) {
+            stats.record_slow_path();
+            wait_start = LockStats::now();
+        })
         // We're going to wait, so record the fact that we're waiting.
-        if (!(state2 & need_to_wake_bit)) {
-            assert(state2 == locked_write_bit);
-            uint32_t desired = locked_write_bit | need_to_wake_bit;
+        if (!(state2 & readers_waiting_bit)) {
+            uint32_t desired = state2 | readers_waiting_bit;
             bool have_exchanged = state.compare_exchange_weak(
                 state2, desired, std::memory_order_relaxed
             );
@@ -37,143 +64,247 @@ void RWLock::lock_read() {
             }
             state2 = desired;
         }
-        futex_wait_bitset(
-            (const uint32_t *) &state, state2, nullptr, reader_mask
+        // Whoever ends the current write phase clears the readers_waiting_bit
+        // and wakes all the readers, even if there's nobody to wake (or, if
+        // there's no write phase, whoever finds the writers gone), so we can
+        // just leave.
+        if (UNLIKELY(deadline_passed(deadline))) {
+            STATS(stats.record_wait(wait_start));
+            return false;
+        }
+        our_phase = state2 & phase_bit;
+        STATS(stats.record_sleep());
+        futex_wait_bitset_until(
+            (const uint32_t *) &state, state2, deadline, reader_mask
         );
-        // If somebody has woken up readers, we expect to see a 0.
-        state2 = 0;
+        state2 = state.load(std::memory_order_relaxed);
+        // If the phase has changed since, we've been let in, and we should
+        // not wait any further; unless some writer has already taken the lock
+        // again, in which case we're going to wait for the next phase change.
+        our_turn = (state2 & phase_bit) != our_phase;
     }
 }
 
-void RWLock::lock_write() {
-    uint32_t state2 = 0;
-    bool have_exchanged = state.compare_exchange_strong(
-       state2, locked_write_bit,
-       std::memory_order_acquire, std::memory_order_relaxed
-    );
+bool RWLock::try_lock_write_until(Deadline deadline) {
+    return lock_write_until(&deadline);
+}
 
-    if (LIKELY(have_exchanged)) {
-        return;
-    }
+bool RWLock::lock_write_until(const Deadline *deadline) {
+    uint32_t state2 = state.load(std::memory_order_relaxed);
+    // Whether we've been woken up to take the lock.
+    bool our_turn = false;
+    STATS(uint64_t wait_start = 0);
 
-    // Alrigth, the fast way didn't work, let's try the slow way.
     while (true) {
-        if ((state2 & ~need_to_wake_bit) == 0) {
-            assert(state2 == 0);
-            // Try to grab it.
-            have_exchanged = state.compare_exchange_strong(
-               state2, locked_write_bit | need_to_wake_bit,
-               std::memory_order_acquire, std::memory_order_relaxed
+        bool can_enter = !(state2 & (locked_write_bit | count_mask)) && (
+            LIKELY(!(state2 & writers_waiting_bit)) || our_turn
+        );
+        if (LIKELY(can_enter)) {
+            // If we've been woken up, there may be other writers waiting, so
+            // leave the writers_waiting_bit set.
+            bool have_exchanged = state.compare_exchange_weak(
+                state2, state2 | locked_write_bit,
+                std::memory_order_acquire, std::memory_order_relaxed
             );
             if (UNLIKELY(!have_exchanged)) {
                 // Reevaluate.
                 continue;
             }
-            return;
+            STATS(if (wait_start) {
+                stats.record_wait(wait_start);
+            } else {
+                stats.record_fast_path();
+            })
+            STATS(stats.record_acquired(LockStats::now()));
+            begin_write();
+            return true;
         }
+        STATS(if (!wait_start) {
+            stats.record_slow_path();
+            wait_start = LockStats::now();
+        })
         // We're going to wait, so record the fact that we're waiting.
-        if (!(state2 & need_to_wake_bit)) {
-            uint32_t desired = state2 | need_to_wake_bit;
-            have_exchanged = state.compare_exchange_strong(
+        if (!(state2 & writers_waiting_bit)) {
+            uint32_t desired = state2 | writers_waiting_bit;
+            bool have_exchanged = state.compare_exchange_weak(
                 state2, desired, std::memory_order_relaxed
             );
             if (UNLIKELY(!have_exchanged)) {
+                // Reevaluate.
                 continue;
             }
             state2 = desired;
         }
-        futex_wait_bitset(
-            (const uint32_t *) &state, state2, nullptr, writer_mask
+        // Giving up leaves the writers_waiting_bit set, which keeps new
+        // readers out until the lock is released. Whoever releases it will
+        // find no writer to wake, and let the readers in instead.
+        if (UNLIKELY(deadline_passed(deadline))) {
+            STATS(stats.record_wait(wait_start));
+            return false;
+        }
+        STATS(stats.record_sleep());
+        int rc = futex_wait_bitset_until(
+            (const uint32_t *) &state, state2, deadline, writer_mask
         );
-        // If somebody has woken up a writer, we expect to see a 0 or a
-        // need_to_wake_bit. Let's try guessing 0.
-        state2 = 0;
+        // If the state has changed before we got to sleep, we haven't been
+        // woken up, and it's some other writer's turn.
+        our_turn = rc == 0;
+        state2 = state.load(std::memory_order_relaxed);
     }
 }
 
-bool RWLock::try_lock_read() {
+bool RWLock::try_upgrade() {
     uint32_t state2 = state.load(std::memory_order_relaxed);
-    if (UNLIKELY(state2 & (locked_write_bit | need_to_wake_bit))) {
+    do {
+        assert(!(state2 & locked_write_bit));
+        assert((state2 & count_mask) != 0);
+        // We can only upgrade if we're the only reader. We don't care about
+        // the waiting threads, if any: we just stay in the lock, and they
+        // keep waiting until we release it.
+        if ((state2 & count_mask) != 1) {
+            return false;
+        }
+    } while (UNLIKELY(!state.compare_exchange_weak(
+        state2, (state2 - 1) | locked_write_bit,
+        std::memory_order_acquire, std::memory_order_relaxed
+    )));
+    STATS(stats.record_acquired(LockStats::now()));
+    begin_write();
+    return true;
+}
+
+bool RWLock::try_convert_to_read(uint32_t stamp) {
+    if (UNLIKELY(stamp == 0) || UNLIKELY(!try_lock_read())) {
         return false;
     }
-    uint32_t count = state2;
-    uint32_t desired = count + 1;
-    bool have_exchanged = state.compare_exchange_strong(
-        state2, desired,
-        std::memory_order_acquire, std::memory_order_relaxed
-    );
-    return LIKELY(have_exchanged);
+    // Holding the lock for reading keeps writers out, so if the version
+    // still matches, no writer has come and gone since the stamp was taken.
+    if (UNLIKELY(version.load(std::memory_order_relaxed) != stamp)) {
+        unlock_read();
+        return false;
+    }
+    return true;
 }
 
-bool RWLock::try_lock_write() {
-    uint32_t expected = 0;
-    bool have_locked = state.compare_exchange_strong(
-       expected, locked_write_bit,
-       std::memory_order_acquire, std::memory_order_relaxed
-    );
-    return have_locked;
+bool RWLock::try_convert_to_write(uint32_t stamp) {
+    if (UNLIKELY(stamp == 0) || UNLIKELY(!try_lock_write())) {
+        return false;
+    }
+    // We have bumped the version ourselves when taking the lock.
+    if (UNLIKELY(version.load(std::memory_order_relaxed) != stamp + 1)) {
+        unlock_write();
+        return false;
+    }
+    return true;
 }
 
-bool RWLock::try_upgrade() {
-    uint32_t state2 = 1;
-    uint32_t desired = locked_write_bit;
-    bool have_exchanged = state.compare_exchange_strong(
-        state2, desired,
-        std::memory_order_acquire, std::memory_order_relaxed
-    );
-    assert(!(state2 & locked_write_bit));
-    if (have_exchanged) {
-        return true;
+// Wake up a writer to take the lock once it becomes free, or if there's none,
+// forget about the writers and let the readers in.
+void RWLock::wake_writer() {
+    int woken = futex_wake_bitset((const uint32_t *) &state, 1, writer_mask);
+    STATS(stats.record_wake(woken));
+    if (LIKELY(woken != 0)) {
+        return;
     }
-    if (state2 == (1 | need_to_wake_bit)) {
-        // We can handle this situation too.
-        // No new readers (or writers) can enter the critical
-        // section if there are writers waiting.
-        state2 = state.exchange(
-            locked_write_bit | need_to_wake_bit,
-            std::memory_order_acquire
+    forget_writers();
+}
+
+// There are no writers sleeping, even though the writers_waiting_bit is set
+// (they must have timed out, or the last one of them has already taken the
+// lock and is now done). Clear the bit, so that new readers don't wait for
+// nothing, and wake the readers that already do.
+void RWLock::forget_writers() {
+    uint32_t state2 = state.load(std::memory_order_relaxed);
+    uint32_t desired;
+    do {
+        if (state2 & (locked_write_bit | count_mask)) {
+            // Somebody has taken the lock in the meantime,
+            // they'll take care of this when releasing it.
+            return;
+        }
+        desired = state2 & ~writers_waiting_bit;
+        if (state2 & readers_waiting_bit) {
+            desired = (desired & ~readers_waiting_bit) ^ phase_bit;
+        }
+        // A writer that has set the bit, but not gone to sleep yet, is going
+        // to notice the change, and reevaluate.
+    } while (UNLIKELY(!state.compare_exchange_weak(
+        state2, desired, std::memory_order_relaxed
+    )));
+    if (state2 & readers_waiting_bit) {
+        STATS(int woken =) futex_wake_bitset(
+            (const uint32_t *) &state, INT_MAX, reader_mask
         );
-        assert(state2 == (1 | need_to_wake_bit));
-        return true;
+        STATS(stats.record_wake(woken));
     }
-    return false;
 }
 
 void RWLock::downgrade() {
-    uint32_t state2 = state.exchange(1, std::memory_order_release);
-    assert(state2 & locked_write_bit);
-    uint32_t count = state2 & ~need_to_wake_bit & ~locked_write_bit;
-    assert(count == 0);
-    (void) count;
-    if (UNLIKELY(state2 & need_to_wake_bit)) {
-        // Wake all the readers.
-        futex_wake_bitset((const uint32_t *) &state, INT_MAX, reader_mask);
+    STATS(stats.record_released());
+    end_write();
+    uint32_t state2 = state.load(std::memory_order_relaxed);
+    uint32_t desired;
+    do {
+        assert(state2 & locked_write_bit);
+        assert((state2 & count_mask) == 0);
+        // This ends the write phase: let the waiting readers in with us.
+        desired = (state2 & ~locked_write_bit) + 1;
+        if (state2 & readers_waiting_bit) {
+            desired = (desired & ~readers_waiting_bit) ^ phase_bit;
+        }
+    } while (UNLIKELY(!state.compare_exchange_weak(
+        state2, desired,
+        std::memory_order_release, std::memory_order_relaxed
+    )));
+    if (UNLIKELY(state2 & readers_waiting_bit)) {
+        STATS(int woken =) futex_wake_bitset(
+            (const uint32_t *) &state, INT_MAX, reader_mask
+        );
+        STATS(stats.record_wake(woken));
     }
 }
 
-void RWLock::unlock_read() {
-    uint32_t state2 = state.fetch_sub(1, std::memory_order_release);
+void RWLock::end_read_phase(uint32_t state2) {
     assert(!(state2 & locked_write_bit));
-    // Note that state2 is the value of state pre-decrement here.
-    uint32_t count = state2 & ~need_to_wake_bit;
-    assert(count != 0);
-    if (UNLIKELY(count == 1 && (state2 & need_to_wake_bit))) {
-        // Wake one writer.
-        state2 = need_to_wake_bit;
-        state.compare_exchange_weak(state2, 0, std::memory_order_relaxed);
-        futex_wake_bitset((const uint32_t *) &state, 1, writer_mask);
+    assert((state2 & count_mask) == 1);
+    if (UNLIKELY(state2 & writers_waiting_bit)) {
+        wake_writer();
+    } else if (UNLIKELY(state2 & readers_waiting_bit)) {
+        // The readers must have been waiting for
+        // writers that have since given up.
+        forget_writers();
     }
 }
 
-void RWLock::unlock_write() {
-    uint32_t state2 = state.exchange(0, std::memory_order_release);
-    assert(state2 & locked_write_bit);
-    uint32_t count = state2 & ~need_to_wake_bit & ~locked_write_bit;
-    assert(count == 0);
-    (void) count;
-    if (UNLIKELY(state2 & need_to_wake_bit)) {
-        // Wake all the readers and one writer.
-        futex_wake_bitset((const uint32_t *) &state, INT_MAX, reader_mask);
-        futex_wake_bitset((const uint32_t *) &state, 1, writer_mask);
+void RWLock::unlock_write_slow() {
+    uint32_t state2 = state.load(std::memory_order_relaxed);
+    uint32_t desired;
+    do {
+        assert(state2 & locked_write_bit);
+        assert((state2 & count_mask) == 0);
+        desired = state2 & ~locked_write_bit;
+        // If there are readers waiting, it's their turn now, even if there
+        // are more writers waiting.
+        if (state2 & readers_waiting_bit) {
+            desired = (desired & ~readers_waiting_bit) ^ phase_bit;
+        }
+    } while (UNLIKELY(!state.compare_exchange_weak(
+        state2, desired,
+        std::memory_order_release, std::memory_order_relaxed
+    )));
+
+    if (UNLIKELY(state2 & readers_waiting_bit)) {
+        int woken = futex_wake_bitset(
+            (const uint32_t *) &state, INT_MAX, reader_mask
+        );
+        STATS(stats.record_wake(woken));
+        if (LIKELY(woken != 0)) {
+            // The last one of them will wake the next writer.
+            return;
+        }
+        // The readers must have all timed out.
+    }
+    if (UNLIKELY(state2 & writers_waiting_bit)) {
+        wake_writer();
     }
 }
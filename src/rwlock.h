@@ -1,8 +1,25 @@
+#pragma once
+
 #include <atomic>
 #include <cstddef>
+#include "deadline.h"
+#include "stats.h"
+#include "util.h"
 
 class RWLock {
 public:
+#ifdef SYNC_PRIMITIVES_STATS
+    explicit RWLock(
+        const char *file = __builtin_FILE(), int line = __builtin_LINE()
+    )
+        : stats("RWLock", file, line) { }
+#endif
+    // Only used for statistics; see stats.h.
+    void set_name([[maybe_unused]] const char *name) {
+        STATS(stats.set_name(name));
+    }
+
+    // The fast paths are defined below, so that they can be inlined.
     void lock_read();
     bool try_lock_read();
     void unlock_read();
@@ -14,10 +31,182 @@ public:
     bool try_upgrade();
     void downgrade();
 
+    // Optimistic reading, for short read-side sections where even the one
+    // atomic write that lock_read() makes is too much. An optimistic reader
+    // takes a stamp, reads the data without holding the lock, and then checks
+    // that no writer has held the lock in the meantime; if one has, whatever
+    // it has read may be torn, and must be discarded. Since the reads may race
+    // with a writer, the data must only be accessed through atomics (relaxed
+    // ones are fine), and nothing read may be acted on before validating it.
+    //
+    // Returns zero if the lock is currently held by a writer.
+    uint32_t try_optimistic_read() const;
+    bool validate(uint32_t stamp) const;
+    // Take the lock for reading or writing, if no writer has held it since
+    // the stamp was taken; everything read optimistically is then consistent
+    // with what the lock protects.
+    bool try_convert_to_read(uint32_t stamp);
+    bool try_convert_to_write(uint32_t stamp);
+
+    bool try_lock_read_until(Deadline deadline);
+    template<typename Rep, typename Period>
+    bool try_lock_read_for(const std::chrono::duration<Rep, Period> &timeout) {
+        return try_lock_read_until(deadline_after(timeout));
+    }
+
+    bool try_lock_write_until(Deadline deadline);
+    template<typename Rep, typename Period>
+    bool try_lock_write_for(const std::chrono::duration<Rep, Period> &timeout) {
+        return try_lock_write_until(deadline_after(timeout));
+    }
+
 private:
-    constexpr static uint32_t need_to_wake_bit = 1 << 31;
-    constexpr static uint32_t locked_write_bit = 1 << 30;
+    bool lock_read_until(const Deadline *deadline);
+    bool lock_write_until(const Deadline *deadline);
+    void end_read_phase(uint32_t state2);
+    void unlock_write_slow();
+    void wake_writer();
+    void forget_writers();
+    void begin_write();
+    void end_write();
+
+    // The lower bits of the state hold the number of readers
+    // currently holding the lock.
+    constexpr static uint32_t locked_write_bit = 1u << 31;
+    constexpr static uint32_t writers_waiting_bit = 1 << 30;
+    constexpr static uint32_t readers_waiting_bit = 1 << 29;
+    // Flipped every time a write phase ends and the readers that have been
+    // waiting for it to end are let in.
+    constexpr static uint32_t phase_bit = 1 << 28;
+    constexpr static uint32_t count_mask = phase_bit - 1;
+    // Readers and writers wait on the same futex, but are woken separately.
     constexpr static uint32_t reader_mask = 1;
     constexpr static uint32_t writer_mask = 2;
     std::atomic_uint32_t state { 0 };
+    // Bumped by every writer when it takes the lock and when it releases it,
+    // so that it's odd exactly when no writer holds the lock. Optimistic
+    // readers use it as a stamp (this is a seqlock, piggybacking on the lock).
+    std::atomic_uint32_t version { 1 };
+    // Hold times are only recorded for writers.
+    STATS(LockStats stats;)
 };
+
+inline void RWLock::lock_read() {
+    uint32_t state2 = state.load(std::memory_order_relaxed);
+    // Disallow new readers when there are waiting writers.
+    if (LIKELY(!(state2 & (locked_write_bit | writers_waiting_bit)))) {
+        bool have_exchanged = state.compare_exchange_weak(
+            state2, state2 + 1,
+            std::memory_order_acquire, std::memory_order_relaxed
+        );
+        if (LIKELY(have_exchanged)) {
+            STATS(stats.record_fast_path());
+            return;
+        }
+    }
+    lock_read_until(nullptr);
+}
+
+inline bool RWLock::try_lock_read() {
+    uint32_t state2 = state.load(std::memory_order_relaxed);
+    if (UNLIKELY(state2 & (locked_write_bit | writers_waiting_bit))) {
+        return false;
+    }
+    bool have_exchanged = state.compare_exchange_strong(
+        state2, state2 + 1,
+        std::memory_order_acquire, std::memory_order_relaxed
+    );
+    STATS(if (have_exchanged) {
+        stats.record_fast_path();
+    })
+    return LIKELY(have_exchanged);
+}
+
+inline void RWLock::unlock_read() {
+    uint32_t state2 = state.fetch_sub(1, std::memory_order_release);
+    // Note that state2 is the value of state pre-decrement here. If we were
+    // the last reader and somebody's waiting, it's up to us to let them in.
+    bool last = (state2 & count_mask) == 1;
+    bool waiting = state2 & (writers_waiting_bit | readers_waiting_bit);
+    if (UNLIKELY(last && waiting)) {
+        end_read_phase(state2);
+    }
+}
+
+inline void RWLock::lock_write() {
+    uint32_t state2 = state.load(std::memory_order_relaxed);
+    if (LIKELY(!(state2 & ~readers_waiting_bit & ~phase_bit))) {
+        bool have_exchanged = state.compare_exchange_weak(
+            state2, state2 | locked_write_bit,
+            std::memory_order_acquire, std::memory_order_relaxed
+        );
+        if (LIKELY(have_exchanged)) {
+            STATS(stats.record_fast_path());
+            STATS(stats.record_acquired(LockStats::now()));
+            begin_write();
+            return;
+        }
+    }
+    lock_write_until(nullptr);
+}
+
+inline bool RWLock::try_lock_write() {
+    uint32_t state2 = state.load(std::memory_order_relaxed);
+    if (UNLIKELY(state2 & ~readers_waiting_bit & ~phase_bit)) {
+        return false;
+    }
+    bool have_locked = state.compare_exchange_strong(
+        state2, state2 | locked_write_bit,
+        std::memory_order_acquire, std::memory_order_relaxed
+    );
+    if (UNLIKELY(!have_locked)) {
+        return false;
+    }
+    STATS(stats.record_fast_path());
+    STATS(stats.record_acquired(LockStats::now()));
+    begin_write();
+    return true;
+}
+
+inline void RWLock::unlock_write() {
+    STATS(stats.record_released());
+    end_write();
+    uint32_t state2 = state.load(std::memory_order_relaxed);
+    if (LIKELY(!(state2 & (writers_waiting_bit | readers_waiting_bit)))) {
+        bool have_exchanged = state.compare_exchange_weak(
+            state2, state2 & ~locked_write_bit,
+            std::memory_order_release, std::memory_order_relaxed
+        );
+        if (LIKELY(have_exchanged)) {
+            return;
+        }
+    }
+    unlock_write_slow();
+}
+
+// Only the writer holding the lock ever modifies the version, so
+// there's no need for read-modify-write operations here.
+inline void RWLock::begin_write() {
+    uint32_t version2 = version.load(std::memory_order_relaxed);
+    version.store(version2 + 1, std::memory_order_relaxed);
+    // Make sure an optimistic reader that sees any of our writes to the data
+    // also sees the version change, and so fails to validate.
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+inline void RWLock::end_write() {
+    uint32_t version2 = version.load(std::memory_order_relaxed);
+    version.store(version2 + 1, std::memory_order_release);
+}
+
+inline uint32_t RWLock::try_optimistic_read() const {
+    uint32_t version2 = version.load(std::memory_order_acquire);
+    return LIKELY(version2 & 1) ? version2 : 0;
+}
+
+inline bool RWLock::validate(uint32_t stamp) const {
+    // Order the optimistic reads of the data before re-reading the version.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return LIKELY(stamp != 0) &&
+        LIKELY(version.load(std::memory_order_relaxed) == stamp);
+}
@@ -1,36 +1,61 @@
 #include "semaphore.h"
 #include "futex.h"
 #include "util.h"
+#include <algorithm>
+#include <climits>
+#include <cassert>
 
+#ifdef SYNC_PRIMITIVES_STATS
+Semaphore::Semaphore(size_t initial_value, const char *file, int line)
+    : state(initial_value), stats("Semaphore", file, line) {
+    assert(initial_value <= count_mask);
+}
+#else
 Semaphore::Semaphore(size_t initial_value)
-    : state(initial_value) { }
+    : state(initial_value) {
+    assert(initial_value <= count_mask);
+}
+#endif
+
+// Every waiting thread counts itself in the upper half of the state before it
+// goes to sleep, and uncounts itself once it's done waiting. This way, up()
+// knows exactly how many threads it could possibly let through, and can wake
+// them all up with a single syscall, instead of waking one and letting it wake
+// the next one. The threads sleep on the counter, so a thread that counts
+// itself in, but has not made it to sleep yet, notices any up() that happens
+// in the meantime.
+//
+// A woken thread still has to compete for the units with the threads that have
+// not waited at all; if it loses, it simply goes back to sleep (it's still
+// counted in), and the next up() is going to wake it again.
+
+const uint32_t *Semaphore::futex_word() const {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return (const uint32_t *) &state;
+#else
+    return (const uint32_t *) &state + 1;
+#endif
+}
+
+bool Semaphore::down_until(Deadline deadline, uint32_t n) {
+    return down_until(&deadline, n);
+}
 
-void Semaphore::down() {
-    uint32_t state2 = state.load(std::memory_order_relaxed);
-    bool responsible_for_waking = false;
+bool Semaphore::down_until(const Deadline *deadline, uint32_t n) {
+    uint64_t state2 = state.load(std::memory_order_relaxed);
+    bool counted_in = false;
+    STATS(uint64_t wait_start = 0);
 
     while (true) {
-        // Note that the state2 value is just a speculation here.
-        uint32_t count = state2 & ~need_to_wake_bit;
-        if (LIKELY(count > 0)) {
-            // It looks like there are some free slots.
-            uint32_t perhaps_wake_bit = state2 & need_to_wake_bit;
-            bool going_to_wake = false;
-            if (UNLIKELY(responsible_for_waking && !perhaps_wake_bit)) {
-                // If we have ourselves been woken up previously, and the
-                // need_to_wake_bit is not set, that means some more slots might
-                // be available now, and it's us who has to wake up additional
-                // threads.
-                if (UNLIKELY(count > 1)) {
-                    going_to_wake = true;
+        if (LIKELY((state2 & count_mask) >= n)) {
+            uint64_t desired = state2 - n;
+            if (counted_in) {
+                desired -= one_waiter;
+                // The last waiter to leave clears the bit.
+                if (!(desired & waiters_mask)) {
+                    desired &= ~batch_waiters_bit;
                 }
-                // Set the need_to_wake_bit. This means that waking further
-                // threads the next time will be the responsibility of up()
-                // calls, not of down() calls; in particular not of down()
-                // calls in the threads we're about to wake.
-                perhaps_wake_bit = need_to_wake_bit;
             }
-            uint32_t desired = (count - 1) | perhaps_wake_bit;
             bool have_exchanged = state.compare_exchange_weak(
                 state2, desired,
                 std::memory_order_acquire, std::memory_order_relaxed
@@ -39,58 +64,66 @@ void Semaphore::down() {
                 // Reevaluate.
                 continue;
             }
-            if (UNLIKELY(going_to_wake)) {
-                futex_wake((const uint32_t *) &state, count - 1);
-            }
-            return;
+            STATS(if (wait_start) {
+                stats.record_wait(wait_start);
+            } else {
+                stats.record_fast_path();
+            })
+            return true;
         }
-        // We're probably going to sleep, so attempt to set the need to wake
-        // bit. We do not commit to sleeping yet, though, as setting the bit
-        // may fail and cause us to reevaluate what we're doing.
-        if (state2 == 0) {
+        STATS(if (!wait_start) {
+            stats.record_slow_path();
+            wait_start = LockStats::now();
+        })
+        // We're probably going to sleep, so count ourselves in. We do not
+        // commit to sleeping yet, though, as this may fail and cause us to
+        // reevaluate what we're doing.
+        if (!counted_in) {
+            uint64_t desired = state2 + one_waiter;
+            if (n > 1) {
+                desired |= batch_waiters_bit;
+            }
             bool have_exchanged = state.compare_exchange_weak(
-                state2, need_to_wake_bit, std::memory_order_relaxed
+                state2, desired, std::memory_order_relaxed
             );
             if (UNLIKELY(!have_exchanged)) {
                 // Reevaluate.
                 continue;
             }
-            state2 = need_to_wake_bit;
+            counted_in = true;
+            state2 = desired;
         }
-        responsible_for_waking = true;
-        futex_wait((const uint32_t *) &state, state2, nullptr);
-        // This is the state we will probably see upon being waked:
-        state2 = 1;
-        // If we guess this wrong, the compare_exchange() above
-        // will fail, we'll load the actual value and reevaluate.
-    }
-}
-
-bool Semaphore::try_down() {
-    uint32_t state2 = state.load(std::memory_order_relaxed);
-    uint32_t count = state2 & ~need_to_wake_bit;
-    if (count == 0) {
-        return false;
+        if (UNLIKELY(deadline_passed(deadline))) {
+            // Count ourselves out. If an up() has woken us up just now, it
+            // has left the units behind, and we'd have grabbed them above.
+            state2 = state.load(std::memory_order_relaxed);
+            uint64_t desired;
+            do {
+                desired = state2 - one_waiter;
+                if (!(desired & waiters_mask)) {
+                    desired &= ~batch_waiters_bit;
+                }
+            } while (UNLIKELY(!state.compare_exchange_weak(
+                state2, desired, std::memory_order_relaxed
+            )));
+            STATS(stats.record_wait(wait_start));
+            return false;
+        }
+        STATS(stats.record_sleep());
+        futex_wait_until(futex_word(), (uint32_t) state2, deadline);
+        state2 = state.load(std::memory_order_relaxed);
     }
-    uint32_t desired = (count - 1) | (state2 & need_to_wake_bit);
-    bool have_exchanged = state.compare_exchange_strong(
-        state2, desired,
-        std::memory_order_acquire, std::memory_order_relaxed
-    );
-    return LIKELY(have_exchanged);
 }
 
-void Semaphore::up() {
-    uint32_t state2 = state.fetch_add(1, std::memory_order_release);
-    if (LIKELY(!(state2 & need_to_wake_bit))) {
-        return;
-    }
-    // Clear the need_to_wake_bit; the thread we will wake below becomes
-    // responsible for waking others if further slots become available later.
-    state2 = state.fetch_and(~need_to_wake_bit, std::memory_order_relaxed);
-    if (UNLIKELY(!(state2 & need_to_wake_bit))) {
-        // Someone else has handled it already.
-        return;
+void Semaphore::wake(uint64_t state2, uint32_t n) {
+    uint32_t waiters = (state2 & waiters_mask) / one_waiter;
+    // If anybody wants more than one unit, we can't tell whom the units we've
+    // just released are going to be enough for, so we let them all sort it
+    // out among themselves; otherwise, each unit is enough for one thread.
+    int to_wake = INT_MAX;
+    if (LIKELY(!(state2 & batch_waiters_bit))) {
+        to_wake = std::min(n, waiters);
     }
-    futex_wake((const uint32_t *) &state, 1);
+    STATS(int woken =) futex_wake(futex_word(), to_wake);
+    STATS(stats.record_wake(woken));
 }
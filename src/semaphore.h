@@ -1,14 +1,96 @@
+#pragma once
+
 #include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <cassert>
+#include "deadline.h"
+#include "stats.h"
+#include "util.h"
 
 class Semaphore {
 public:
+#ifdef SYNC_PRIMITIVES_STATS
+    Semaphore(
+        size_t initial_value,
+        const char *file = __builtin_FILE(), int line = __builtin_LINE()
+    );
+#else
     Semaphore(size_t initial_value);
-    void down();
-    bool try_down();
-    void up();
+#endif
+    // Only used for statistics; see stats.h.
+    void set_name([[maybe_unused]] const char *name) {
+        STATS(stats.set_name(name));
+    }
+    // Take n units at once, waiting until all of them are available.
+    // The fast paths are defined below, so that they can be inlined.
+    void down(uint32_t n = 1);
+    bool try_down(uint32_t n = 1);
+    // Release n units at once, waking up as many threads as that can let
+    // through (but no more) with a single syscall.
+    void up(uint32_t n = 1);
+
+    bool down_until(Deadline deadline, uint32_t n = 1);
+    template<typename Rep, typename Period>
+    bool down_for(
+        const std::chrono::duration<Rep, Period> &timeout, uint32_t n = 1
+    ) {
+        return down_until(deadline_after(timeout), n);
+    }
 
 private:
-    constexpr static uint32_t need_to_wake_bit = 1 << 31;
-    std::atomic_uint32_t state;
+    friend class Waitable;
+    bool down_until(const Deadline *deadline, uint32_t n);
+    void wake(uint64_t state2, uint32_t n);
+    const uint32_t *futex_word() const;
+
+    // The lower half of the state is the counter; that's the word that the
+    // waiting threads sleep on. The upper half is the number of threads that
+    // are waiting (or about to), plus a bit that says whether any of them are
+    // waiting for more than one unit at once.
+    constexpr static uint64_t count_mask = 0xffffffff;
+    constexpr static uint64_t one_waiter = 1ull << 32;
+    constexpr static uint64_t batch_waiters_bit = 1ull << 63;
+    constexpr static uint64_t waiters_mask = ~count_mask & ~batch_waiters_bit;
+    std::atomic_uint64_t state;
+    // Semaphores are not owned, so there are no hold times.
+    STATS(LockStats stats;)
 };
+
+inline void Semaphore::down(uint32_t n) {
+    uint64_t state2 = state.load(std::memory_order_relaxed);
+    if (LIKELY((state2 & count_mask) >= n)) {
+        bool have_exchanged = state.compare_exchange_weak(
+            state2, state2 - n,
+            std::memory_order_acquire, std::memory_order_relaxed
+        );
+        if (LIKELY(have_exchanged)) {
+            STATS(stats.record_fast_path());
+            return;
+        }
+    }
+    down_until(nullptr, n);
+}
+
+inline bool Semaphore::try_down(uint32_t n) {
+    uint64_t state2 = state.load(std::memory_order_relaxed);
+    while ((state2 & count_mask) >= n) {
+        bool have_exchanged = state.compare_exchange_weak(
+            state2, state2 - n,
+            std::memory_order_acquire, std::memory_order_relaxed
+        );
+        if (LIKELY(have_exchanged)) {
+            STATS(stats.record_fast_path());
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void Semaphore::up(uint32_t n) {
+    uint64_t state2 = state.fetch_add(n, std::memory_order_release);
+    assert((state2 & count_mask) + n <= count_mask);
+    if (UNLIKELY(state2 & ~count_mask)) {
+        wake(state2, n);
+    }
+}
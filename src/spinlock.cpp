@@ -2,7 +2,7 @@
 #include "util.h"
 #include <sched.h>
 
-void Spinlock::lock() {
+void Spinlock::lock_slow() {
     bool was_locked;
     int times = 0;
     do {
@@ -12,12 +12,3 @@ void Spinlock::lock() {
         was_locked = locked.exchange(true, std::memory_order_acquire);
     } while (UNLIKELY(was_locked));
 }
-
-bool Spinlock::try_lock() {
-    bool was_locked = locked.exchange(true, std::memory_order_acquire);
-    return LIKELY(!was_locked);
-}
-
-void Spinlock::unlock() {
-    locked.store(false, std::memory_order_release);
-}
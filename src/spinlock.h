@@ -1,4 +1,7 @@
+#pragma once
+
 #include <atomic>
+#include "util.h"
 
 class Spinlock {
 public:
@@ -7,5 +10,23 @@ public:
     void unlock();
 
 private:
+    void lock_slow();
+
     std::atomic_bool locked { false };
 };
+
+inline void Spinlock::lock() {
+    bool was_locked = locked.exchange(true, std::memory_order_acquire);
+    if (UNLIKELY(was_locked)) {
+        lock_slow();
+    }
+}
+
+inline bool Spinlock::try_lock() {
+    bool was_locked = locked.exchange(true, std::memory_order_acquire);
+    return LIKELY(!was_locked);
+}
+
+inline void Spinlock::unlock() {
+    locked.store(false, std::memory_order_release);
+}
@@ -0,0 +1,135 @@
+#include "stats.h"
+
+#ifdef SYNC_PRIMITIVES_STATS
+
+#include "spinlock.h"
+#include <chrono>
+
+// Note that this cannot be a Mutex, since that would collect
+// statistics itself. Both of these are constant-initialized,
+// so locks with static storage duration can use them safely.
+static Spinlock registry_lock;
+static LockStats *registry = nullptr;
+
+LockStats::LockStats(const char *kind, const char *file, int line)
+    : kind(kind), file(file), line(line) {
+    registry_lock.lock();
+    prev = nullptr;
+    next = registry;
+    if (next) {
+        next->prev = this;
+    }
+    registry = this;
+    registry_lock.unlock();
+}
+
+LockStats::~LockStats() {
+    registry_lock.lock();
+    if (prev) {
+        prev->next = next;
+    } else {
+        registry = next;
+    }
+    if (next) {
+        next->prev = prev;
+    }
+    registry_lock.unlock();
+}
+
+void LockStats::set_name(const char *name) {
+    this->name.store(name, std::memory_order_relaxed);
+}
+
+uint64_t LockStats::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+void LockStats::record_duration(std::atomic_uint64_t *buckets, uint64_t ns) {
+    size_t bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+    if (bucket >= num_buckets) {
+        bucket = num_buckets - 1;
+    }
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void LockStats::record_wait(uint64_t since) {
+    record_duration(wait_times, now() - since);
+}
+
+void LockStats::record_released() {
+    uint64_t at = acquired_at.load(std::memory_order_relaxed);
+    record_duration(hold_times, now() - at);
+}
+
+static void dump_histogram(FILE *out, const std::atomic_uint64_t *buckets) {
+    // Trailing empty buckets are omitted.
+    size_t size = LockStats::num_buckets;
+    while (size > 0 && !buckets[size - 1].load(std::memory_order_relaxed)) {
+        size--;
+    }
+    fputc('[', out);
+    for (size_t i = 0; i < size; i++) {
+        fprintf(
+            out, "%s%llu", i ? ", " : "",
+            (unsigned long long) buckets[i].load(std::memory_order_relaxed)
+        );
+    }
+    fputc(']', out);
+}
+
+// Names are arbitrary strings, so they may need escaping.
+static void dump_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            fputc('\\', out);
+            fputc(c, out);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+void dump_lock_stats(FILE *out) {
+    registry_lock.lock();
+    for (LockStats *stats = registry; stats; stats = stats->next) {
+        const char *name = stats->name.load(std::memory_order_relaxed);
+        fprintf(out, "{\"kind\": \"%s\", \"name\": ", stats->kind);
+        if (name) {
+            dump_string(out, name);
+        } else {
+            fputs("null", out);
+        }
+        fputs(", \"file\": ", out);
+        dump_string(out, stats->file);
+        fprintf(
+            out,
+            ", \"line\": %d, \"id\": \"%p\", "
+            "\"fast_path\": %llu, \"slow_path\": %llu, \"sleeps\": %llu, "
+            "\"empty_wakes\": %llu, \"wait_times\": ",
+            stats->line, (void *) stats,
+            (unsigned long long) stats->fast_path.load(),
+            (unsigned long long) stats->slow_path.load(),
+            (unsigned long long) stats->sleeps.load(),
+            (unsigned long long) stats->empty_wakes.load()
+        );
+        dump_histogram(out, stats->wait_times);
+        fputs(", \"hold_times\": ", out);
+        dump_histogram(out, stats->hold_times);
+        fputs("}\n", out);
+    }
+    registry_lock.unlock();
+    fflush(out);
+}
+
+#else
+
+void dump_lock_stats(FILE *) { }
+
+#endif
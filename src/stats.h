@@ -0,0 +1,87 @@
+#pragma once
+
+// Per-lock contention statistics. These are only collected when the library
+// (and everything that includes its headers) is built with
+// SYNC_PRIMITIVES_STATS defined, which is what the "stats" build option does.
+// Otherwise, none of this is compiled in, and the primitives are exactly the
+// same as if it didn't exist.
+
+#include <cstdio>
+
+#ifdef SYNC_PRIMITIVES_STATS
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#define STATS(...) __VA_ARGS__
+
+class LockStats {
+public:
+    LockStats(const char *kind, const char *file, int line);
+    ~LockStats();
+    LockStats(const LockStats &) = delete;
+    LockStats &operator = (const LockStats &) = delete;
+
+    void set_name(const char *name);
+
+    // Timestamp to pass to record_wait() and record_acquired() later.
+    static uint64_t now();
+
+    void record_fast_path() {
+        fast_path.fetch_add(1, std::memory_order_relaxed);
+    }
+    void record_slow_path() {
+        slow_path.fetch_add(1, std::memory_order_relaxed);
+    }
+    void record_sleep() {
+        sleeps.fetch_add(1, std::memory_order_relaxed);
+    }
+    // Record the result of a futex_wake() call.
+    void record_wake(int woken) {
+        if (woken <= 0) {
+            empty_wakes.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    void record_wait(uint64_t since);
+    // Only meaningful for locks that are held by one thread at a time.
+    void record_acquired(uint64_t at) {
+        acquired_at.store(at, std::memory_order_relaxed);
+    }
+    void record_released();
+
+    // Durations are bucketed by their binary logarithm: bucket i counts the
+    // durations of at least 2^(i - 1) and less than 2^i nanoseconds.
+    constexpr static size_t num_buckets = 40;
+
+    std::atomic_uint64_t fast_path { 0 };
+    std::atomic_uint64_t slow_path { 0 };
+    std::atomic_uint64_t sleeps { 0 };
+    std::atomic_uint64_t empty_wakes { 0 };
+    std::atomic_uint64_t wait_times[num_buckets] { };
+    std::atomic_uint64_t hold_times[num_buckets] { };
+
+private:
+    friend void dump_lock_stats(FILE *out);
+
+    static void record_duration(std::atomic_uint64_t *buckets, uint64_t ns);
+
+    std::atomic_uint64_t acquired_at { 0 };
+    const char *kind;
+    std::atomic<const char *> name { nullptr };
+    const char *file;
+    int line;
+    // All the live instances are kept in a global list.
+    LockStats *prev;
+    LockStats *next;
+};
+
+#else
+
+#define STATS(...)
+
+#endif
+
+// Print the statistics of every live lock to the given stream, one JSON object
+// per line. Does nothing unless statistics are enabled.
+void dump_lock_stats(FILE *out = stderr);
@@ -0,0 +1,341 @@
+#include "threadpool.h"
+#include "futex.h"
+#include "cache_line.h"
+#include "util.h"
+#include <climits>
+#include <cassert>
+
+// The Chase-Lev work-stealing deque, as formalized for the C11 memory model in
+// "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê et al.).
+// The owner pushes and pops at the bottom, without any atomic read-modify-write
+// operations unless it's racing a thief for the very last task, and thieves
+// take from the top with a compare-and-swap.
+class WorkDeque {
+public:
+    WorkDeque() : array(new Array(initial_capacity)) { }
+
+    ~WorkDeque() {
+        delete array.load(std::memory_order_relaxed);
+    }
+
+    // Only called by the owner.
+    void push(Task *task) {
+        int64_t bottom2 = bottom.load(std::memory_order_relaxed);
+        int64_t top2 = top.load(std::memory_order_acquire);
+        Array *array2 = array.load(std::memory_order_relaxed);
+        if (UNLIKELY(bottom2 - top2 >= (int64_t) array2->capacity)) {
+            array2 = grow(array2, top2, bottom2);
+        }
+        array2->put(bottom2, task);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(bottom2 + 1, std::memory_order_relaxed);
+    }
+
+    // Only called by the owner.
+    Task *pop() {
+        int64_t bottom2 = bottom.load(std::memory_order_relaxed) - 1;
+        Array *array2 = array.load(std::memory_order_relaxed);
+        bottom.store(bottom2, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top2 = top.load(std::memory_order_relaxed);
+        if (UNLIKELY(top2 > bottom2)) {
+            // Empty.
+            bottom.store(bottom2 + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        Task *task = array2->get(bottom2);
+        if (UNLIKELY(top2 == bottom2)) {
+            // This is the last task, race the thieves for it.
+            bool have_exchanged = top.compare_exchange_strong(
+                top2, top2 + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed
+            );
+            if (!have_exchanged) {
+                task = nullptr;
+            }
+            bottom.store(bottom2 + 1, std::memory_order_relaxed);
+        }
+        return task;
+    }
+
+    // Called by anyone but the owner.
+    Task *steal() {
+        int64_t top2 = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t bottom2 = bottom.load(std::memory_order_acquire);
+        if (top2 >= bottom2) {
+            return nullptr;
+        }
+        Array *array2 = array.load(std::memory_order_acquire);
+        Task *task = array2->get(top2);
+        bool have_exchanged = top.compare_exchange_strong(
+            top2, top2 + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed
+        );
+        // If we've lost the race, somebody else got the task.
+        return have_exchanged ? task : nullptr;
+    }
+
+    bool empty() const {
+        int64_t top2 = top.load(std::memory_order_relaxed);
+        return bottom.load(std::memory_order_relaxed) <= top2;
+    }
+
+private:
+    struct Array {
+        Array(size_t capacity)
+            : capacity(capacity), slots(new std::atomic<Task *>[capacity]) { }
+
+        Task *get(int64_t index) const {
+            return slots[index & (capacity - 1)].load(
+                std::memory_order_relaxed
+            );
+        }
+        void put(int64_t index, Task *task) {
+            slots[index & (capacity - 1)].store(
+                task, std::memory_order_relaxed
+            );
+        }
+
+        size_t capacity;
+        std::unique_ptr<std::atomic<Task *>[]> slots;
+    };
+
+    Array *grow(Array *old, int64_t top2, int64_t bottom2) {
+        Array *new_array = new Array(old->capacity * 2);
+        for (int64_t i = top2; i < bottom2; i++) {
+            new_array->put(i, old->get(i));
+        }
+        // Thieves may still be reading from the old array, so we can't free
+        // it until we're gone ourselves.
+        retired.emplace_back(old);
+        array.store(new_array, std::memory_order_release);
+        return new_array;
+    }
+
+    constexpr static size_t initial_capacity = 256;
+    alignas(cache_line_size) std::atomic_int64_t top { 0 };
+    alignas(cache_line_size) std::atomic_int64_t bottom { 0 };
+    std::atomic<Array *> array;
+    std::vector<std::unique_ptr<Array>> retired;
+};
+
+class Worker {
+public:
+    Worker(size_t index) : index(index), random_state(index * 2 + 1) { }
+
+    // A quick xorshift, for picking the victims to steal from.
+    uint32_t random() {
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        return random_state;
+    }
+
+    WorkDeque deque;
+    size_t index;
+    uint32_t random_state;
+};
+
+// The pool and the worker that the current thread belongs to, if any.
+static thread_local ThreadPool *current_pool = nullptr;
+static thread_local Worker *current_worker = nullptr;
+
+ThreadPool::ThreadPool(size_t num_threads) {
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+    for (size_t i = 0; i < num_threads; i++) {
+        workers.emplace_back(new Worker(i));
+    }
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([this, i] {
+            work(workers[i].get());
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    stopping.store(true, std::memory_order_seq_cst);
+    // Wake everybody up, so they notice.
+    uint32_t sleepers2 = sleepers.exchange(0, std::memory_order_seq_cst);
+    if (sleepers2) {
+        wakeups.up(sleepers2);
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::submit(Task *task) {
+    if (current_pool == this) {
+        current_worker->deque.push(task);
+    } else {
+        injected_mutex.lock();
+        injected.push_back(task);
+        num_injected.fetch_add(1, std::memory_order_relaxed);
+        injected_mutex.unlock();
+    }
+    notify();
+}
+
+// Wake up a sleeping worker, if there is one, to pick up a new task.
+void ThreadPool::notify() {
+    // This pairs up with the fence in work(): either we see the worker among
+    // the sleepers, or it sees the task when checking once again.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint32_t sleepers2 = sleepers.load(std::memory_order_relaxed);
+    while (UNLIKELY(sleepers2 > 0)) {
+        bool have_exchanged = sleepers.compare_exchange_weak(
+            sleepers2, sleepers2 - 1, std::memory_order_relaxed
+        );
+        if (LIKELY(have_exchanged)) {
+            wakeups.up();
+            return;
+        }
+    }
+}
+
+Task *ThreadPool::find_task(Worker *worker) {
+    if (worker) {
+        if (Task *task = worker->deque.pop()) {
+            return task;
+        }
+    }
+    if (num_injected.load(std::memory_order_relaxed)) {
+        injected_mutex.lock();
+        Task *task = nullptr;
+        if (!injected.empty()) {
+            task = injected.front();
+            injected.pop_front();
+            num_injected.fetch_sub(1, std::memory_order_relaxed);
+        }
+        injected_mutex.unlock();
+        if (task) {
+            return task;
+        }
+    }
+    return steal(worker);
+}
+
+Task *ThreadPool::steal(Worker *worker) {
+    size_t n = workers.size();
+    size_t start = worker ? worker->random() % n : 0;
+    for (size_t i = 0; i < n; i++) {
+        Worker *victim = workers[(start + i) % n].get();
+        if (victim == worker) {
+            continue;
+        }
+        if (Task *task = victim->deque.steal()) {
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+bool ThreadPool::run_one(Worker *worker) {
+    Task *task = find_task(worker);
+    if (!task) {
+        return false;
+    }
+    task->run();
+    delete task;
+    return true;
+}
+
+void ThreadPool::work(Worker *worker) {
+    current_pool = this;
+    current_worker = worker;
+    constexpr int spin_limit = 64;
+
+    while (true) {
+        if (run_one(worker)) {
+            continue;
+        }
+        // Stealing may fail spuriously, and new tasks tend to come in bursts,
+        // so look around a few more times before going to sleep.
+        bool found = false;
+        for (int i = 0; i < spin_limit && !found; i++) {
+            CPU_RELAX();
+            found = run_one(worker);
+        }
+        if (found) {
+            continue;
+        }
+
+        sleepers.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        // Check once again, now that whoever spawns a task is going to see
+        // us among the sleepers.
+        bool stopping2 = stopping.load(std::memory_order_relaxed);
+        bool have_work = num_injected.load(std::memory_order_relaxed) != 0;
+        for (size_t i = 0; i < workers.size() && !have_work; i++) {
+            have_work = !workers[i]->deque.empty();
+        }
+        if (have_work || stopping2) {
+            // Take ourselves back. If somebody has already converted us into
+            // a wakeup, take that instead; it's coming in any moment.
+            uint32_t sleepers2 = sleepers.load(std::memory_order_relaxed);
+            bool taken_back = false;
+            while (sleepers2 > 0 && !taken_back) {
+                taken_back = sleepers.compare_exchange_weak(
+                    sleepers2, sleepers2 - 1, std::memory_order_relaxed
+                );
+            }
+            if (!taken_back) {
+                wakeups.down();
+            }
+            if (stopping2 && !have_work) {
+                // Everybody else still running will complete their own tasks,
+                // including the ones they spawn; and all the other deques are
+                // empty.
+                break;
+            }
+            continue;
+        }
+        wakeups.down();
+    }
+}
+
+void TaskGroup::wait() {
+    Worker *worker = current_pool == &pool ? current_worker : nullptr;
+    uint32_t state2 = state.load(std::memory_order_acquire);
+    while (state2 & ~need_to_wake_bit) {
+        // Rather than blocking, help with the tasks (likely our own ones).
+        if (worker && pool.run_one(worker)) {
+            state2 = state.load(std::memory_order_acquire);
+            continue;
+        }
+        if (!(state2 & need_to_wake_bit)) {
+            bool have_exchanged = state.compare_exchange_weak(
+                state2, state2 | need_to_wake_bit,
+                std::memory_order_acquire, std::memory_order_acquire
+            );
+            if (UNLIKELY(!have_exchanged)) {
+                continue;
+            }
+            state2 |= need_to_wake_bit;
+        }
+        futex_wait((const uint32_t *) &state, state2, nullptr);
+        state2 = state.load(std::memory_order_acquire);
+    }
+}
+
+void TaskGroup::done() {
+    // Once the count drops to zero, the group may be gone any moment, so
+    // clear the need_to_wake_bit in the same go, rather than afterwards.
+    // Waking up on the address of a freed group is harmless.
+    uint32_t state2 = state.load(std::memory_order_relaxed);
+    uint32_t desired;
+    do {
+        desired = state2 - one_task;
+        if (desired == need_to_wake_bit) {
+            desired = 0;
+        }
+    } while (UNLIKELY(!state.compare_exchange_weak(
+        state2, desired, std::memory_order_acq_rel, std::memory_order_relaxed
+    )));
+    if (UNLIKELY(desired == 0 && (state2 & need_to_wake_bit))) {
+        futex_wake((const uint32_t *) &state, INT_MAX);
+    }
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "mutex.h"
+#include "semaphore.h"
+
+// A unit of work, allocated by ThreadPool::spawn(), and
+// deleted by whoever runs it.
+class Task {
+public:
+    virtual ~Task() = default;
+    virtual void run() = 0;
+};
+
+template<typename F>
+class FunctionTask final : public Task {
+public:
+    FunctionTask(F &&f) : f(std::move(f)) { }
+    FunctionTask(const F &f) : f(f) { }
+    void run() override {
+        f();
+    }
+
+private:
+    F f;
+};
+
+class Worker;
+
+// A work-stealing thread pool. Every worker has its own deque of tasks: it
+// pushes the tasks it spawns onto the bottom of its deque, and pops them from
+// there too, so it keeps working on whatever's hot in its cache, touching no
+// shared cache lines. Workers that run out of tasks steal from the top of the
+// other workers' deques, picking victims at random. Tasks spawned from outside
+// the pool go into a shared queue, which the workers check too.
+//
+// Workers that find nothing to do spin for a little while, and then go to
+// sleep on a semaphore, using no CPU until more tasks are spawned.
+class ThreadPool {
+public:
+    explicit ThreadPool(
+        size_t num_threads = std::thread::hardware_concurrency()
+    );
+    // Waits for all the tasks to complete, including the ones they spawn.
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator = (const ThreadPool &) = delete;
+
+    template<typename F>
+    void spawn(F &&f) {
+        submit(new FunctionTask<std::decay_t<F>>(std::forward<F>(f)));
+    }
+
+    size_t num_threads() const {
+        return workers.size();
+    }
+
+private:
+    friend class Worker;
+    friend class TaskGroup;
+
+    void submit(Task *task);
+    // Find a task, and run it; returns false if there was none.
+    bool run_one(Worker *worker);
+    Task *find_task(Worker *worker);
+    Task *steal(Worker *worker);
+    void notify();
+    void work(Worker *worker);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    // The tasks spawned from outside the pool.
+    Mutex injected_mutex;
+    std::deque<Task *> injected;
+    std::atomic_size_t num_injected { 0 };
+
+    // How many workers are going to sleep, and have not been woken up yet.
+    // Waking one up converts one of those into a unit of the semaphore.
+    std::atomic_uint32_t sleepers { 0 };
+    Semaphore wakeups { 0 };
+    std::atomic_bool stopping { false };
+};
+
+// Tracks a group of tasks, so that one can wait for all of them to complete.
+// Waiting from one of the pool's workers runs the pool's tasks in the meantime,
+// so fork-join parallelism doesn't leave workers blocked.
+class TaskGroup {
+public:
+    TaskGroup(ThreadPool &pool) : pool(pool) { }
+    // Waits for the tasks, if it hasn't been done already.
+    ~TaskGroup() {
+        wait();
+    }
+
+    template<typename F>
+    void spawn(F &&f) {
+        state.fetch_add(one_task, std::memory_order_relaxed);
+        pool.spawn([this, f = std::forward<F>(f)] () mutable {
+            f();
+            done();
+        });
+    }
+
+    void wait();
+
+private:
+    void done();
+
+    ThreadPool &pool;
+    // The number of tasks yet to complete, like in a Barrier.
+    constexpr static uint32_t need_to_wake_bit = 1;
+    constexpr static uint32_t one_task = 2;
+    std::atomic_uint32_t state { 0 };
+};
+
+template<typename F>
+void parallel_for_range(
+    TaskGroup &group, size_t begin, size_t end, size_t grain, F &f
+) {
+    // Split off the upper halves as tasks for others to steal,
+    // until what's left is small enough to do ourselves.
+    while (end - begin > grain) {
+        size_t middle = begin + (end - begin) / 2;
+        group.spawn([&group, middle, end, grain, &f] {
+            parallel_for_range(group, middle, end, grain, f);
+        });
+        end = middle;
+    }
+    for (size_t i = begin; i < end; i++) {
+        f(i);
+    }
+}
+
+// Call f(i) for every i in [begin, end), in parallel, and wait for all of the
+// calls to complete. The range gets split in halves recursively, down to
+// pieces of at most grain iterations.
+template<typename F>
+void parallel_for(
+    ThreadPool &pool, size_t begin, size_t end, F &&f, size_t grain = 1
+) {
+    if (begin >= end) {
+        return;
+    }
+    TaskGroup group { pool };
+    parallel_for_range(group, begin, end, grain == 0 ? 1 : grain, f);
+    group.wait();
+}
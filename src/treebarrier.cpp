@@ -0,0 +1,122 @@
+#include "treebarrier.h"
+#include "futex.h"
+#include "util.h"
+#include <algorithm>
+#include <climits>
+#include <cassert>
+
+TreeBarrierBase::TreeBarrierBase(size_t num_threads) {
+    assert(num_threads > 0 && num_threads <= UINT32_MAX);
+    size_t num_nodes = 0;
+    size_t width = num_threads;
+    do {
+        width = (width + fan_in - 1) / fan_in;
+        num_nodes += width;
+    } while (width > 1);
+    nodes.reset(new Node[num_nodes]);
+
+    // Here, width is the number of children on the level below: threads for
+    // the leaves, and nodes starting at children_start for the rest.
+    size_t level_start = 0;
+    size_t children_start = 0;
+    width = num_threads;
+    bool leaves = true;
+    while (true) {
+        size_t level_width = (width + fan_in - 1) / fan_in;
+        for (size_t i = 0; i < level_width; i++) {
+            Node &node = nodes[level_start + i];
+            node.expected = std::min(fan_in, width - i * fan_in);
+            node.remaining.store(node.expected, std::memory_order_relaxed);
+            node.parent = no_parent;
+        }
+        if (!leaves) {
+            for (size_t i = 0; i < width; i++) {
+                nodes[children_start + i].parent = level_start + i / fan_in;
+            }
+        }
+        if (level_width == 1) {
+            break;
+        }
+        children_start = level_start;
+        level_start += level_width;
+        width = level_width;
+        leaves = false;
+    }
+}
+
+bool TreeBarrierBase::arrive(
+    size_t thread_index, size_t &won, uint32_t *generations
+) {
+    uint32_t index = thread_index / fan_in;
+    won = 0;
+    while (true) {
+        Node &node = nodes[index];
+        // The generation of the node can not change until we
+        // arrive, so this is the generation we're arriving in.
+        uint32_t generation = node.generation.load(
+            std::memory_order_relaxed
+        ) & ~need_to_wake_bit;
+        // Synchronize with everybody who has arrived at this node before us,
+        // and through them, with everybody who has arrived below it.
+        uint32_t remaining2 = node.remaining.fetch_sub(
+            1, std::memory_order_acq_rel
+        );
+        assert(remaining2 != 0);
+        if (remaining2 != 1) {
+            wait_node(node, generation);
+            return false;
+        }
+        // We're the last one here. Nobody is going to arrive at this node
+        // again until we release it, so reset it for the next phase already.
+        node.remaining.store(node.expected, std::memory_order_relaxed);
+        assert(won < max_depth);
+        generations[won++] = generation;
+        if (node.parent == no_parent) {
+            return true;
+        }
+        index = node.parent;
+    }
+}
+
+void TreeBarrierBase::release(
+    size_t thread_index, size_t won, const uint32_t *generations
+) {
+    uint32_t path[max_depth];
+    uint32_t index = thread_index / fan_in;
+    for (size_t i = 0; i < won; i++) {
+        path[i] = index;
+        index = nodes[index].parent;
+    }
+    // Top down, so that the threads waiting higher up (who have more
+    // threads to wake up below them) get going first.
+    for (size_t i = won; i > 0; i--) {
+        release_node(nodes[path[i - 1]], generations[i - 1]);
+    }
+}
+
+void TreeBarrierBase::wait_node(Node &node, uint32_t generation) {
+    uint32_t state2 = node.generation.load(std::memory_order_acquire);
+    while (UNLIKELY((state2 & ~need_to_wake_bit) == generation)) {
+        if (!(state2 & need_to_wake_bit)) {
+            bool have_exchanged = node.generation.compare_exchange_weak(
+                state2, state2 | need_to_wake_bit,
+                std::memory_order_acquire, std::memory_order_acquire
+            );
+            if (UNLIKELY(!have_exchanged)) {
+                continue;
+            }
+            state2 |= need_to_wake_bit;
+        }
+        futex_wait((const uint32_t *) &node.generation, state2, nullptr);
+        state2 = node.generation.load(std::memory_order_acquire);
+    }
+}
+
+void TreeBarrierBase::release_node(Node &node, uint32_t generation) {
+    uint32_t state2 = node.generation.exchange(
+        generation + one_generation, std::memory_order_release
+    );
+    if (state2 & need_to_wake_bit) {
+        futex_wake((const uint32_t *) &node.generation, INT_MAX);
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include "cyclicbarrier.h"
+#include "cache_line.h"
+
+class TreeBarrierBase {
+protected:
+    TreeBarrierBase(size_t num_threads);
+
+    // Climb the tree for as long as we are the last one to arrive at each
+    // node, and then either wait at the node where we were not, or, if we've
+    // made it past the root, return true, so the caller runs the completion
+    // function. Either way, the caller then calls release().
+    bool arrive(size_t thread_index, size_t &won, uint32_t *generations);
+    void release(size_t thread_index, size_t won, const uint32_t *generations);
+
+    // Enough for any 32-bit number of threads.
+    constexpr static size_t max_depth = 16;
+
+private:
+    constexpr static size_t fan_in = 4;
+    constexpr static uint32_t no_parent = UINT32_MAX;
+    constexpr static uint32_t need_to_wake_bit = 1;
+    constexpr static uint32_t one_generation = 2;
+
+    // Every node gets its own cache line, so the threads arriving at different
+    // nodes don't bounce the same line between their cores.
+    struct alignas(cache_line_size) Node {
+        std::atomic_uint32_t remaining;
+        // Works just like in CyclicBarrier.
+        std::atomic_uint32_t generation { 0 };
+        uint32_t expected;
+        uint32_t parent;
+    };
+
+    static void wait_node(Node &node, uint32_t generation);
+    static void release_node(Node &node, uint32_t generation);
+
+    // The leaves come first, followed by the rest of the tree, level by level.
+    std::unique_ptr<Node[]> nodes;
+};
+
+// A cyclic barrier for a fixed set of threads, each of which has its own index
+// in [0, num_threads). Instead of having all the threads decrement the same
+// counter, they arrive at the leaves of a tree, in groups of four, and only
+// the last thread to arrive in each group goes on to arrive at the parent node.
+// Releasing the threads happens the other way around: the thread that made it
+// past the root wakes the threads that have waited at the nodes it's passed,
+// and then each of them does the same for the nodes below. This keeps both
+// the contention on any single cache line and the number of threads that any
+// single wake-up syscall has to deal with bounded by the fan-in, making the
+// latency of the barrier grow logarithmically with the number of threads.
+template<typename Completion = NoCompletion>
+class TreeBarrier : private TreeBarrierBase {
+public:
+    explicit TreeBarrier(
+        size_t num_threads, Completion completion = Completion()
+    ) : TreeBarrierBase(num_threads), completion(std::move(completion)) { }
+
+    void arrive_and_wait(size_t thread_index) {
+        size_t won;
+        uint32_t generations[max_depth];
+        if (arrive(thread_index, won, generations)) {
+            completion();
+        }
+        release(thread_index, won, generations);
+    }
+
+private:
+    Completion completion;
+};
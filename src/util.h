@@ -1,3 +1,5 @@
+#pragma once
+
 #ifndef NDEBUG
     #include <stdlib.h>
     #define UNREACHABLE() abort()
@@ -9,6 +11,15 @@
 #define LIKELY(cond) __builtin_expect(!!(cond), 1)
 #define UNLIKELY(cond) __builtin_expect(!!(cond), 0)
 
+// Hint to the CPU that we're busy-waiting.
+#if defined(__x86_64__) || defined(__i386__)
+    #define CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+    #define CPU_RELAX() asm volatile("yield" ::: "memory")
+#else
+    #define CPU_RELAX() asm volatile("" ::: "memory")
+#endif
+
 #if __cplusplus >= 201703L
     #define SUPPORTS_STRONGER_FAILURE_ORDERING 1
 #endif
@@ -0,0 +1,238 @@
+#include "waitany.h"
+#include "event.h"
+#include "semaphore.h"
+#include "mutex.h"
+#include "futex.h"
+#include "util.h"
+#include <atomic>
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+
+// Waiting on several primitives at once works the same way as waiting on any
+// one of them: we record the fact that we're waiting in each of them, just like
+// a regular waiter would, and then sleep on all of their futex words at once,
+// using FUTEX_WAITV. When woken up, we poll them all again.
+//
+// The catch is that the Semaphore and the Mutex only wake up as many waiters
+// as they can let in, and if one of those wakeups lands on us, but we end up
+// taking something else, nobody else gets it. So when leaving, we pass on the
+// wakeups we might have received to the regular waiters; see disarm().
+
+// Whether the kernel supports FUTEX_WAITV; cleared upon getting ENOSYS.
+static std::atomic_bool have_futex_waitv { true };
+
+// Without FUTEX_WAITV, we sleep on the first futex for this long at most, and
+// then poll the rest.
+constexpr static auto poll_interval = std::chrono::milliseconds(1);
+
+int wait_any(std::initializer_list<Waitable> waitables) {
+    return Waitable::wait(waitables.begin(), waitables.size(), nullptr);
+}
+
+int wait_any_until(
+    std::initializer_list<Waitable> waitables, Deadline deadline
+) {
+    return Waitable::wait(waitables.begin(), waitables.size(), &deadline);
+}
+
+int Waitable::wait(
+    const Waitable *waitables, size_t count, const Deadline *deadline
+) {
+    assert(count > 0 && count <= futex_waitv_max);
+    bool armed[futex_waitv_max] = { false };
+    futex_waitv_entry entries[futex_waitv_max];
+    int result = -1;
+    // Which of them has woken us up the last time we slept, if any. Only
+    // that one might have been handed off to us.
+    int woken = -1;
+
+    while (true) {
+        for (size_t i = 0; i < count && result < 0; i++) {
+            const uint32_t *uaddr;
+            uint32_t val;
+            if (waitables[i].poll(armed[i], (int) i == woken, uaddr, val)) {
+                result = i;
+            } else {
+                entries[i] = futex_waitv_make_entry(uaddr, val);
+            }
+        }
+        if (result >= 0 || UNLIKELY(deadline_passed(deadline))) {
+            break;
+        }
+        if (LIKELY(have_futex_waitv.load(std::memory_order_relaxed))) {
+            int rc = futex_waitv_until(entries, count, deadline);
+            if (LIKELY(rc >= 0 || errno != ENOSYS)) {
+                // On success, it returns the index of the one that woke us.
+                woken = rc;
+                continue;
+            }
+            have_futex_waitv.store(false, std::memory_order_relaxed);
+        }
+        Deadline poll_deadline = std::chrono::steady_clock::now() +
+            poll_interval;
+        if (deadline) {
+            poll_deadline = std::min(poll_deadline, *deadline);
+        }
+        int rc = futex_wait_until(
+            (const uint32_t *) entries[0].uaddr, entries[0].val,
+            count == 1 ? deadline : &poll_deadline
+        );
+        woken = rc == 0 ? 0 : -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (armed[i] && (int) i != result) {
+            waitables[i].disarm((int) i == woken);
+        }
+    }
+    return result;
+}
+
+// Try to acquire it; if that fails, make sure it's going to wake us up, and
+// tell which futex word to sleep on, and with what value.
+bool Waitable::poll(
+    bool &armed, bool woken, const uint32_t *&uaddr, uint32_t &val
+) const {
+    switch (kind) {
+    case EVENT: {
+        uint32_t state2 = event->state.load(std::memory_order_acquire);
+        while (state2 == Event::UNSET_NO_WAITERS) {
+            bool have_exchanged = event->state.compare_exchange_weak(
+                state2, Event::UNSET,
+                std::memory_order_acquire, std::memory_order_acquire
+            );
+            if (LIKELY(have_exchanged)) {
+                state2 = Event::UNSET;
+            }
+        }
+        if (state2 == Event::SET) {
+            return true;
+        }
+        // Events wake everybody up, so there's nothing to undo.
+        uaddr = (const uint32_t *) &event->state;
+        val = Event::UNSET;
+        return false;
+    }
+    case SEMAPHORE: {
+        Semaphore *s = semaphore;
+        uint64_t state2 = s->state.load(std::memory_order_relaxed);
+        while (true) {
+            if (state2 & Semaphore::count_mask) {
+                uint64_t desired = state2 - 1;
+                if (armed) {
+                    desired -= Semaphore::one_waiter;
+                    if (!(desired & Semaphore::waiters_mask)) {
+                        desired &= ~Semaphore::batch_waiters_bit;
+                    }
+                }
+                bool have_exchanged = s->state.compare_exchange_weak(
+                    state2, desired,
+                    std::memory_order_acquire, std::memory_order_relaxed
+                );
+                if (LIKELY(have_exchanged)) {
+                    armed = false;
+                    return true;
+                }
+                continue;
+            }
+            if (armed) {
+                break;
+            }
+            // Count ourselves in, like down() does.
+            bool have_exchanged = s->state.compare_exchange_weak(
+                state2, state2 + Semaphore::one_waiter,
+                std::memory_order_relaxed
+            );
+            if (LIKELY(have_exchanged)) {
+                armed = true;
+                break;
+            }
+        }
+        uaddr = s->futex_word();
+        val = 0;
+        return false;
+    }
+    case MUTEX: {
+        Mutex *m = mutex;
+        // The first time around, we're not a waiter yet, so try the fast way.
+        if (!armed && m->try_lock()) {
+            return true;
+        }
+        // Like in Mutex::lock_slow(), always leave it LOCKED_NEED_TO_WAKE. If
+        // this mutex has woken us up, it may have been handed off to us; but
+        // not if it was something else, or a spurious wakeup.
+        uint32_t state2 = m->state.load(std::memory_order_relaxed);
+        if (m->try_lock_waiting(state2, woken, false)) {
+            armed = false;
+            STATS(m->stats.record_acquired(LockStats::now()));
+            return true;
+        }
+        armed = true;
+        uaddr = (const uint32_t *) &m->state;
+        val = state2;
+        return false;
+    }
+    }
+    UNREACHABLE();
+}
+
+// Stop waiting on it, having acquired something else.
+void Waitable::disarm(bool woken) const {
+    switch (kind) {
+    case EVENT:
+        break;
+    case SEMAPHORE: {
+        // Count ourselves out; if there are units left, there may have been a
+        // wakeup meant for them that we've swallowed, so pass it on.
+        Semaphore *s = semaphore;
+        uint64_t state2 = s->state.load(std::memory_order_relaxed);
+        uint64_t desired;
+        do {
+            desired = state2 - Semaphore::one_waiter;
+            if (!(desired & Semaphore::waiters_mask)) {
+                desired &= ~Semaphore::batch_waiters_bit;
+            }
+        } while (UNLIKELY(!s->state.compare_exchange_weak(
+            state2, desired, std::memory_order_relaxed
+        )));
+        uint32_t units = desired & Semaphore::count_mask;
+        if (units && (desired & ~Semaphore::count_mask)) {
+            s->wake(desired, units);
+        }
+        break;
+    }
+    case MUTEX: {
+        // Whoever we might have been woken up by has handed the responsibility
+        // for waking the next waiter to us. Hand it back: either to the thread
+        // holding the mutex, or, if there's none, to the next waiter directly.
+        Mutex *m = mutex;
+        uint32_t state2 = m->state.load(std::memory_order_relaxed);
+        while (true) {
+            if (state2 == Mutex::UNLOCKED) {
+                m->wake();
+                break;
+            }
+            if (state2 == Mutex::HANDED_OFF) {
+                // If it has woken us up, it might have been handed off to
+                // us; pass it on. Otherwise, it's been handed off to someone
+                // else, who is on their way to take it over.
+                if (woken) {
+                    m->hand_off();
+                }
+                break;
+            }
+            if (state2 >= Mutex::LOCKED_NEED_TO_WAKE) {
+                break;
+            }
+            bool have_exchanged = m->state.compare_exchange_weak(
+                state2, Mutex::LOCKED_NEED_TO_WAKE, std::memory_order_relaxed
+            );
+            if (LIKELY(have_exchanged)) {
+                break;
+            }
+        }
+        break;
+    }
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include "deadline.h"
+
+class Event;
+class Semaphore;
+class Mutex;
+
+// Something that wait_any() can wait for. An Event fires once it's notified
+// (and it stays notified); a Semaphore fires when it has a unit to take, which
+// wait_any() then takes; and a Mutex fires when it can be locked, which
+// wait_any() then does.
+class Waitable {
+public:
+    Waitable(Event &event) : kind(EVENT), event(&event) { }
+    Waitable(Semaphore &semaphore) : kind(SEMAPHORE), semaphore(&semaphore) { }
+    Waitable(Mutex &mutex) : kind(MUTEX), mutex(&mutex) { }
+
+private:
+    friend int wait_any(std::initializer_list<Waitable> waitables);
+    friend int wait_any_until(
+        std::initializer_list<Waitable> waitables, Deadline deadline
+    );
+
+    static int wait(
+        const Waitable *waitables, size_t count, const Deadline *deadline
+    );
+    bool poll(
+        bool &armed, bool woken, const uint32_t *&uaddr, uint32_t &val
+    ) const;
+    void disarm(bool woken) const;
+
+    enum {
+        EVENT,
+        SEMAPHORE,
+        MUTEX,
+    } kind;
+    union {
+        Event *event;
+        Semaphore *semaphore;
+        Mutex *mutex;
+    };
+};
+
+// Wait until any of the waitables fires, acquire it, and return its index.
+// If several of them are ready, the one listed first wins.
+int wait_any(std::initializer_list<Waitable> waitables);
+// Returns -1 if none of them fires by the deadline.
+int wait_any_until(
+    std::initializer_list<Waitable> waitables, Deadline deadline
+);
+template<typename Rep, typename Period>
+int wait_any_for(
+    std::initializer_list<Waitable> waitables,
+    const std::chrono::duration<Rep, Period> &timeout
+) {
+    return wait_any_until(waitables, deadline_after(timeout));
+}
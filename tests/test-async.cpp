@@ -0,0 +1,141 @@
+#undef NDEBUG
+
+#include "async.h"
+#include <vector>
+#include <thread>
+#include <cassert>
+
+// A fire-and-forget coroutine, which starts running right away.
+struct Task {
+    struct promise_type {
+        Task get_return_object() {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+        void return_void() { }
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+};
+
+void mutex_test() {
+    AsyncMutex mutex;
+    AsyncEvent go;
+    std::vector<int> order;
+
+    // Coroutines suspend on the locked mutex instead of blocking the thread,
+    // and get resumed in the order they arrived.
+    auto locker = [&] (int i) -> Task {
+        co_await go.wait_async();
+        co_await mutex.lock_async();
+        order.push_back(i);
+        mutex.unlock();
+    };
+    assert(mutex.try_lock());
+    for (int i = 0; i < 10; i++) {
+        locker(i);
+    }
+    go.notify();
+    assert(order.empty());
+    mutex.unlock();
+    assert(order.size() == 10);
+    for (int i = 0; i < 10; i++) {
+        assert(order[i] == i);
+    }
+    assert(mutex.try_lock());
+    mutex.unlock();
+}
+
+void threads_test() {
+    // Coroutines on several threads hammering the same mutex.
+    constexpr size_t num_threads = 10;
+    constexpr size_t num_times = 1000;
+    AsyncMutex mutex;
+    AsyncSemaphore done { 0 };
+    size_t counter = 0;
+    auto worker = [&] () -> Task {
+        for (size_t i = 0; i < num_times; i++) {
+            co_await mutex.lock_async();
+            counter++;
+            mutex.unlock();
+        }
+        done.up();
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_threads; i++) {
+        // The coroutines refer to the lambda's captures through its closure,
+        // so it must outlive them: no copying it into the thread, which
+        // destroys the copy as soon as the coroutine first suspends.
+        threads.emplace_back([&worker] {
+            worker();
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    for (size_t i = 0; i < num_threads; i++) {
+        assert(done.try_down());
+    }
+    assert(!done.try_down());
+    assert(counter == num_threads * num_times);
+}
+
+void semaphore_test() {
+    AsyncSemaphore semaphore { 2 };
+    int inside = 0, max_inside = 0, finished = 0;
+    AsyncEvent release;
+    auto user = [&] () -> Task {
+        co_await semaphore.down_async();
+        inside++;
+        max_inside = std::max(max_inside, inside);
+        co_await release.wait_async();
+        inside--;
+        finished++;
+        semaphore.up();
+    };
+    for (int i = 0; i < 5; i++) {
+        user();
+    }
+    assert(inside == 2);
+    // Letting them out lets the others in, which then wait too...
+    release.notify();
+    // ...except the event is notified now, so they go right through.
+    assert(finished == 5);
+    assert(max_inside == 2);
+    assert(semaphore.try_down() && semaphore.try_down());
+    assert(!semaphore.try_down());
+}
+
+void barrier_test() {
+    constexpr int num_coroutines = 5;
+    constexpr int num_rounds = 10;
+    AsyncBarrier barrier { num_coroutines };
+    int arrived[num_rounds] = { 0 };
+    int finished = 0;
+    auto participant = [&] () -> Task {
+        for (int round = 0; round < num_rounds; round++) {
+            arrived[round]++;
+            co_await barrier.arrive_and_wait_async();
+            // Everybody has arrived in this round.
+            assert(arrived[round] == num_coroutines);
+        }
+        finished++;
+    };
+    for (int i = 0; i < num_coroutines; i++) {
+        participant();
+    }
+    assert(finished == num_coroutines);
+}
+
+int main() {
+    mutex_test();
+    threads_test();
+    semaphore_test();
+    barrier_test();
+}
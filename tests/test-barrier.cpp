@@ -27,4 +27,10 @@ int main() {
     for (std::thread &thread : threads) {
         thread.join();
     }
+
+    using namespace std::chrono_literals;
+    Barrier barrier2 { 1 };
+    assert(!barrier2.wait_for(1ms));
+    barrier2.check_in();
+    assert(barrier2.wait_for(1ms));
 }
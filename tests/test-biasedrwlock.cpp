@@ -0,0 +1,77 @@
+#undef NDEBUG
+
+#include "biasedrwlock.h"
+#include "barrier.h"
+#include <vector>
+#include <thread>
+#include <sched.h>
+#include <cassert>
+
+int main() {
+    constexpr size_t num_threads = 100;
+    constexpr size_t num_times = 100;
+    constexpr size_t write_ratio = 10;
+    std::vector<int> v;
+    std::vector<std::thread> threads;
+    BiasedRWLock rwlock;
+    Barrier barrier { num_threads };
+
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([i, &barrier, &v, &rwlock] {
+            barrier.check_in_and_wait();
+            for (size_t j = 0; j < num_times; j++) {
+                if (i * write_ratio == j) {
+                    rwlock.lock_write();
+                    v.push_back(35);
+                    sched_yield();
+                    rwlock.unlock_write();
+                } else {
+                    BiasedRWLock::ReadToken token = rwlock.lock_read();
+                    if (!v.empty()) {
+                        assert(v.back() == 35);
+                    }
+                    sched_yield();
+                    rwlock.unlock_read(token);
+                }
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    assert(v.size() == std::min(num_threads, num_times / write_ratio));
+
+    BiasedRWLock::ReadToken token, token2;
+    assert(rwlock.try_lock_write());
+    assert(!rwlock.try_lock_write());
+    assert(!rwlock.try_lock_read(token));
+    token = rwlock.downgrade();
+    assert(rwlock.try_upgrade(token));
+    token = rwlock.downgrade();
+    token2 = rwlock.lock_read();
+    assert(!rwlock.try_upgrade(token));
+    rwlock.unlock_read(token2);
+    assert(rwlock.try_upgrade(token));
+    rwlock.unlock_write();
+
+    // Upgrading and writing while readers are using the fast path.
+    BiasedRWLock fresh;
+    token = fresh.lock_read();
+    token2 = fresh.lock_read();
+    assert(!fresh.try_upgrade(token));
+    assert(!fresh.try_lock_write());
+    fresh.unlock_read(token2);
+    assert(fresh.try_upgrade(token));
+    // Only start the writer now: once it's inside lock_write(), it holds the
+    // underlying lock while it waits for the readers, so an upgrade fails.
+    std::thread writer { [&fresh, &v] {
+        fresh.lock_write();
+        v.push_back(35);
+        fresh.unlock_write();
+    } };
+    fresh.unlock_write();
+    writer.join();
+    assert(v.size() == 1 + std::min(num_threads, num_times / write_ratio));
+    token = fresh.lock_read();
+    fresh.unlock_read(token);
+}
@@ -0,0 +1,137 @@
+#undef NDEBUG
+
+#include "channel.h"
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <cassert>
+
+constexpr static size_t num_threads = 10;
+constexpr static size_t num_items = 10000;
+
+void mpmc_test() {
+    // Move-only items, and a channel that's small enough to fill up.
+    Channel<std::unique_ptr<size_t>> channel { 16 };
+    std::vector<std::thread> threads;
+    std::atomic_size_t sum { 0 };
+    std::atomic_size_t received { 0 };
+
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([i, &channel] {
+            for (size_t j = 0; j < num_items; j++) {
+                bool sent = channel.send(
+                    std::make_unique<size_t>(i * num_items + j)
+                );
+                assert(sent);
+            }
+        });
+        threads.emplace_back([&channel, &sum, &received] {
+            while (auto item = channel.recv()) {
+                sum.fetch_add(**item, std::memory_order_relaxed);
+                received.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    // Wait for the senders, then close the channel to stop the receivers.
+    for (size_t i = 0; i < num_threads; i++) {
+        threads[2 * i].join();
+    }
+    channel.close();
+    for (size_t i = 0; i < num_threads; i++) {
+        threads[2 * i + 1].join();
+    }
+    size_t total = num_threads * num_items;
+    assert(received.load() == total);
+    assert(sum.load() == total * (total - 1) / 2);
+    assert(!channel.send(std::make_unique<size_t>(0)));
+}
+
+void batch_test() {
+    Channel<size_t> channel { 64 };
+    std::vector<size_t> items;
+    for (size_t i = 0; i < num_items; i++) {
+        items.push_back(i);
+    }
+
+    std::thread sender { [&channel, &items] {
+        size_t sent = channel.send_batch(items.begin(), items.end());
+        assert(sent == num_items);
+        channel.close();
+    } };
+    std::vector<size_t> received;
+    size_t batches = 0;
+    while (size_t n = channel.recv_batch(std::back_inserter(received), 100)) {
+        assert(n <= 100);
+        batches++;
+    }
+    sender.join();
+    // The items arrive in order, with nothing lost or duplicated.
+    assert(received == items);
+    assert(batches <= num_items);
+}
+
+void try_test() {
+    Channel<int> channel { 3 };
+    // The capacity got rounded up to 4.
+    for (int i = 0; i < 4; i++) {
+        assert(channel.try_send(int(i)));
+    }
+    assert(!channel.try_send(4));
+    assert(channel.try_recv() == 0);
+    assert(channel.try_send(4));
+    channel.close();
+    assert(!channel.try_send(5));
+    // The items are still there after closing.
+    for (int i = 1; i < 5; i++) {
+        assert(channel.recv() == i);
+    }
+    assert(!channel.try_recv());
+    assert(!channel.recv());
+
+    // Items left in the channel get destroyed with it.
+    std::shared_ptr<int> shared = std::make_shared<int>(0);
+    {
+        Channel<std::shared_ptr<int>> channel2 { 4 };
+        channel2.send(std::shared_ptr<int>(shared));
+        channel2.send(std::shared_ptr<int>(shared));
+        assert(shared.use_count() == 3);
+    }
+    assert(shared.use_count() == 1);
+}
+
+void close_test() {
+    // Closing while sends are in flight: every item whose send has succeeded
+    // gets received.
+    for (size_t round = 0; round < 100; round++) {
+        Channel<size_t> channel { 1024 };
+        std::vector<std::thread> threads;
+        std::atomic_size_t sent { 0 };
+        std::atomic_size_t received { 0 };
+        for (size_t i = 0; i < num_threads; i++) {
+            threads.emplace_back([&channel, &sent] {
+                while (channel.send(0)) {
+                    sent.fetch_add(1, std::memory_order_relaxed);
+                }
+            });
+            threads.emplace_back([&channel, &received] {
+                while (channel.recv()) {
+                    received.fetch_add(1, std::memory_order_relaxed);
+                }
+            });
+        }
+        std::this_thread::yield();
+        channel.close();
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+        assert(received.load() == sent.load());
+    }
+}
+
+int main() {
+    mpmc_test();
+    batch_test();
+    try_test();
+    close_test();
+}
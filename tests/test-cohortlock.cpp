@@ -0,0 +1,78 @@
+#undef NDEBUG
+
+#include "cohortlock.h"
+#include "barrier.h"
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <sched.h>
+#include <cassert>
+
+// Pretend that each thread is on whichever node the test says it is.
+static thread_local size_t fake_node = 0;
+static const NumaTopology fake_topology { 3, [] { return fake_node; } };
+
+int main() {
+    constexpr size_t num_threads = 20;
+    constexpr size_t num_times = 1000;
+    std::vector<std::thread> threads;
+    Barrier barrier { num_threads };
+
+    const NumaTopology &topology = NumaTopology::system();
+    assert(topology.num_nodes() >= 1);
+    assert(topology.current_node() < topology.num_nodes());
+
+    // Mutual exclusion, with threads on several (fake) nodes.
+    CohortLock lock { fake_topology, 4 };
+    size_t counter = 0;
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([i, &barrier, &lock, &counter] {
+            fake_node = i % 3;
+            barrier.check_in_and_wait();
+            for (size_t j = 0; j < num_times; j++) {
+                lock.lock();
+                size_t counter2 = counter;
+                if (j % 100 == 0) {
+                    sched_yield();
+                }
+                counter = counter2 + 1;
+                lock.unlock();
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    assert(counter == num_threads * num_times);
+
+    // The lock goes to a waiter on the same node first, even though a waiter
+    // on the other node has been waiting for longer.
+    using namespace std::chrono_literals;
+    std::string order;
+    fake_node = 0;
+    lock.lock();
+    std::thread remote { [&lock, &order] {
+        fake_node = 1;
+        lock.lock();
+        order += 'r';
+        lock.unlock();
+    } };
+    std::this_thread::sleep_for(10ms);
+    std::thread local { [&lock, &order] {
+        fake_node = 0;
+        lock.lock();
+        // The global mutex has been left locked for us.
+        fake_node = 2;
+        assert(!lock.try_lock());
+        fake_node = 0;
+        order += 'l';
+        lock.unlock();
+    } };
+    std::this_thread::sleep_for(10ms);
+    assert(!lock.try_lock());
+    lock.unlock();
+    local.join();
+    remote.join();
+    assert(order == "lr");
+}
@@ -0,0 +1,71 @@
+#undef NDEBUG
+
+#include "compactmutex.h"
+#include <vector>
+#include <thread>
+#include <sched.h>
+#include <cassert>
+
+int main() {
+    constexpr size_t num_threads = 100;
+    constexpr size_t num_times = 100;
+    std::vector<int> v;
+    std::vector<std::thread> threads;
+    CompactMutex mutex;
+    static_assert(sizeof(mutex) == 1);
+
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([&v, &mutex] {
+            for (size_t j = 0; j < num_times; j++) {
+                mutex.lock();
+                v.push_back(35);
+                sched_yield();
+                mutex.unlock();
+                sched_yield();
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+
+    assert(v.size() == num_times * num_threads);
+    assert(mutex.try_lock());
+    assert(!mutex.try_lock());
+
+    // Timing out, both with and without other waiters.
+    using namespace std::chrono_literals;
+    assert(!mutex.try_lock_for(1ms));
+    std::thread waiter { [&mutex] {
+        mutex.lock();
+        mutex.unlock();
+    } };
+    assert(!mutex.try_lock_for(1ms));
+    mutex.unlock();
+    waiter.join();
+    assert(mutex.try_lock_for(1ms));
+    mutex.unlock();
+
+    // A lock embedded into a word that holds other data.
+    using Lock = LockAlgorithm<uint32_t, 1u << 30, 1u << 31>;
+    std::atomic_uint32_t header { 0 };
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([&header] {
+            for (size_t j = 0; j < num_times; j++) {
+                Lock::lock(header);
+                // Nobody else modifies the data bits without the lock,
+                // but they could, as long as they do it atomically.
+                uint32_t header2 = header.load(std::memory_order_relaxed);
+                sched_yield();
+                header.fetch_add(1, std::memory_order_relaxed);
+                assert((header2 & 0xffff) + 1 == (header & 0xffff));
+                Lock::unlock(header);
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    assert(header.load() == num_times * num_threads);
+}
@@ -0,0 +1,87 @@
+#undef NDEBUG
+
+#include "compactonce.h"
+#include "barrier.h"
+#include <vector>
+#include <thread>
+#include <sched.h>
+#include <cassert>
+
+int main() {
+    constexpr size_t num_threads = 100;
+    constexpr size_t num_times = 100;
+    std::vector<int> v;
+    std::vector<std::thread> threads;
+    Barrier barrier { num_threads };
+    CompactOnce once1, once2[num_times];
+    static_assert(sizeof(once1) == 1);
+
+    // Uncontended when not done.
+    once1.perform([&v] {
+        v.push_back(35);
+    });
+    assert(v.size() == 1);
+
+    // Contended.
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([&v, &barrier, &once2] {
+            barrier.check_in_and_wait();
+            for (size_t j = 0; j < num_times; j++) {
+                once2[j].perform([&v] {
+                    v.push_back(35);
+                });
+                once2[j].perform([] {
+                    assert(false);
+                });
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+
+    assert(v.size() == 1 + num_times);
+
+    // Uncontended when done.
+    once2[0].perform([&v] {
+        v.push_back(35);
+    });
+    assert(v.size() == 1 + num_times);
+
+    // Sixteen onces packed into a single word.
+    std::atomic_uint32_t word { 0 };
+    std::atomic_size_t performed { 0 };
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([&word, &performed] {
+            auto perform = [&performed] {
+                performed.fetch_add(1, std::memory_order_relaxed);
+                sched_yield();
+            };
+            OnceAlgorithm<uint32_t, 0>::perform(word, perform);
+            OnceAlgorithm<uint32_t, 2>::perform(word, perform);
+            OnceAlgorithm<uint32_t, 30>::perform(word, perform);
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    assert(performed.load() == 3);
+
+    // Timing out while somebody else is performing.
+    using namespace std::chrono_literals;
+    CompactOnce once3;
+    Barrier started { 1 };
+    Barrier timed_out { 1 };
+    std::thread performer { [&] {
+        once3.perform([&] {
+            started.check_in();
+            timed_out.wait();
+        });
+    } };
+    started.wait();
+    assert(!once3.perform_for([] { assert(false); }, 1ms));
+    timed_out.check_in();
+    assert(once3.perform_for([] { assert(false); }, 10s));
+    performer.join();
+}
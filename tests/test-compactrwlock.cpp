@@ -0,0 +1,72 @@
+#undef NDEBUG
+
+#include "compactrwlock.h"
+#include "barrier.h"
+#include <vector>
+#include <thread>
+#include <sched.h>
+#include <cassert>
+
+int main() {
+    constexpr size_t num_threads = 100;
+    constexpr size_t num_times = 100;
+    constexpr size_t write_ratio = 10;
+    std::vector<int> v;
+    std::vector<std::thread> threads;
+    CompactRWLock rwlock;
+    static_assert(sizeof(rwlock) == 2);
+    Barrier barrier { num_threads };
+
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([i, &barrier, &v, &rwlock] {
+            barrier.check_in_and_wait();
+            for (size_t j = 0; j < num_times; j++) {
+                if (i * write_ratio == j) {
+                    rwlock.lock_write();
+                    v.push_back(35);
+                    sched_yield();
+                    rwlock.unlock_write();
+                } else {
+                    rwlock.lock_read();
+                    if (!v.empty()) {
+                        assert(v.back() == 35);
+                    }
+                    sched_yield();
+                    rwlock.unlock_read();
+                }
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    assert(rwlock.try_lock_write());
+    assert(!rwlock.try_lock_write());
+    assert(!rwlock.try_lock_read());
+    rwlock.downgrade();
+    assert(rwlock.try_upgrade());
+    rwlock.downgrade();
+    rwlock.lock_read();
+    assert(!rwlock.try_upgrade());
+    assert(v.size() == std::min(num_threads, num_times / write_ratio));
+
+    // A writer timing out must not leave the readers
+    // that queued up behind it waiting forever.
+    using namespace std::chrono_literals;
+    rwlock.unlock_read();
+    assert(!rwlock.try_lock_write_for(1ms));
+    std::thread writer { [&rwlock] {
+        assert(!rwlock.try_lock_write_for(10ms));
+    } };
+    sched_yield();
+    std::thread reader { [&rwlock] {
+        rwlock.lock_read();
+        rwlock.unlock_read();
+    } };
+    writer.join();
+    rwlock.unlock_read();
+    reader.join();
+    assert(rwlock.try_lock_write_for(1ms));
+    assert(!rwlock.try_lock_read_for(1ms));
+}
@@ -0,0 +1,146 @@
+#undef NDEBUG
+
+#include "condvar.h"
+#include "mutex.h"
+#include <sys/resource.h>
+#include <vector>
+#include <thread>
+#include <cassert>
+
+static long voluntary_switches() {
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_nvcsw;
+}
+
+int main() {
+    using namespace std::chrono_literals;
+    constexpr size_t num_threads = 10;
+    constexpr size_t num_items = 10000;
+
+    // Producers and consumers, notified one at a time.
+    Mutex mutex;
+    CondVar not_empty { mutex };
+    std::vector<size_t> queue;
+    size_t consumed = 0;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([&] {
+            for (size_t j = 0; j < num_items / num_threads; j++) {
+                mutex.lock();
+                not_empty.wait([&queue] { return !queue.empty(); });
+                queue.pop_back();
+                consumed++;
+                mutex.unlock();
+            }
+        });
+    }
+    for (size_t i = 0; i < num_items; i++) {
+        mutex.lock();
+        queue.push_back(i);
+        not_empty.notify_one();
+        mutex.unlock();
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    assert(consumed == num_items);
+    assert(queue.empty());
+    threads.clear();
+
+    // Everybody gets woken up by notify_all(), with or without the mutex.
+    for (bool under_lock : { true, false }) {
+        bool go = false;
+        size_t waiting = 0;
+        CondVar all { mutex };
+        for (size_t i = 0; i < num_threads; i++) {
+            threads.emplace_back([&] {
+                mutex.lock();
+                waiting++;
+                all.wait([&go] { return go; });
+                mutex.unlock();
+            });
+        }
+        while (true) {
+            mutex.lock();
+            if (waiting == num_threads) {
+                break;
+            }
+            mutex.unlock();
+            std::this_thread::yield();
+        }
+        go = true;
+        if (under_lock) {
+            all.notify_all();
+            mutex.unlock();
+        } else {
+            mutex.unlock();
+            all.notify_all();
+        }
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+    }
+
+    // Notifying while holding the mutex moves the waiter over to the mutex
+    // instead of waking it up, so it only wakes up once, when the mutex is
+    // unlocked, instead of going back to sleep on the mutex right away.
+    bool ready = false;
+    bool waiting = false;
+    CondVar one { mutex };
+    std::thread waiter { [&] {
+        mutex.lock();
+        waiting = true;
+        long before = voluntary_switches();
+        one.wait([&ready] { return ready; });
+        long switches = voluntary_switches() - before;
+        mutex.unlock();
+        assert(switches == 1);
+    } };
+    while (true) {
+        mutex.lock();
+        if (waiting) {
+            break;
+        }
+        mutex.unlock();
+        std::this_thread::yield();
+    }
+    // Give the waiter a chance to actually go to sleep.
+    mutex.unlock();
+    std::this_thread::sleep_for(10ms);
+    mutex.lock();
+    ready = true;
+    one.notify_one();
+    std::this_thread::sleep_for(10ms);
+    mutex.unlock();
+    waiter.join();
+
+    // A waiter that is notified but only gets the mutex back after its
+    // deadline has still been woken up.
+    waiting = false;
+    std::thread timed_waiter { [&] {
+        mutex.lock();
+        waiting = true;
+        assert(one.wait_for(50ms));
+        mutex.unlock();
+    } };
+    while (true) {
+        mutex.lock();
+        if (waiting) {
+            break;
+        }
+        mutex.unlock();
+        std::this_thread::yield();
+    }
+    one.notify_one();
+    std::this_thread::sleep_for(150ms);
+    mutex.unlock();
+    timed_waiter.join();
+
+    // Timing out still reacquires the mutex.
+    mutex.lock();
+    assert(!one.wait_for(1ms));
+    assert(!mutex.try_lock());
+    mutex.unlock();
+}
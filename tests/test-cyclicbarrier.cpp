@@ -0,0 +1,60 @@
+#undef NDEBUG
+
+#include "cyclicbarrier.h"
+#include <vector>
+#include <thread>
+#include <cassert>
+
+int main() {
+    constexpr size_t num_threads = 100;
+    constexpr size_t num_rounds = 100;
+    unsigned data[num_threads] = { 0 };
+    size_t completed = 0;
+    std::vector<std::thread> threads;
+    CyclicBarrier barrier { num_threads, [&] {
+        // Everybody has arrived, and nobody has been released yet.
+        // Every round has two phases.
+        for (size_t j = 0; j < num_threads; j++) {
+            assert(data[j] == completed / 2 + 1);
+        }
+        completed++;
+    } };
+
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([i, &data, &barrier, &completed] {
+            for (size_t round = 0; round < num_rounds; round++) {
+                data[i]++;
+                barrier.arrive_and_wait();
+                assert(completed == 2 * round + 1);
+                for (size_t j = 0; j < num_threads; j++) {
+                    assert(data[j] >= round + 1);
+                }
+                barrier.arrive_and_wait();
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    assert(completed == 2 * num_rounds);
+    threads.clear();
+
+    // Threads that drop out are no longer waited for.
+    std::atomic_size_t phases { 0 };
+    CyclicBarrier barrier2 { num_threads, [&phases] {
+        phases.fetch_add(1, std::memory_order_relaxed);
+    } };
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([i, &barrier2] {
+            // Thread i takes part in i + 1 phases.
+            for (size_t round = 0; round < i; round++) {
+                barrier2.arrive_and_wait();
+            }
+            barrier2.arrive_and_drop();
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    assert(phases.load(std::memory_order_relaxed) == num_threads);
+}
@@ -22,4 +22,13 @@ int main() {
 
     reader.join();
     writer.join();
+
+    using namespace std::chrono_literals;
+    Event event2;
+    assert(!event2.wait_for(1ms));
+    std::thread notifier { [&event2] {
+        event2.notify();
+    } };
+    assert(event2.wait_for(10s));
+    notifier.join();
 }
@@ -0,0 +1,75 @@
+#undef NDEBUG
+
+#include "lazy.h"
+#include "barrier.h"
+#include <vector>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <stdexcept>
+#include <cassert>
+
+struct Counted {
+    Counted(int value) : value(value) {
+        alive++;
+    }
+    ~Counted() {
+        alive--;
+    }
+
+    int value;
+    static inline std::atomic_int alive { 0 };
+};
+
+int main() {
+    constexpr size_t num_threads = 100;
+    std::vector<std::thread> threads;
+    Barrier barrier { num_threads };
+
+    {
+        OnceCell<Counted> cell;
+        assert(cell.get() == nullptr);
+        assert(cell.emplace(35));
+        assert(!cell.emplace(36));
+        assert(cell.get()->value == 35);
+        assert(cell.get_or_init([] { return Counted(36); }).value == 35);
+        assert(Counted::alive.load() == 1);
+    }
+    assert(Counted::alive.load() == 0);
+
+    // Contended: everyone sees the same value, initialized once.
+    std::atomic_size_t initialized { 0 };
+    Lazy<std::string> lazy { [] {
+        return std::string("hello");
+    } };
+    Lazy counted { [&initialized] {
+        initialized++;
+        return Counted(35);
+    } };
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([&] {
+            barrier.check_in_and_wait();
+            assert(counted->value == 35);
+            assert(&*counted == &counted.get());
+            assert(*lazy == "hello");
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    assert(initialized.load() == 1);
+
+    // An initializer that throws gets retried.
+    size_t attempts = 0;
+    Lazy flaky { [&attempts] {
+        if (attempts++ == 0) {
+            throw std::runtime_error("oops");
+        }
+        return 35;
+    } };
+    try {
+        flaky.get();
+        assert(false);
+    } catch (const std::runtime_error &) { }
+    assert(*flaky == 35 && attempts == 2);
+}
@@ -0,0 +1,111 @@
+#undef NDEBUG
+
+#include "lockstripe.h"
+#include "mutex.h"
+#include "rwlock.h"
+#include "barrier.h"
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <thread>
+#include <sched.h>
+#include <cassert>
+
+int main() {
+    constexpr size_t num_threads = 20;
+    constexpr size_t num_times = 1000;
+    constexpr size_t num_accounts = 100;
+    std::vector<std::thread> threads;
+    Barrier barrier { num_threads };
+
+    using MutexStripe = LockStripe<Mutex, 16>;
+    static_assert(sizeof(MutexStripe) >= 16 * cache_line_size);
+    static_assert(alignof(MutexStripe) == cache_line_size);
+
+    // Even consecutive keys spread out over the shards.
+    std::set<size_t> seen;
+    for (size_t key = 0; key < 16; key++) {
+        seen.insert(MutexStripe::shard_of(key));
+    }
+    assert(seen.size() > 8);
+    assert((LockStripe<Mutex, 1>::shard_of(35) == 0));
+
+    // The shards come out sorted, and without duplicates.
+    auto shards = MutexStripe::shards_of(0, 1, 2, 3, 2, 1, 0);
+    std::vector<size_t> indices(shards.begin(), shards.end());
+    std::vector<int> keys { 3, 2, 1, 0, 0 };
+    assert(indices == MutexStripe::shards_of_range(keys.begin(), keys.end()));
+    for (size_t i = 1; i < indices.size(); i++) {
+        assert(indices[i - 1] < indices[i]);
+    }
+    for (int key : keys) {
+        size_t index = MutexStripe::shard_of(key);
+        assert(std::count(indices.begin(), indices.end(), index) == 1);
+    }
+
+    // Transfer money between random pairs of accounts, locking both at once.
+    // This deadlocks if the shards are locked in the wrong order, and loses
+    // money if they are not actually locked.
+    MutexStripe stripe;
+    std::vector<long> accounts(num_accounts, 100);
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([i, &barrier, &stripe, &accounts] {
+            barrier.check_in_and_wait();
+            size_t seed = i;
+            for (size_t j = 0; j < num_times; j++) {
+                seed = seed * 6364136223846793005 + 1442695040888963407;
+                size_t from = (seed >> 33) % num_accounts;
+                size_t to = (seed >> 17) % num_accounts;
+                auto shards = MutexStripe::shards_of(from, to);
+                stripe.lock_all(shards);
+                accounts[from]--;
+                if (j % 100 == 0) {
+                    sched_yield();
+                }
+                accounts[to]++;
+                stripe.unlock_all(shards);
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    long total = 0;
+    for (long balance : accounts) {
+        total += balance;
+    }
+    assert(total == 100 * (long) num_accounts);
+
+    // Waiting for a shard gets counted.
+    stripe.reset_contention();
+    stripe.lock(35);
+    std::thread waiter { [&stripe] {
+        stripe.lock(35);
+        stripe.unlock(35);
+    } };
+    while (stripe.contention(MutexStripe::shard_of(35)) == 0) {
+        sched_yield();
+    }
+    stripe.unlock(35);
+    waiter.join();
+    assert(stripe.contention(MutexStripe::shard_of(35)) == 1);
+    assert(stripe.try_lock(35));
+    stripe.unlock(35);
+
+    // Read-write locks.
+    LockStripe<RWLock, 8> rwstripe;
+    auto rwshards = LockStripe<RWLock, 8>::shards_of(1, 2);
+    rwstripe.lock_all_read(rwshards);
+    rwstripe.lock_read(1);
+    assert(!rwstripe.shard_for(2).try_lock_write());
+    rwstripe.unlock_read(1);
+    rwstripe.unlock_all_read(rwshards);
+    rwstripe.lock_all_write(rwshards);
+    assert(!rwstripe.shard_for(1).try_lock_read());
+    rwstripe.unlock_all_write(rwshards);
+    rwstripe.lock_write(2);
+    rwstripe.unlock_write(2);
+    for (size_t i = 0; i < rwstripe.size(); i++) {
+        assert(rwstripe.contention(i) == 0);
+    }
+}
@@ -0,0 +1,61 @@
+#undef NDEBUG
+
+#include "mcslock.h"
+#include "barrier.h"
+#include <vector>
+#include <thread>
+#include <cassert>
+
+int main() {
+    constexpr size_t num_threads = 100;
+    constexpr size_t num_times = 100;
+    std::vector<int> v;
+    std::vector<std::thread> threads;
+    MCSLock lock;
+    Barrier barrier { num_threads };
+
+    // Uncontended, with an explicit node.
+    MCSLock::Node node;
+    lock.lock(node);
+    assert(!lock.try_lock());
+    v.push_back(35);
+    lock.unlock(node);
+    assert(lock.try_lock(node));
+    lock.unlock(node);
+    assert(v.size() == 1);
+
+    // Contended, using the RAII guard.
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([&v, &barrier, &lock] {
+            barrier.check_in_and_wait();
+            for (size_t j = 0; j < num_times; j++) {
+                MCSLock::Guard guard { lock };
+                v.push_back(35);
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+    assert(v.size() == 1 + num_times * num_threads);
+
+    // Contended, using the per-thread node cache, while holding
+    // several locks at once and releasing them out of order.
+    MCSLock other_lock;
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([&v, &lock, &other_lock] {
+            for (size_t j = 0; j < num_times; j++) {
+                lock.lock();
+                other_lock.lock();
+                v.push_back(35);
+                lock.unlock();
+                other_lock.unlock();
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    assert(v.size() == 1 + 2 * num_times * num_threads);
+}
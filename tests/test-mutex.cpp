@@ -2,6 +2,7 @@
 
 #include "mutex.h"
 #include <vector>
+#include <atomic>
 #include <thread>
 #include <sched.h>
 #include <cassert>
@@ -27,8 +28,83 @@ int main() {
     for (std::thread &thread : threads) {
         thread.join();
     }
+    threads.clear();
 
     assert(v.size() == num_times * num_threads);
+
+    // Short critical sections, so that spinning gets a chance to succeed.
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([&v, &mutex] {
+            for (size_t j = 0; j < num_times; j++) {
+                mutex.lock();
+                v.push_back(35);
+                mutex.unlock();
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    assert(v.size() == 2 * num_times * num_threads);
     assert(mutex.try_lock());
     assert(!mutex.try_lock());
+
+    // Timing out, both with and without other waiters.
+    using namespace std::chrono_literals;
+    assert(!mutex.try_lock_for(1ms));
+    std::thread waiter { [&mutex] {
+        mutex.lock();
+        mutex.unlock();
+    } };
+    assert(!mutex.try_lock_for(1ms));
+    mutex.unlock();
+    waiter.join();
+    assert(mutex.try_lock_for(1ms));
+
+    // A thread that keeps relocking the mutex right after unlocking it must
+    // not starve a waiter: once the waiter has been waiting for long enough,
+    // the mutex gets handed over to it, and can't be grabbed in the meantime.
+    std::atomic_bool acquired { false };
+    std::thread starving { [&mutex, &acquired] {
+        mutex.lock();
+        acquired.store(true);
+        mutex.unlock();
+    } };
+    std::this_thread::sleep_for(5ms);
+    size_t relocked = 0;
+    for (; relocked < 100; relocked++) {
+        mutex.unlock();
+        if (acquired.load() || !mutex.try_lock()) {
+            break;
+        }
+        std::this_thread::sleep_for(2ms);
+    }
+    assert(relocked < 10);
+    starving.join();
+    assert(acquired.load());
+    // Back to normal.
+    assert(mutex.try_lock());
+
+    // A waiter that has given up after waiting for too long leaves the mutex
+    // in the starvation mode, so it's handed over to the next waiter...
+    std::thread waiter2 { [&mutex] {
+        mutex.lock();
+        mutex.unlock();
+    } };
+    std::thread impatient { [&mutex] {
+        assert(!mutex.try_lock_for(5ms));
+    } };
+    impatient.join();
+    mutex.unlock();
+    waiter2.join();
+    // ...or, if there's nobody left waiting, simply unlocked.
+    assert(mutex.try_lock());
+    impatient = std::thread { [&mutex] {
+        assert(!mutex.try_lock_for(5ms));
+    } };
+    impatient.join();
+    mutex.unlock();
+    assert(mutex.try_lock());
+    mutex.unlock();
 }
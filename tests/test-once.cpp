@@ -3,7 +3,11 @@
 #include "once.h"
 #include "barrier.h"
 #include <vector>
+#include <atomic>
+#include <stdexcept>
 #include <thread>
+#include <pthread.h>
+#include <sched.h>
 #include <cassert>
 
 int main() {
@@ -45,4 +49,106 @@ int main() {
         v.push_back(35);
     });
     assert(v.size() == 1 + num_times);
+
+    // Timing out while somebody else is performing.
+    using namespace std::chrono_literals;
+    Once once3;
+    Barrier started { 1 };
+    Barrier timed_out { 1 };
+    std::thread performer { [&] {
+        once3.perform([&] {
+            started.check_in();
+            timed_out.wait();
+        });
+    } };
+    started.wait();
+    assert(!once3.perform_for([] { assert(false); }, 1ms));
+    timed_out.check_in();
+    assert(once3.perform_for([] { assert(false); }, 10s));
+    performer.join();
+
+    // A callback that throws leaves the once as it was.
+    Once once4;
+    try {
+        once4.perform([] {
+            throw std::runtime_error("oops");
+        });
+        assert(false);
+    } catch (const std::runtime_error &) { }
+    assert(!once4.is_done());
+    v.clear();
+    once4.perform([&v] {
+        v.push_back(35);
+    });
+    assert(once4.is_done() && v.size() == 1);
+
+    // And one of the threads waiting for it gets to perform it instead.
+    Once once5;
+    Barrier started2 { 1 };
+    std::atomic_size_t performed { 0 };
+    std::thread thrower { [&] {
+        try {
+            once5.perform([&] {
+                started2.check_in();
+                std::this_thread::sleep_for(10ms);
+                throw std::runtime_error("oops");
+            });
+            assert(false);
+        } catch (const std::runtime_error &) { }
+    } };
+    started2.wait();
+    threads.clear();
+    for (size_t i = 0; i < 10; i++) {
+        threads.emplace_back([&once5, &performed] {
+            once5.perform([&performed] {
+                performed++;
+            });
+            assert(performed.load() == 1);
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    thrower.join();
+    assert(performed.load() == 1);
+
+    // If the thread that threw retries right away, it may well get there
+    // before the waiters it woke up do, and then they have to make sure it
+    // wakes them up again; as do the ones still asleep.
+    for (size_t i = 0; i < 20; i++) {
+        Once once6;
+        Barrier started3 { 1 };
+        performed = 0;
+        std::thread retrier { [&] {
+            try {
+                once6.perform([&] {
+                    started3.check_in();
+                    std::this_thread::sleep_for(10ms);
+                    throw std::runtime_error("oops");
+                });
+                assert(false);
+            } catch (const std::runtime_error &) { }
+            once6.perform([&performed] {
+                performed++;
+            });
+        } };
+        started3.wait();
+        threads.clear();
+        for (size_t j = 0; j < 10; j++) {
+            threads.emplace_back([&once6, &performed] {
+                // Make sure the retrier gets there first, even on one CPU.
+                sched_param param { 0 };
+                pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+                once6.perform([&performed] {
+                    performed++;
+                });
+                assert(performed.load() == 1);
+            });
+        }
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+        retrier.join();
+        assert(performed.load() == 1);
+    }
 }
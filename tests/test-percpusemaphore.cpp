@@ -0,0 +1,93 @@
+#undef NDEBUG
+
+#include "percpusemaphore.h"
+#include "barrier.h"
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <sched.h>
+#include <cassert>
+
+constexpr static size_t num_threads = 50;
+constexpr static size_t num_times = 1000;
+
+// Count how many units there are by taking all of them, and put them back.
+static size_t count_units(PerCpuSemaphore &semaphore) {
+    size_t count = 0;
+    while (semaphore.try_down()) {
+        count++;
+    }
+    for (size_t i = 0; i < count; i++) {
+        semaphore.up();
+    }
+    return count;
+}
+
+// A pool with fewer units than threads: there must never be more threads
+// inside than units, and no units must get lost along the way.
+static void pool_test(size_t units, uint32_t cache_size) {
+    std::vector<std::thread> threads;
+    PerCpuSemaphore semaphore { units, cache_size };
+    Barrier barrier { num_threads };
+    std::atomic_size_t inside { 0 };
+
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([&] {
+            barrier.check_in_and_wait();
+            for (size_t j = 0; j < num_times; j++) {
+                semaphore.down();
+                size_t inside2 = inside.fetch_add(1) + 1;
+                assert(inside2 <= units);
+                if (j % 10 == 0) {
+                    sched_yield();
+                }
+                inside.fetch_sub(1);
+                semaphore.up();
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    assert(count_units(semaphore) == units);
+}
+
+int main() {
+    pool_test(1, 64);
+    pool_test(4, 64);
+    pool_test(40, 8);
+    pool_test(1000, 64);
+    pool_test(1000, 1);
+
+    // Units released into the caches are all still there.
+    PerCpuSemaphore semaphore { 0, 16 };
+    assert(!semaphore.try_down());
+    for (size_t i = 0; i < 100; i++) {
+        semaphore.up();
+    }
+    assert(count_units(semaphore) == 100);
+    std::thread other { [&semaphore] {
+        for (size_t i = 0; i < 100; i++) {
+            semaphore.down();
+        }
+        assert(!semaphore.try_down());
+    } };
+    other.join();
+
+    // Blocking, and timing out.
+    using namespace std::chrono_literals;
+    assert(!semaphore.down_for(1ms));
+    std::thread waiter { [&semaphore] {
+        semaphore.down();
+        semaphore.down();
+    } };
+    std::this_thread::sleep_for(10ms);
+    semaphore.up();
+    std::this_thread::sleep_for(10ms);
+    semaphore.up();
+    waiter.join();
+    assert(!semaphore.try_down());
+    semaphore.up();
+    assert(semaphore.down_for(1ms));
+}
@@ -0,0 +1,130 @@
+#undef NDEBUG
+
+#include "pimutex.h"
+#include "picondvar.h"
+#include <vector>
+#include <deque>
+#include <thread>
+#include <sched.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cassert>
+
+constexpr static size_t num_threads = 10;
+constexpr static size_t num_times = 1000;
+
+void lock_test() {
+    PIMutex mutex;
+    size_t counter = 0;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([&] {
+            for (size_t j = 0; j < num_times; j++) {
+                mutex.lock();
+                size_t value = counter;
+                // Get preempted while holding the mutex every now and then,
+                // so that the others have to go through the kernel.
+                if (j % 16 == 0) {
+                    sched_yield();
+                }
+                counter = value + 1;
+                mutex.unlock();
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    assert(counter == num_threads * num_times);
+    assert(mutex.try_lock());
+    mutex.unlock();
+}
+
+void timeout_test() {
+    using namespace std::chrono_literals;
+    PIMutex mutex;
+    mutex.lock();
+    std::thread other { [&mutex] {
+        assert(!mutex.try_lock());
+        assert(!mutex.try_lock_for(1ms));
+    } };
+    other.join();
+    std::thread other2 { [&mutex] {
+        assert(mutex.try_lock_for(1s));
+        mutex.unlock();
+    } };
+    usleep(10000);
+    mutex.unlock();
+    other2.join();
+}
+
+void condvar_test() {
+    PIMutex mutex;
+    PICondVar condvar { mutex };
+    std::deque<size_t> queue;
+    bool done = false;
+    size_t sum = 0;
+    std::vector<std::thread> consumers;
+    for (size_t i = 0; i < num_threads; i++) {
+        consumers.emplace_back([&] {
+            mutex.lock();
+            while (true) {
+                condvar.wait([&] {
+                    return !queue.empty() || done;
+                });
+                if (queue.empty()) {
+                    break;
+                }
+                sum += queue.front();
+                queue.pop_front();
+            }
+            mutex.unlock();
+        });
+    }
+    for (size_t i = 0; i < num_times; i++) {
+        mutex.lock();
+        queue.push_back(i);
+        mutex.unlock();
+        condvar.notify_one();
+    }
+    mutex.lock();
+    done = true;
+    mutex.unlock();
+    condvar.notify_all();
+    for (std::thread &thread : consumers) {
+        thread.join();
+    }
+    assert(sum == num_times * (num_times - 1) / 2);
+
+    // Timing out re-locks the mutex too.
+    using namespace std::chrono_literals;
+    mutex.lock();
+    assert(!condvar.wait_for(1ms));
+    assert(!mutex.try_lock());
+    mutex.unlock();
+}
+
+void fork_test() {
+    // The child's thread has a new thread ID, and it must use that one as the
+    // owner, rather than the parent's.
+    PIMutex mutex;
+    mutex.lock();
+    mutex.unlock();
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        assert(current_tid() == (uint32_t) getpid());
+        lock_test();
+        _exit(0);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main() {
+    lock_test();
+    timeout_test();
+    condvar_test();
+    fork_test();
+}
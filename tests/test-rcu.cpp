@@ -0,0 +1,109 @@
+#undef NDEBUG
+
+#include "rcu.h"
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <sched.h>
+#include <cassert>
+
+struct Config {
+    std::atomic_bool alive { true };
+    uint64_t version;
+
+    explicit Config(uint64_t version) : version(version) { }
+};
+
+static std::atomic<Config *> current;
+static std::atomic_size_t retired { 0 };
+
+struct Retired {
+    ~Retired() {
+        retired.fetch_add(1);
+    }
+};
+
+static void run(size_t num_readers, size_t num_updates) {
+    current.store(new Config(0));
+    std::atomic_bool done { false };
+    std::vector<std::thread> readers;
+    for (size_t i = 0; i < num_readers; i++) {
+        readers.emplace_back([&done] {
+            uint64_t last_version = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                RCU::read_lock();
+                Config *config = current.load(std::memory_order_acquire);
+                // Nesting doesn't end the outer critical section.
+                RCU::read_lock();
+                RCU::read_unlock();
+                sched_yield();
+                assert(config->alive.load(std::memory_order_relaxed));
+                assert(config->version >= last_version);
+                last_version = config->version;
+                RCU::read_unlock();
+            }
+        });
+    }
+
+    for (uint64_t version = 1; version <= num_updates; version++) {
+        Config *old = current.exchange(
+            new Config(version), std::memory_order_acq_rel
+        );
+        if (version % 2) {
+            RCU::synchronize();
+            // No reader may be looking at it anymore.
+            old->alive.store(false, std::memory_order_relaxed);
+            delete old;
+        } else {
+            RCU::retire(old);
+        }
+    }
+    done.store(true);
+    for (std::thread &reader : readers) {
+        reader.join();
+    }
+    delete current.load();
+}
+
+int main() {
+    run(4, 200);
+
+    // Deferred callbacks run in order, after a grace period.
+    size_t retired_before = retired.load();
+    std::vector<int> order;
+    for (int i = 0; i < 100; i++) {
+        RCU::call([&order, i] {
+            order.push_back(i);
+        });
+        RCU::retire(new Retired);
+    }
+    RCU::barrier();
+    assert(retired.load() == retired_before + 100);
+    assert(order.size() == 100);
+    for (int i = 0; i < 100; i++) {
+        assert(order[i] == i);
+    }
+
+    // A synchronize() that has to sleep until a reader leaves.
+    std::atomic_bool reading { false };
+    std::thread long_reader { [&reading] {
+        RCU::read_lock();
+        reading.store(true);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        RCU::read_unlock();
+    } };
+    while (!reading.load()) {
+        sched_yield();
+    }
+    auto start = std::chrono::steady_clock::now();
+    RCU::synchronize();
+    assert(std::chrono::steady_clock::now() - start >=
+        std::chrono::milliseconds(10));
+    long_reader.join();
+
+    // The same, with the read-side fences replaced by membarrier().
+    if (RCU::enable_membarrier()) {
+        run(4, 200);
+        RCU::barrier();
+    }
+}
@@ -0,0 +1,51 @@
+#undef NDEBUG
+
+#include "robustmutex.h"
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <new>
+#include <thread>
+#include <cassert>
+
+int main() {
+    using namespace std::chrono_literals;
+
+    // A thread exiting with the mutex held.
+    RobustMutex mutex;
+    std::thread { [&mutex] {
+        assert(mutex.lock() == RobustMutex::ACQUIRED);
+    } }.join();
+    assert(mutex.lock() == RobustMutex::OWNER_DIED);
+    mutex.mark_consistent();
+    mutex.unlock();
+    assert(mutex.try_lock() == RobustMutex::ACQUIRED);
+    std::thread { [&mutex] {
+        assert(mutex.try_lock() == RobustMutex::BUSY);
+        assert(mutex.try_lock_for(1ms) == RobustMutex::BUSY);
+    } }.join();
+    mutex.unlock();
+
+    // A process dying with a mutex in shared memory held.
+    void *memory = mmap(
+        nullptr, sizeof(RobustMutex), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0
+    );
+    assert(memory != MAP_FAILED);
+    RobustMutex *shared = new (memory) RobustMutex;
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        shared->lock();
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(shared->lock() == RobustMutex::OWNER_DIED);
+    // Give up on repairing it.
+    shared->unlock();
+    assert(shared->lock() == RobustMutex::NOT_RECOVERABLE);
+    shared->~RobustMutex();
+    munmap(memory, sizeof(RobustMutex));
+}
@@ -3,6 +3,7 @@
 #include "rwlock.h"
 #include "barrier.h"
 #include <vector>
+#include <atomic>
 #include <thread>
 #include <sched.h>
 #include <cassert>
@@ -49,4 +50,96 @@ int main() {
     rwlock.lock_read();
     assert(!rwlock.try_upgrade());
     assert(v.size() == std::min(num_threads, num_times / write_ratio));
+
+    // A writer timing out must not leave the readers
+    // that queued up behind it waiting forever.
+    using namespace std::chrono_literals;
+    rwlock.unlock_read();
+    assert(!rwlock.try_lock_write_for(1ms));
+    std::thread writer { [&rwlock] {
+        assert(!rwlock.try_lock_write_for(10ms));
+    } };
+    sched_yield();
+    std::thread reader { [&rwlock] {
+        rwlock.lock_read();
+        rwlock.unlock_read();
+    } };
+    writer.join();
+    rwlock.unlock_read();
+    reader.join();
+    assert(rwlock.try_lock_write_for(1ms));
+    assert(!rwlock.try_lock_read_for(1ms));
+
+    // Phase fairness: once the writer is done, the reader that has been waiting
+    // goes before the writer that has been waiting, and then a new reader has
+    // to wait for the writer.
+    std::vector<char> order;
+    std::thread waiting_reader { [&rwlock, &order] {
+        rwlock.lock_read();
+        order.push_back('r');
+        std::this_thread::sleep_for(10ms);
+        rwlock.unlock_read();
+    } };
+    std::this_thread::sleep_for(10ms);
+    std::thread waiting_writer { [&rwlock, &order] {
+        rwlock.lock_write();
+        order.push_back('w');
+        rwlock.unlock_write();
+    } };
+    std::this_thread::sleep_for(10ms);
+    rwlock.unlock_write();
+    std::this_thread::sleep_for(5ms);
+    assert(!rwlock.try_lock_read());
+    rwlock.lock_read();
+    order.push_back('R');
+    rwlock.unlock_read();
+    waiting_reader.join();
+    waiting_writer.join();
+    assert((order == std::vector<char> { 'r', 'w', 'R' }));
+
+    // Optimistic reads: a writer keeps the two fields equal, so a validated
+    // optimistic read must never see them differ.
+    RWLock seqlock;
+    std::atomic_uint64_t a { 0 }, b { 0 };
+    std::atomic_bool done { false };
+    std::thread optimistic_writer { [&] {
+        for (uint64_t i = 1; i <= 10000; i++) {
+            seqlock.lock_write();
+            a.store(i, std::memory_order_relaxed);
+            if (i % 100 == 0) {
+                sched_yield();
+            }
+            b.store(i, std::memory_order_relaxed);
+            seqlock.unlock_write();
+        }
+        done.store(true);
+    } };
+    while (!done.load()) {
+        uint32_t stamp = seqlock.try_optimistic_read();
+        uint64_t a2 = a.load(std::memory_order_relaxed);
+        uint64_t b2 = b.load(std::memory_order_relaxed);
+        if (seqlock.validate(stamp)) {
+            assert(a2 == b2);
+        }
+    }
+    optimistic_writer.join();
+
+    uint32_t stamp = seqlock.try_optimistic_read();
+    assert(stamp != 0 && seqlock.validate(stamp));
+    assert(seqlock.try_convert_to_read(stamp));
+    // Readers don't invalidate stamps.
+    assert(seqlock.validate(stamp));
+    seqlock.unlock_read();
+    assert(seqlock.try_convert_to_write(stamp));
+    assert(seqlock.try_optimistic_read() == 0);
+    assert(!seqlock.validate(stamp));
+    seqlock.unlock_write();
+    assert(!seqlock.validate(stamp));
+    assert(!seqlock.try_convert_to_read(stamp));
+    assert(!seqlock.try_convert_to_write(stamp));
+    stamp = seqlock.try_optimistic_read();
+    assert(seqlock.try_convert_to_write(stamp));
+    seqlock.downgrade();
+    assert(!seqlock.validate(stamp));
+    seqlock.unlock_read();
 }
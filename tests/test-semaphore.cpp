@@ -94,8 +94,92 @@ void nonbinary_test() {
     assert(!semaphore.try_down());
 }
 
+void timeout_test() {
+    using namespace std::chrono_literals;
+    Semaphore semaphore { 0 };
+    std::atomic_uint32_t got { 0 };
+
+    assert(!semaphore.down_for(1ms));
+
+    // Let a few threads time out while others wait, and make sure
+    // the ones that are still waiting get woken up.
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < 10; i++) {
+        threads.emplace_back([i, &semaphore, &got] {
+            if (i % 2) {
+                semaphore.down_for(1ms);
+            } else {
+                semaphore.down();
+                got.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    usleep(10000);
+    for (size_t i = 0; i < 5; i++) {
+        semaphore.up();
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    assert(got.load(std::memory_order_relaxed) == 5);
+}
+
+void batch_test() {
+    constexpr size_t num = 8;
+    Semaphore semaphore { 0 };
+
+    // A batch should only be taken as a whole.
+    semaphore.up(2);
+    assert(!semaphore.try_down(3));
+    assert(semaphore.try_down(2));
+    assert(!semaphore.try_down());
+
+    // Release a whole bunch of waiters at once.
+    std::vector<std::thread> threads;
+    std::atomic_uint32_t got { 0 };
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([&semaphore, &got] {
+            semaphore.down();
+            got.fetch_add(1, std::memory_order_relaxed);
+        });
+    }
+    usleep(10000);
+    semaphore.up(num_threads);
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+    assert(got.load(std::memory_order_relaxed) == num_threads);
+    assert(!semaphore.try_down());
+
+    // Threads taking batches of different sizes should never
+    // hold more than there is, and never get stuck.
+    semaphore.up(num);
+    std::atomic_uint32_t value { 0 };
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([i, &semaphore, &value] {
+            uint32_t n = 1 + i % 4;
+            for (size_t j = 0; j < num_times; j++) {
+                semaphore.down(n);
+                uint32_t v = n + value.fetch_add(n, std::memory_order_relaxed);
+                assert(v <= num);
+                sched_yield();
+                value.fetch_sub(n, std::memory_order_relaxed);
+                semaphore.up(n);
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    assert(semaphore.try_down(num));
+    assert(!semaphore.try_down());
+}
+
 int main() {
     lock_test();
     event_test();
     nonbinary_test();
+    timeout_test();
+    batch_test();
 }
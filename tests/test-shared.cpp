@@ -0,0 +1,111 @@
+#undef NDEBUG
+
+// Only built with the process_shared option: the primitives live in
+// MAP_SHARED memory, and get used by forked processes.
+
+#include "mutex.h"
+#include "condvar.h"
+#include "semaphore.h"
+#include "event.h"
+#include "rwlock.h"
+#include "barrier.h"
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <new>
+#include <type_traits>
+#include <cassert>
+
+#ifndef SYNC_PRIMITIVES_PROCESS_SHARED
+#error "This test needs the process_shared build option"
+#endif
+
+// Whatever is placed in shared memory must not depend on where it's mapped.
+static_assert(std::is_standard_layout_v<Mutex>);
+static_assert(std::is_standard_layout_v<CondVar>);
+static_assert(std::is_standard_layout_v<Semaphore>);
+static_assert(std::is_standard_layout_v<Event>);
+static_assert(std::is_standard_layout_v<RWLock>);
+static_assert(std::is_standard_layout_v<Barrier>);
+
+constexpr size_t num_processes = 4;
+constexpr size_t iterations = 10000;
+
+struct Shared {
+    Mutex mutex;
+    CondVar condvar { mutex };
+    size_t counter = 0;
+    size_t ready = 0;
+    Semaphore semaphore { 0 };
+    Event event;
+    RWLock rwlock;
+    size_t rw_counter = 0;
+    Barrier barrier { num_processes };
+};
+
+static void child(Shared *shared) {
+    for (size_t i = 0; i < iterations; i++) {
+        shared->mutex.lock();
+        shared->counter++;
+        shared->mutex.unlock();
+    }
+    for (size_t i = 0; i < iterations; i++) {
+        shared->rwlock.lock_write();
+        shared->rw_counter++;
+        shared->rwlock.unlock_write();
+        shared->rwlock.lock_read();
+        assert(shared->rw_counter > 0);
+        shared->rwlock.unlock_read();
+    }
+
+    shared->mutex.lock();
+    shared->ready++;
+    shared->condvar.notify_all();
+    shared->mutex.unlock();
+
+    shared->event.wait();
+    shared->semaphore.up();
+    shared->barrier.check_in_and_wait();
+}
+
+int main() {
+    void *memory = mmap(
+        nullptr, sizeof(Shared), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0
+    );
+    assert(memory != MAP_FAILED);
+    Shared *shared = new (memory) Shared;
+
+    // All but one of the processes taking part in the barrier are children.
+    pid_t pids[num_processes - 1];
+    for (pid_t &pid : pids) {
+        pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+            child(shared);
+            _exit(0);
+        }
+    }
+
+    shared->mutex.lock();
+    shared->condvar.wait([shared] {
+        return shared->ready == num_processes - 1;
+    });
+    assert(shared->counter == (num_processes - 1) * iterations);
+    shared->mutex.unlock();
+
+    shared->event.notify();
+    for (size_t i = 0; i < num_processes - 1; i++) {
+        shared->semaphore.down();
+    }
+    shared->barrier.check_in_and_wait();
+
+    for (pid_t pid : pids) {
+        int status;
+        waitpid(pid, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    assert(shared->rw_counter == (num_processes - 1) * iterations);
+    shared->~Shared();
+    munmap(memory, sizeof(Shared));
+}
@@ -0,0 +1,143 @@
+#undef NDEBUG
+
+#include "stats.h"
+#include "mutex.h"
+#include "rwlock.h"
+#include "semaphore.h"
+#include <string>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+
+#ifndef SYNC_PRIMITIVES_STATS
+#error "This test needs the statistics compiled in"
+#endif
+
+// The line that dump_lock_stats() prints for the lock with the given name.
+static std::string dump_line(const char *quoted_name) {
+    char *buffer = nullptr;
+    size_t size = 0;
+    FILE *out = open_memstream(&buffer, &size);
+    dump_lock_stats(out);
+    fclose(out);
+    std::string dump { buffer, size };
+    free(buffer);
+    std::string needle = std::string("\"name\": ") + quoted_name + ",";
+    size_t at = dump.find(needle);
+    assert(at != std::string::npos);
+    size_t start = dump.rfind('\n', at);
+    start = start == std::string::npos ? 0 : start + 1;
+    return dump.substr(start, dump.find('\n', at) - start);
+}
+
+static unsigned long long field(const std::string &line, const char *key) {
+    std::string needle = std::string("\"") + key + "\": ";
+    size_t at = line.find(needle);
+    assert(at != std::string::npos);
+    return strtoull(line.c_str() + at + needle.size(), nullptr, 10);
+}
+
+// The total count in a histogram.
+static unsigned long long total(const std::string &line, const char *key) {
+    std::string needle = std::string("\"") + key + "\": [";
+    size_t at = line.find(needle);
+    assert(at != std::string::npos);
+    const char *p = line.c_str() + at + needle.size();
+    unsigned long long sum = 0;
+    while (*p != ']') {
+        char *end;
+        sum += strtoull(p, &end, 10);
+        p = end;
+        while (*p == ',' || *p == ' ') {
+            p++;
+        }
+    }
+    return sum;
+}
+
+int main() {
+    using namespace std::chrono_literals;
+
+    // One uncontended acquisition, and one that has to sleep.
+    Mutex mutex;
+    mutex.set_name("mutex \"quoted\" \\ name");
+    mutex.lock();
+    std::thread waiter { [&mutex] {
+        mutex.lock();
+        mutex.unlock();
+    } };
+    std::this_thread::sleep_for(10ms);
+    mutex.unlock();
+    waiter.join();
+    std::string line = dump_line("\"mutex \\\"quoted\\\" \\\\ name\"");
+    assert(line.find("\"kind\": \"Mutex\"") != std::string::npos);
+    assert(line.find("test-stats.cpp") != std::string::npos);
+    assert(field(line, "fast_path") == 1);
+    assert(field(line, "slow_path") == 1);
+    assert(field(line, "sleeps") >= 1);
+    // The waiter can't know it was the only one, so it wakes nobody on unlock.
+    assert(field(line, "empty_wakes") <= 1);
+    assert(total(line, "wait_times") == 1);
+    assert(total(line, "hold_times") == 2);
+
+    // A reader waiting for a writer.
+    RWLock rwlock;
+    rwlock.set_name("rwlock");
+    rwlock.lock_write();
+    std::thread reader { [&rwlock] {
+        rwlock.lock_read();
+        rwlock.unlock_read();
+    } };
+    std::this_thread::sleep_for(10ms);
+    rwlock.unlock_write();
+    reader.join();
+    line = dump_line("\"rwlock\"");
+    assert(line.find("\"kind\": \"RWLock\"") != std::string::npos);
+    assert(field(line, "fast_path") == 1);
+    assert(field(line, "slow_path") == 1);
+    assert(field(line, "sleeps") >= 1);
+    assert(total(line, "wait_times") == 1);
+    // Only the writer counts as holding the lock.
+    assert(total(line, "hold_times") == 1);
+
+    // A thread waiting for a unit.
+    Semaphore semaphore { 0 };
+    semaphore.set_name("semaphore");
+    std::thread down { [&semaphore] {
+        semaphore.down();
+    } };
+    std::this_thread::sleep_for(10ms);
+    semaphore.up();
+    down.join();
+    semaphore.up();
+    assert(semaphore.try_down());
+    line = dump_line("\"semaphore\"");
+    assert(line.find("\"kind\": \"Semaphore\"") != std::string::npos);
+    assert(field(line, "fast_path") == 1);
+    assert(field(line, "slow_path") == 1);
+    assert(field(line, "sleeps") >= 1);
+    assert(field(line, "empty_wakes") == 0);
+    assert(total(line, "wait_times") == 1);
+    assert(total(line, "hold_times") == 0);
+
+    // Unnamed locks are dumped too, and dead ones aren't.
+    {
+        Mutex unnamed;
+        line = dump_line("null");
+        assert(line.find("\"kind\": \"Mutex\"") != std::string::npos);
+    }
+    {
+        Mutex temporary;
+        temporary.set_name("temporary");
+    }
+    char *buffer = nullptr;
+    size_t size = 0;
+    FILE *out = open_memstream(&buffer, &size);
+    dump_lock_stats(out);
+    fclose(out);
+    assert(!strstr(buffer, "\"temporary\""));
+    free(buffer);
+}
@@ -0,0 +1,99 @@
+#undef NDEBUG
+
+#include "threadpool.h"
+#include <vector>
+#include <thread>
+#include <cassert>
+
+constexpr static size_t num_threads = 4;
+
+void spawn_test() {
+    std::atomic_size_t count { 0 };
+    {
+        ThreadPool pool { num_threads };
+        for (size_t i = 0; i < 1000; i++) {
+            pool.spawn([&pool, &count] {
+                // Tasks spawning more tasks.
+                for (size_t j = 0; j < 10; j++) {
+                    pool.spawn([&count] {
+                        count.fetch_add(1, std::memory_order_relaxed);
+                    });
+                }
+                count.fetch_add(1, std::memory_order_relaxed);
+            });
+        }
+        // The destructor waits for all of them.
+    }
+    assert(count.load() == 1000 * 11);
+}
+
+static uint64_t fib(ThreadPool &pool, uint64_t n) {
+    if (n < 2) {
+        return n;
+    }
+    uint64_t a, b;
+    TaskGroup group { pool };
+    group.spawn([&pool, &a, n] {
+        a = fib(pool, n - 1);
+    });
+    b = fib(pool, n - 2);
+    group.wait();
+    return a + b;
+}
+
+void task_group_test() {
+    ThreadPool pool { num_threads };
+    // Fork-join from outside the pool, recursing inside it.
+    uint64_t result;
+    TaskGroup group { pool };
+    group.spawn([&pool, &result] {
+        result = fib(pool, 20);
+    });
+    group.wait();
+    assert(result == 6765);
+    // Waiting twice is fine.
+    group.wait();
+}
+
+void parallel_for_test() {
+    ThreadPool pool { num_threads };
+    constexpr size_t n = 100000;
+    std::vector<unsigned char> seen(n);
+    for (size_t grain : { (size_t) 1, (size_t) 7, (size_t) 1000, n * 2 }) {
+        parallel_for(pool, 0, n, [&seen] (size_t i) {
+            seen[i]++;
+        }, grain);
+    }
+    for (size_t i = 0; i < n; i++) {
+        assert(seen[i] == 4);
+    }
+    // Empty ranges do nothing.
+    parallel_for(pool, 5, 5, [] (size_t) {
+        assert(false);
+    });
+}
+
+void idle_test() {
+    // Let the workers fall asleep between bursts,
+    // and make sure they get woken up again.
+    ThreadPool pool { num_threads };
+    for (size_t round = 0; round < 20; round++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::atomic_size_t count { 0 };
+        TaskGroup group { pool };
+        for (size_t i = 0; i < 100; i++) {
+            group.spawn([&count] {
+                count.fetch_add(1, std::memory_order_relaxed);
+            });
+        }
+        group.wait();
+        assert(count.load() == 100);
+    }
+}
+
+int main() {
+    spawn_test();
+    task_group_test();
+    parallel_for_test();
+    idle_test();
+}
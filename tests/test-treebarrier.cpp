@@ -0,0 +1,44 @@
+#undef NDEBUG
+
+#include "treebarrier.h"
+#include <vector>
+#include <thread>
+#include <cassert>
+
+static void test(size_t num_threads) {
+    constexpr size_t num_rounds = 100;
+    std::vector<unsigned> data(num_threads);
+    size_t completed = 0;
+    std::vector<std::thread> threads;
+    TreeBarrier barrier { num_threads, [&] {
+        // Everybody has arrived, and nobody has been released yet.
+        for (size_t j = 0; j < num_threads; j++) {
+            assert(data[j] == completed + 1);
+        }
+        completed++;
+    } };
+
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([i, num_threads, &data, &barrier, &completed] {
+            for (size_t round = 0; round < num_rounds; round++) {
+                data[i]++;
+                barrier.arrive_and_wait(i);
+                assert(completed == round + 1);
+                for (size_t j = 0; j < num_threads; j++) {
+                    assert(data[j] >= round + 1);
+                }
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    assert(completed == num_rounds);
+}
+
+int main() {
+    // Check trees of all kinds of shapes, including partially filled ones.
+    for (size_t num_threads : { 1, 3, 4, 5, 16, 17, 100 }) {
+        test(num_threads);
+    }
+}
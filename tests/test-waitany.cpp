@@ -0,0 +1,136 @@
+#undef NDEBUG
+
+#include "waitany.h"
+#include "event.h"
+#include "semaphore.h"
+#include "mutex.h"
+#include <vector>
+#include <thread>
+#include <unistd.h>
+#include <cassert>
+
+void ready_test() {
+    Event event1, event2;
+    Semaphore semaphore { 1 };
+    Mutex mutex;
+
+    // The first one that's ready wins, and gets acquired.
+    assert(wait_any({ event1, semaphore, mutex }) == 1);
+    assert(!semaphore.try_down());
+    assert(wait_any({ event1, semaphore, mutex }) == 2);
+    assert(!mutex.try_lock());
+    mutex.unlock();
+    event2.notify();
+    assert(wait_any({ event1, event2, mutex }) == 1);
+    // Events stay notified.
+    assert(event2.try_wait());
+}
+
+void timeout_test() {
+    using namespace std::chrono_literals;
+    Event event;
+    Semaphore semaphore { 0 };
+    Mutex mutex;
+    mutex.lock();
+    std::thread other { [&] {
+        assert(wait_any_for({ event, semaphore, mutex }, 1ms) == -1);
+    } };
+    other.join();
+    // Nothing is left acquired, and nobody is left counted in.
+    semaphore.up();
+    assert(semaphore.try_down());
+    mutex.unlock();
+    assert(mutex.try_lock());
+    mutex.unlock();
+}
+
+void wake_test() {
+    Event event;
+    Semaphore semaphore { 0 };
+    Mutex mutex;
+
+    mutex.lock();
+    std::thread waiter { [&] {
+        assert(wait_any({ event, semaphore, mutex }) == 2);
+        mutex.unlock();
+        assert(wait_any({ event, semaphore }) == 1);
+        assert(wait_any({ event, semaphore }) == 0);
+    } };
+    usleep(10000);
+    mutex.unlock();
+    usleep(10000);
+    semaphore.up();
+    usleep(10000);
+    event.notify();
+    waiter.join();
+}
+
+void workers_test() {
+    // Workers handling units of work until told to shut down.
+    constexpr size_t num_threads = 10;
+    constexpr size_t num_units = 10000;
+    Event shutdown;
+    Semaphore work { 0 };
+    std::atomic_size_t handled { 0 };
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([&] {
+            while (wait_any({ work, shutdown }) == 0) {
+                handled.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    for (size_t i = 0; i < num_units; i++) {
+        work.up();
+    }
+    // With the work listed first, it gets drained before shutting down.
+    while (handled.load() != num_units) {
+        usleep(1000);
+    }
+    shutdown.notify();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    assert(!work.try_down());
+}
+
+void pass_on_test() {
+    // If a wakeup meant for a semaphore or a mutex lands on a thread that takes
+    // something else instead, it must not get lost.
+    for (size_t round = 0; round < 100; round++) {
+        Event event;
+        Semaphore semaphore { 0 };
+        Mutex mutex;
+        mutex.lock();
+        std::thread any { [&] {
+            int which = wait_any({ event, semaphore, mutex });
+            if (which == 2) {
+                mutex.unlock();
+            } else if (which == 1) {
+                semaphore.up();
+            }
+        } };
+        std::thread down { [&] {
+            semaphore.down();
+        } };
+        std::thread lock { [&] {
+            mutex.lock();
+            mutex.unlock();
+        } };
+        usleep(100);
+        event.notify();
+        semaphore.up();
+        mutex.unlock();
+        any.join();
+        down.join();
+        lock.join();
+    }
+}
+
+int main() {
+    ready_test();
+    timeout_test();
+    wake_test();
+    workers_test();
+    pass_on_test();
+}